@@ -0,0 +1,86 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <limits>
+
+// Axis-aligned bounding box in world space
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    // Default box is empty so that expanding it by anything yields that thing
+    AABB()
+        : min(std::numeric_limits<float>::infinity())
+        , max(-std::numeric_limits<float>::infinity())
+    {}
+
+    AABB(const glm::vec3& lo, const glm::vec3& hi)
+        : min(lo)
+        , max(hi)
+    {}
+
+    bool isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    // Grows the box by a small margin so that rounding in the shape kernels
+    // can never produce a hit just outside its bounds
+    void pad() {
+        glm::vec3 margin = (max - min) * 1e-4f + glm::vec3(1e-5f);
+        min -= margin;
+        max += margin;
+    }
+
+    glm::vec3 centroid() const {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 extent() const {
+        return max - min;
+    }
+
+    float surfaceArea() const {
+        if (isEmpty()) return 0.0f;
+        glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Slab test. Returns true if the ray enters the box before tMax and sets the entry distance.
+    bool intersect(const glm::vec3& origin, const glm::vec3& invDir, float tMax, float& tEntry) const {
+        float tx1 = (min.x - origin.x) * invDir.x;
+        float tx2 = (max.x - origin.x) * invDir.x;
+        float ty1 = (min.y - origin.y) * invDir.y;
+        float ty2 = (max.y - origin.y) * invDir.y;
+        float tz1 = (min.z - origin.z) * invDir.z;
+        float tz2 = (max.z - origin.z) * invDir.z;
+
+        float tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.0f));
+        float tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), tMax));
+
+        tEntry = tNear;
+        return tNear <= tFar;
+    }
+
+    // Bounds of this box after transforming all eight corners by a matrix
+    AABB transformed(const glm::mat4& matrix) const {
+        AABB result;
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner((i & 1) ? max.x : min.x,
+                             (i & 2) ? max.y : min.y,
+                             (i & 4) ? max.z : min.z);
+            glm::vec4 p = matrix * glm::vec4(corner, 1.0f);
+            result.expand(glm::vec3(p) / p.w);
+        }
+        return result;
+    }
+};
@@ -0,0 +1,309 @@
+#include "bvh.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <utility>
+#include "../utils/thread_pool.h"
+
+void BVH::clear() {
+    nodes.clear();
+    primitiveIndices.clear();
+    stats = BuildStats();
+}
+
+bool BVH::isValidLayout(const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& indices,
+                        uint32_t primitiveCount) {
+    for (uint32_t index : indices) {
+        if (index >= primitiveCount) return false;
+    }
+
+    // Children come later, so a forward sweep knows each node's depth before its
+    // children's; a node reached along several paths keeps its deepest one
+    size_t nodeCount = nodes.size();
+    std::vector<int> depth(nodeCount, 0);
+    for (size_t i = 0; i < nodeCount; ++i) {
+        const BVHNode& node = nodes[i];
+        if (node.count > 0) {
+            if (uint64_t(node.offset) + node.count > indices.size()) return false;
+            continue;
+        }
+        // Traversal pushes one entry per interior node on the way down
+        if (node.axis >= 3 || i + 1 >= nodeCount || node.offset <= i + 1 || node.offset >= nodeCount ||
+            depth[i] + 1 > MAX_STACK_DEPTH) {
+            return false;
+        }
+        depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+        depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+    }
+    return true;
+}
+
+void BVH::assign(std::vector<BVHNode>&& builtNodes, std::vector<uint32_t>&& builtIndices, const BuildStats& builtStats) {
+    nodes = std::move(builtNodes);
+    primitiveIndices = std::move(builtIndices);
+    stats = builtStats;
+}
+
+float BVH::refit(const std::vector<AABB>& primitiveBounds) {
+    // Children always come after their parent in the depth-first layout, so a
+    // reverse sweep sees both children of a node before the node itself
+    for (size_t i = nodes.size(); i-- > 0;) {
+        BVHNode& node = nodes[i];
+        AABB bounds;
+        if (node.count > 0) {
+            for (uint32_t slot = node.offset; slot < node.offset + node.count; ++slot) {
+                AABB primitive = primitiveBounds[primitiveIndices[slot]];
+                primitive.pad();
+                bounds.expand(primitive);
+            }
+        } else {
+            bounds = nodes[i + 1].bounds;
+            bounds.expand(nodes[node.offset].bounds);
+        }
+        node.bounds = bounds;
+    }
+
+    stats.sahCost = computeSAHCost();
+    return stats.sahCost;
+}
+
+void BVH::build(const std::vector<AABB>& primitiveBounds, int maxLeafSize, ThreadPool* pool) {
+    auto start = std::chrono::steady_clock::now();
+    clear();
+    maxLeafSize = std::max(maxLeafSize, 1);
+
+    std::vector<BuildPrimitive> prims;
+    prims.reserve(primitiveBounds.size());
+    for (size_t i = 0; i < primitiveBounds.size(); ++i) {
+        AABB bounds = primitiveBounds[i];
+        if (bounds.isEmpty()) continue;
+        bounds.pad();
+        prims.push_back({bounds, bounds.centroid(), static_cast<uint32_t>(i)});
+    }
+
+    stats.primitiveCount = static_cast<int>(prims.size());
+    int count = static_cast<int>(prims.size());
+
+    // Small builds are not worth handing out
+    const int MIN_PARALLEL_PRIMITIVES = 4096;
+    if (pool && pool->size() > 1 && count >= MIN_PARALLEL_PRIMITIVES) {
+        // Several tasks per worker, so uneven subtrees balance out
+        int taskSize = std::max(count / (pool->size() * 8), MIN_PARALLEL_PRIMITIVES / 4);
+        std::vector<TopNode> top;
+        std::vector<BuildTask> tasks;
+        buildTop(prims, 0, count, 1, maxLeafSize, taskSize, top, tasks);
+
+        pool->parallelFor(static_cast<int>(tasks.size()), [&](int i) {
+            BuildTask& task = tasks[i];
+            buildRecursive(prims, task.begin, task.end, task.depth, maxLeafSize, task.output);
+        });
+
+        size_t nodeCount = top.size();
+        for (const BuildTask& task : tasks) {
+            nodeCount += task.output.nodes.size();
+            stats.maxDepth = std::max(stats.maxDepth, task.output.maxDepth);
+            stats.leafCount += task.output.leafCount;
+        }
+        nodes.reserve(nodeCount);
+        primitiveIndices.reserve(prims.size());
+        flattenTop(top, tasks, 0);
+    } else if (count > 0) {
+        BuildOutput out;
+        out.nodes.reserve(2 * prims.size());
+        out.primitiveIndices.reserve(prims.size());
+        buildRecursive(prims, 0, count, 1, maxLeafSize, out);
+        nodes = std::move(out.nodes);
+        primitiveIndices = std::move(out.primitiveIndices);
+        stats.maxDepth = out.maxDepth;
+        stats.leafCount = out.leafCount;
+    }
+
+    stats.nodeCount = static_cast<int>(nodes.size());
+    stats.sahCost = computeSAHCost();
+    stats.buildMilliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+int BVH::partitionRange(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                        const AABB& bounds, const AABB& centroidBounds, int& axis) {
+    int count = end - begin;
+    if (count <= maxLeafSize) {
+        return -1;
+    }
+
+    glm::vec3 centroidExtent = centroidBounds.extent();
+    axis = 0;
+    if (centroidExtent.y > centroidExtent[axis]) axis = 1;
+    if (centroidExtent.z > centroidExtent[axis]) axis = 2;
+
+    int mid = -1;
+    if (depth < MAX_SAH_DEPTH && centroidExtent[axis] > 0.0f) {
+        // Bin centroids along the widest axis and evaluate the SAH at every bin boundary
+        struct Bin { AABB bounds; int count = 0; };
+        Bin bins[BIN_COUNT];
+        float scale = BIN_COUNT / centroidExtent[axis];
+        int splitAxis = axis;
+        auto binOf = [&](const BuildPrimitive& p) {
+            int b = static_cast<int>((p.centroid[splitAxis] - centroidBounds.min[splitAxis]) * scale);
+            return std::min(b, BIN_COUNT - 1);
+        };
+        for (int i = begin; i < end; ++i) {
+            Bin& bin = bins[binOf(prims[i])];
+            bin.bounds.expand(prims[i].bounds);
+            ++bin.count;
+        }
+
+        float rightArea[BIN_COUNT - 1];
+        int rightCount[BIN_COUNT - 1];
+        AABB accumulated;
+        int accumulatedCount = 0;
+        for (int b = BIN_COUNT - 1; b > 0; --b) {
+            accumulated.expand(bins[b].bounds);
+            accumulatedCount += bins[b].count;
+            rightArea[b - 1] = accumulated.surfaceArea();
+            rightCount[b - 1] = accumulatedCount;
+        }
+
+        float bestCost = std::numeric_limits<float>::infinity();
+        int bestSplit = -1;
+        accumulated = AABB();
+        accumulatedCount = 0;
+        for (int b = 0; b < BIN_COUNT - 1; ++b) {
+            accumulated.expand(bins[b].bounds);
+            accumulatedCount += bins[b].count;
+            if (accumulatedCount == 0 || rightCount[b] == 0) continue;
+            float cost = accumulated.surfaceArea() * accumulatedCount + rightArea[b] * rightCount[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        // Traversal step costs about as much as one primitive test
+        float leafCost = bounds.surfaceArea() * count;
+        float splitCost = bounds.surfaceArea() + bestCost;
+        bool preferLeaf = bestSplit < 0 || splitCost >= leafCost;
+        if (preferLeaf && count <= MAX_SAH_LEAF_SIZE) {
+            return -1;
+        }
+        if (bestSplit >= 0) {
+            auto split = std::partition(prims.begin() + begin, prims.begin() + end,
+                [&](const BuildPrimitive& p) { return binOf(p) <= bestSplit; });
+            mid = static_cast<int>(split - prims.begin());
+        }
+    }
+
+    if (mid <= begin || mid >= end) {
+        // Degenerate or very deep subtree: split at the median centroid
+        mid = begin + count / 2;
+        int splitAxis = axis;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+            [splitAxis](const BuildPrimitive& a, const BuildPrimitive& b) { return a.centroid[splitAxis] < b.centroid[splitAxis]; });
+    }
+    return mid;
+}
+
+uint32_t BVH::buildRecursive(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                             BuildOutput& out) {
+    uint32_t nodeIndex = static_cast<uint32_t>(out.nodes.size());
+    out.nodes.push_back(BVHNode());
+    out.maxDepth = std::max(out.maxDepth, depth);
+
+    AABB bounds, centroidBounds;
+    for (int i = begin; i < end; ++i) {
+        bounds.expand(prims[i].bounds);
+        centroidBounds.expand(prims[i].centroid);
+    }
+    out.nodes[nodeIndex].bounds = bounds;
+
+    int axis = 0;
+    int mid = partitionRange(prims, begin, end, depth, maxLeafSize, bounds, centroidBounds, axis);
+    if (mid < 0) {
+        out.nodes[nodeIndex].offset = static_cast<uint32_t>(out.primitiveIndices.size());
+        out.nodes[nodeIndex].count = static_cast<uint16_t>(end - begin);
+        out.nodes[nodeIndex].axis = 0;
+        for (int i = begin; i < end; ++i) {
+            out.primitiveIndices.push_back(prims[i].index);
+        }
+        ++out.leafCount;
+        return nodeIndex;
+    }
+
+    buildRecursive(prims, begin, mid, depth + 1, maxLeafSize, out);
+    uint32_t secondChild = buildRecursive(prims, mid, end, depth + 1, maxLeafSize, out);
+
+    out.nodes[nodeIndex].offset = secondChild;
+    out.nodes[nodeIndex].count = 0;
+    out.nodes[nodeIndex].axis = static_cast<uint16_t>(axis);
+    return nodeIndex;
+}
+
+int BVH::buildTop(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                  int taskSize, std::vector<TopNode>& top, std::vector<BuildTask>& tasks) {
+    int index = static_cast<int>(top.size());
+    top.push_back(TopNode());
+
+    AABB bounds, centroidBounds;
+    for (int i = begin; i < end; ++i) {
+        bounds.expand(prims[i].bounds);
+        centroidBounds.expand(prims[i].centroid);
+    }
+    top[index].bounds = bounds;
+
+    // Ranges at or below the task size are left whole for the workers, which make
+    // exactly the split decisions a serial build would have made from here on
+    int axis = 0;
+    int mid = end - begin > taskSize ? partitionRange(prims, begin, end, depth, maxLeafSize, bounds, centroidBounds, axis) : -1;
+    if (mid < 0) {
+        top[index].task = static_cast<int>(tasks.size());
+        tasks.push_back({begin, end, depth, BuildOutput()});
+        return index;
+    }
+
+    int first = buildTop(prims, begin, mid, depth + 1, maxLeafSize, taskSize, top, tasks);
+    int second = buildTop(prims, mid, end, depth + 1, maxLeafSize, taskSize, top, tasks);
+    top[index].axis = axis;
+    top[index].children[0] = first;
+    top[index].children[1] = second;
+    return index;
+}
+
+uint32_t BVH::flattenTop(const std::vector<TopNode>& top, const std::vector<BuildTask>& tasks, int index) {
+    uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    const TopNode& topNode = top[index];
+
+    if (topNode.task >= 0) {
+        // Subtrees are already depth-first, only their offsets need rebasing
+        const BuildOutput& output = tasks[topNode.task].output;
+        uint32_t indexBase = static_cast<uint32_t>(primitiveIndices.size());
+        for (BVHNode node : output.nodes) {
+            node.offset += node.count > 0 ? indexBase : nodeIndex;
+            nodes.push_back(node);
+        }
+        primitiveIndices.insert(primitiveIndices.end(), output.primitiveIndices.begin(), output.primitiveIndices.end());
+        return nodeIndex;
+    }
+
+    nodes.push_back(BVHNode());
+    nodes[nodeIndex].bounds = topNode.bounds;
+    flattenTop(top, tasks, topNode.children[0]);
+    uint32_t secondChild = flattenTop(top, tasks, topNode.children[1]);
+    nodes[nodeIndex].offset = secondChild;
+    nodes[nodeIndex].count = 0;
+    nodes[nodeIndex].axis = static_cast<uint16_t>(topNode.axis);
+    return nodeIndex;
+}
+
+float BVH::computeSAHCost() const {
+    if (nodes.empty()) return 0.0f;
+
+    float rootArea = nodes[0].bounds.surfaceArea();
+    if (rootArea <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (const BVHNode& node : nodes) {
+        float probability = node.bounds.surfaceArea() / rootArea;
+        cost += probability * (node.count > 0 ? node.count : 1.0f);
+    }
+    return cost;
+}
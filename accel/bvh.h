@@ -0,0 +1,311 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "aabb.h"
+#include "../ray.h"
+#include "../ray_packet.h"
+#include "../utils/bits.h"
+
+class ThreadPool;
+
+// Node of a flattened BVH. Nodes are stored depth-first, so the first child
+// of an interior node always directly follows it in the array.
+struct BVHNode {
+    AABB bounds;
+    uint32_t offset;    // Leaf: first entry in the primitive index array. Interior: index of the second child.
+    uint16_t count;     // Number of primitives in a leaf, 0 for interior nodes
+    uint16_t axis;      // Split axis of an interior node, used to visit the nearer child first
+};
+
+// Counters gathered while traversing a BVH
+struct TraversalStats {
+    uint64_t rays = 0;
+    uint64_t nodesVisited = 0;
+    uint64_t primitiveTests = 0;
+
+    void add(const TraversalStats& other) {
+        rays += other.rays;
+        nodesVisited += other.nodesVisited;
+        primitiveTests += other.primitiveTests;
+    }
+};
+
+// Summary of the most recent BVH build
+struct BuildStats {
+    double buildMilliseconds = 0.0;
+    int primitiveCount = 0;
+    int nodeCount = 0;
+    int leafCount = 0;
+    int maxDepth = 0;
+    float sahCost = 0.0f;   // Expected cost of a random ray under the surface area heuristic
+};
+
+// Bounding volume hierarchy over an array of primitive bounds, built with a
+// binned surface area heuristic and flattened into a single node array
+class BVH {
+private:
+    static const int BIN_COUNT = 16;
+    static const int MAX_STACK_DEPTH = 128;
+    static const int MAX_SAH_DEPTH = 64;      // Deeper subtrees fall back to median splits
+    static const int MAX_SAH_LEAF_SIZE = 16;  // Largest leaf the SAH may choose over splitting
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> primitiveIndices;
+    BuildStats stats;
+
+    struct BuildPrimitive {
+        AABB bounds;
+        glm::vec3 centroid;
+        uint32_t index;
+    };
+
+    // Output of building one subtree, with offsets relative to its own arrays
+    struct BuildOutput {
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> primitiveIndices;
+        int maxDepth = 0;
+        int leafCount = 0;
+    };
+
+    // Node of the top levels of a parallel build. Either splits into two more
+    // top nodes, or stands for a subtree built as a separate task.
+    struct TopNode {
+        AABB bounds;
+        int axis = 0;
+        int children[2] = { -1, -1 };
+        int task = -1;
+    };
+
+    struct BuildTask {
+        int begin, end, depth;
+        BuildOutput output;
+    };
+
+    // Chooses where to split prims[begin, end). Returns -1 when the range should
+    // become a leaf, otherwise the partition point after reordering the range.
+    static int partitionRange(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                              const AABB& bounds, const AABB& centroidBounds, int& axis);
+
+    static uint32_t buildRecursive(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                                   BuildOutput& out);
+
+    // Splits the top of the tree serially until ranges are small enough to hand out as tasks
+    static int buildTop(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, int maxLeafSize,
+                        int taskSize, std::vector<TopNode>& top, std::vector<BuildTask>& tasks);
+
+    // Appends the subtree rooted at a top node to the flattened arrays, depth-first
+    uint32_t flattenTop(const std::vector<TopNode>& top, const std::vector<BuildTask>& tasks, int index);
+
+    float computeSAHCost() const;
+
+public:
+    // Builds the hierarchy. Primitive i is referred to by index i in traversal callbacks.
+    // With a pool, subtrees below the top levels are built on its workers; the
+    // result is identical to a serial build.
+    void build(const std::vector<AABB>& primitiveBounds, int maxLeafSize = 4, ThreadPool* pool = nullptr);
+
+    void clear();
+    bool isEmpty() const { return nodes.empty(); }
+
+    // Recomputes every node's bounds for moved primitives, keeping the tree's
+    // topology. Much cheaper than a build, but the tree degrades as primitives
+    // drift away from where they were when it was built. Returns the new SAH cost.
+    float refit(const std::vector<AABB>& primitiveBounds);
+
+    // Checks that nodes and indices, e.g. read back from a scene cache, form a
+    // hierarchy traversal can walk safely: children lie after their parent and
+    // inside the array, the tree fits the traversal stack, and leaves only name
+    // primitives below primitiveCount
+    static bool isValidLayout(const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& indices,
+                              uint32_t primitiveCount);
+
+    // Adopts a hierarchy built earlier, e.g. one read back from a scene cache
+    void assign(std::vector<BVHNode>&& builtNodes, std::vector<uint32_t>&& builtIndices, const BuildStats& builtStats);
+
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getPrimitiveIndices() const { return primitiveIndices; }
+    const BuildStats& getBuildStats() const { return stats; }
+
+    // Closest-hit traversal. testPrimitive(index, tMax) lowers tMax to the distance of
+    // any nearer hit it finds; nodes entered beyond tMax are skipped.
+    template <typename TestPrimitive>
+    void intersect(const Ray& ray, float& tMax, TestPrimitive&& testPrimitive, TraversalStats* traversalStats = nullptr) const {
+        intersectOrdered(ray, tMax, [&](uint32_t slot, float& maxDistance) {
+            testPrimitive(primitiveIndices[slot], maxDistance);
+        }, traversalStats);
+    }
+
+    // Same traversal, but passes positions in the leaf-ordered primitive index array.
+    // Lets callers that stored their primitives in leaf order skip the indirection.
+    template <typename TestPrimitive>
+    void intersectOrdered(const Ray& ray, float& tMax, TestPrimitive&& testPrimitive, TraversalStats* traversalStats = nullptr) const {
+        if (nodes.empty()) return;
+
+        glm::vec3 origin = ray.getOrigin();
+        glm::vec3 invDir = 1.0f / ray.getDirection();
+        bool dirNegative[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
+
+        uint32_t stack[MAX_STACK_DEPTH];
+        int stackSize = 0;
+        uint32_t current = 0;
+        uint64_t visited = 0;
+        uint64_t tests = 0;
+
+        while (true) {
+            const BVHNode& node = nodes[current];
+            ++visited;
+
+            float tEntry;
+            if (node.bounds.intersect(origin, invDir, tMax, tEntry)) {
+                if (node.count > 0) {
+                    for (uint32_t i = 0; i < node.count; ++i) {
+                        ++tests;
+                        testPrimitive(node.offset + i, tMax);
+                    }
+                } else {
+                    // Visit the child on the near side of the split first so tMax shrinks sooner
+                    if (dirNegative[node.axis]) {
+                        stack[stackSize++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stackSize++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stackSize == 0) break;
+            current = stack[--stackSize];
+        }
+
+        if (traversalStats) {
+            traversalStats->rays += 1;
+            traversalStats->nodesVisited += visited;
+            traversalStats->primitiveTests += tests;
+        }
+    }
+
+    // Any-hit traversal over leaf-ordered slots. Returns as soon as isBlocker(slot)
+    // reports a hit closer than tMax; nodes entered beyond tMax are skipped.
+    template <typename IsBlocker>
+    bool occluded(const Ray& ray, float tMax, IsBlocker&& isBlocker, TraversalStats* traversalStats = nullptr) const {
+        if (nodes.empty()) return false;
+
+        glm::vec3 origin = ray.getOrigin();
+        glm::vec3 invDir = 1.0f / ray.getDirection();
+
+        uint32_t stack[MAX_STACK_DEPTH];
+        int stackSize = 0;
+        uint32_t current = 0;
+        uint64_t visited = 0;
+        uint64_t tests = 0;
+        bool blocked = false;
+
+        while (!blocked) {
+            const BVHNode& node = nodes[current];
+            ++visited;
+
+            float tEntry;
+            if (node.bounds.intersect(origin, invDir, tMax, tEntry)) {
+                if (node.count > 0) {
+                    for (uint32_t i = 0; i < node.count && !blocked; ++i) {
+                        ++tests;
+                        blocked = isBlocker(node.offset + i);
+                    }
+                } else {
+                    // Order does not matter for any-hit queries
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0) break;
+            current = stack[--stackSize];
+        }
+
+        if (traversalStats) {
+            traversalStats->rays += 1;
+            traversalStats->nodesVisited += visited;
+            traversalStats->primitiveTests += tests;
+        }
+        return blocked;
+    }
+
+    // Packet traversal for a bundle of rays sharing one origin. Each node is tested
+    // against every lane and entered if any lane reaches it before its own tMax.
+    // testPrimitive(slot, laneMask) receives leaf-ordered slots and the lanes that
+    // reached the leaf, and lowers tMax[lane] for every nearer hit it finds.
+    template <typename TestPrimitive>
+    void intersectPacket(const RayPacket& packet, float* tMax, TestPrimitive&& testPrimitive, TraversalStats* traversalStats = nullptr) const {
+        if (nodes.empty()) return;
+
+        int laneCount = packet.size();
+        glm::vec3 origin = packet.origin;
+        float invX[RayPacket::SIZE], invY[RayPacket::SIZE], invZ[RayPacket::SIZE];
+        for (int lane = 0; lane < laneCount; ++lane) {
+            invX[lane] = 1.0f / packet.dirX[lane];
+            invY[lane] = 1.0f / packet.dirY[lane];
+            invZ[lane] = 1.0f / packet.dirZ[lane];
+        }
+
+        // Primary rays of a block point roughly the same way, so the first lane picks child order
+        bool dirNegative[3] = { invX[0] < 0.0f, invY[0] < 0.0f, invZ[0] < 0.0f };
+
+        uint32_t stack[MAX_STACK_DEPTH];
+        int stackSize = 0;
+        uint32_t current = 0;
+        uint64_t visited = 0;
+        uint64_t tests = 0;
+
+        while (true) {
+            const BVHNode& node = nodes[current];
+            const AABB& box = node.bounds;
+            ++visited;
+
+            uint64_t laneMask = 0;
+            for (int lane = 0; lane < laneCount; ++lane) {
+                float tx1 = (box.min.x - origin.x) * invX[lane];
+                float tx2 = (box.max.x - origin.x) * invX[lane];
+                float ty1 = (box.min.y - origin.y) * invY[lane];
+                float ty2 = (box.max.y - origin.y) * invY[lane];
+                float tz1 = (box.min.z - origin.z) * invZ[lane];
+                float tz2 = (box.max.z - origin.z) * invZ[lane];
+
+                float tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.0f));
+                float tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), tMax[lane]));
+                laneMask |= static_cast<uint64_t>(tNear <= tFar) << lane;
+            }
+
+            if (laneMask != 0) {
+                if (node.count > 0) {
+                    int activeLanes = count_set_bits(laneMask);
+                    for (uint32_t i = 0; i < node.count; ++i) {
+                        tests += activeLanes;
+                        testPrimitive(node.offset + i, laneMask);
+                    }
+                } else {
+                    if (dirNegative[node.axis]) {
+                        stack[stackSize++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stackSize++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stackSize == 0) break;
+            current = stack[--stackSize];
+        }
+
+        if (traversalStats) {
+            traversalStats->rays += laneCount;
+            traversalStats->nodesVisited += visited;
+            traversalStats->primitiveTests += tests;
+        }
+    }
+};
@@ -0,0 +1,352 @@
+#include "compiled_scene.h"
+#include <array>
+#include <limits>
+#include <map>
+#include <utility>
+#include "../shapes/sphere.h"
+#include "../shapes/cuboid.h"
+#include "../shapes/instance.h"
+#include "../utils/bits.h"
+
+void SpherePool::clear() {
+    objectToWorld.clear();
+    worldToObject.clear();
+    radius.clear();
+}
+
+void CuboidPool::clear() {
+    objectToWorld.clear();
+    worldToObject.clear();
+}
+
+void InstancePool::clear() {
+    objectToWorld.clear();
+    worldToObject.clear();
+    geometryIndex.clear();
+    geometries.clear();
+}
+
+// Key that identifies materials with identical coefficients
+static std::array<float, 14> materialKey(const Material& m) {
+    return {
+        m.color.r, m.color.g, m.color.b,
+        m.ambient.r, m.ambient.g, m.ambient.b,
+        m.diffuse.r, m.diffuse.g, m.diffuse.b,
+        m.specular.r, m.specular.g, m.specular.b,
+        m.shininess, m.reflectiveness
+    };
+}
+
+void CompiledScene::clear() {
+    bvh.clear();
+    primitives.clear();
+    materials.clear();
+    spheres.clear();
+    cuboids.clear();
+    instances.clear();
+    generics.clear();
+    shapeCount = 0;
+}
+
+void CompiledScene::assign(uint32_t compiledShapes, std::vector<PrimitiveRef>&& primitiveTable, std::vector<Material>&& materialTable,
+                           SpherePool&& spherePool, CuboidPool&& cuboidPool, BVH&& hierarchy) {
+    clear();
+    shapeCount = compiledShapes;
+    primitives = std::move(primitiveTable);
+    materials = std::move(materialTable);
+    spheres = std::move(spherePool);
+    cuboids = std::move(cuboidPool);
+    bvh = std::move(hierarchy);
+}
+
+std::vector<std::shared_ptr<Shape>> CompiledScene::toShapes() const {
+    std::vector<std::shared_ptr<Shape>> shapes(shapeCount);
+    for (const PrimitiveRef& ref : primitives) {
+        const Material& material = materials[ref.material];
+        switch (ref.type) {
+        case ShapeType::Sphere: {
+            // The full matrix is restored, as the shape may have been moved or rotated since it was made
+            const glm::mat4& matrix = spheres.objectToWorld[ref.poolIndex];
+            auto sphere = std::make_shared<Sphere>(glm::vec3(matrix[3]), spheres.radius[ref.poolIndex], material);
+            sphere->setModelMatrix(matrix);
+            shapes[ref.shapeIndex] = sphere;
+            break;
+        }
+        case ShapeType::Cuboid: {
+            // The dimensions are baked into the matrix; its axis lengths recover them
+            const glm::mat4& matrix = cuboids.objectToWorld[ref.poolIndex];
+            glm::vec3 dimensions(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])),
+                                 glm::length(glm::vec3(matrix[2])));
+            auto cuboid = std::make_shared<Cuboid>(glm::vec3(matrix[3]), dimensions, material);
+            cuboid->setModelMatrix(matrix);
+            shapes[ref.shapeIndex] = cuboid;
+            break;
+        }
+        case ShapeType::Instance: {
+            std::shared_ptr<const Geometry> geometry = instances.geometries[instances.geometryIndex[ref.poolIndex]];
+            shapes[ref.shapeIndex] = std::make_shared<Instance>(geometry, instances.objectToWorld[ref.poolIndex], material);
+            break;
+        }
+        case ShapeType::Generic:
+            shapes[ref.shapeIndex] = generics.shapes[ref.poolIndex];
+            break;
+        }
+    }
+    return shapes;
+}
+
+void CompiledScene::build(const std::vector<std::shared_ptr<Shape>>& shapes) {
+    clear();
+    shapeCount = static_cast<uint32_t>(shapes.size());
+
+    std::vector<AABB> bounds;
+    bounds.reserve(shapes.size());
+    for (const auto& shape : shapes) {
+        bounds.push_back(shape->getBounds());
+    }
+    bvh.build(bounds);
+
+    // Pack shapes in BVH leaf order so each leaf reads neighbouring pool entries,
+    // then point the BVH at the primitive table instead of the shape list
+    std::map<std::array<float, 14>, uint32_t> materialIndex;
+    std::map<const Geometry*, uint32_t> geometryIndex;
+    const std::vector<uint32_t>& order = bvh.getPrimitiveIndices();
+    primitives.reserve(order.size());
+    for (uint32_t shapeIndex : order) {
+        const Shape* shape = shapes[shapeIndex].get();
+        PrimitiveRef ref;
+        ref.shapeIndex = shapeIndex;
+
+        // Shapes sharing a material share one table entry
+        auto inserted = materialIndex.emplace(materialKey(shape->getMaterial()), static_cast<uint32_t>(materials.size()));
+        if (inserted.second) {
+            materials.push_back(shape->getMaterial());
+        }
+        ref.material = inserted.first->second;
+
+        if (const Sphere* sphere = dynamic_cast<const Sphere*>(shape)) {
+            ref.type = ShapeType::Sphere;
+            ref.poolIndex = static_cast<uint32_t>(spheres.size());
+            spheres.objectToWorld.push_back(sphere->getModelMatrix());
+            spheres.worldToObject.push_back(sphere->getWorldToObjectMatrix());
+            spheres.radius.push_back(sphere->getRadius());
+        } else if (const Cuboid* cuboid = dynamic_cast<const Cuboid*>(shape)) {
+            ref.type = ShapeType::Cuboid;
+            ref.poolIndex = static_cast<uint32_t>(cuboids.size());
+            cuboids.objectToWorld.push_back(cuboid->getModelMatrix());
+            cuboids.worldToObject.push_back(cuboid->getWorldToObjectMatrix());
+        } else if (const Instance* instance = dynamic_cast<const Instance*>(shape)) {
+            // Instances of one geometry share a single entry in the geometry table
+            const std::shared_ptr<const Geometry>& geometry = instance->getGeometry();
+            auto known = geometryIndex.emplace(geometry.get(), static_cast<uint32_t>(instances.geometries.size()));
+            if (known.second) {
+                instances.geometries.push_back(geometry);
+            }
+            ref.type = ShapeType::Instance;
+            ref.poolIndex = static_cast<uint32_t>(instances.size());
+            instances.objectToWorld.push_back(instance->getModelMatrix());
+            instances.worldToObject.push_back(instance->getWorldToObjectMatrix());
+            instances.geometryIndex.push_back(known.first->second);
+        } else {
+            ref.type = ShapeType::Generic;
+            ref.poolIndex = static_cast<uint32_t>(generics.size());
+            generics.shapes.push_back(shapes[shapeIndex]);
+        }
+        primitives.push_back(ref);
+    }
+}
+
+float CompiledScene::refit(const std::vector<std::shared_ptr<Shape>>& shapes) {
+    for (const PrimitiveRef& ref : primitives) {
+        const Shape& shape = *shapes[ref.shapeIndex];
+        switch (ref.type) {
+        case ShapeType::Sphere:
+            spheres.objectToWorld[ref.poolIndex] = shape.getModelMatrix();
+            spheres.worldToObject[ref.poolIndex] = shape.getWorldToObjectMatrix();
+            break;
+        case ShapeType::Cuboid:
+            cuboids.objectToWorld[ref.poolIndex] = shape.getModelMatrix();
+            cuboids.worldToObject[ref.poolIndex] = shape.getWorldToObjectMatrix();
+            break;
+        case ShapeType::Instance:
+            instances.objectToWorld[ref.poolIndex] = shape.getModelMatrix();
+            instances.worldToObject[ref.poolIndex] = shape.getWorldToObjectMatrix();
+            break;
+        case ShapeType::Generic:
+            // Held by pointer, so already up to date
+            break;
+        }
+    }
+
+    std::vector<AABB> bounds;
+    bounds.reserve(shapes.size());
+    for (const auto& shape : shapes) {
+        bounds.push_back(shape->getBounds());
+    }
+    return bvh.refit(bounds);
+}
+
+bool CompiledScene::hitDistance(const SpherePool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const {
+    return Sphere::hitDistance(ray, pool.objectToWorld[index], pool.worldToObject[index], pool.radius[index], distance, detail.objectHitPoint);
+}
+
+bool CompiledScene::hitDistance(const CuboidPool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const {
+    return Cuboid::hitDistance(ray, pool.objectToWorld[index], pool.worldToObject[index], distance, detail.objectHitPoint);
+}
+
+bool CompiledScene::hitDistance(const InstancePool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const {
+    GeometryHit hit;
+    const Geometry& geometry = *pool.geometries[pool.geometryIndex[index]];
+    if (!Instance::hitDistance(geometry, ray, pool.worldToObject[index], tMax, distance, hit)) {
+        return false;
+    }
+    detail.element = hit.element;
+    detail.u = hit.u;
+    detail.v = hit.v;
+    return true;
+}
+
+bool CompiledScene::hitDistance(const GenericPool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const {
+    // Generic shapes recompute their normal through Shape::intersect when resolved
+    Intersection intersection = pool.shapes[index]->intersect(ray);
+    distance = intersection.distance;
+    detail.objectHitPoint = glm::vec3(0.0f);
+    return intersection.hit;
+}
+
+template <typename Pool>
+void CompiledScene::testPool(const Pool& pool, uint32_t slot, const Ray& ray, float& tMax, HitRecord& closest) const {
+    const PrimitiveRef& ref = primitives[slot];
+    float distance;
+    HitRecord detail;
+    if (!hitDistance(pool, ref.poolIndex, ray, tMax, distance, detail)) {
+        return;
+    }
+
+    // Equal distances keep the lowest shape index, matching a linear scan over the shapes
+    if (distance < tMax || (distance == tMax && closest.hit() && ref.shapeIndex < primitives[closest.primitive].shapeIndex)) {
+        tMax = distance;
+        closest.distance = distance;
+        closest.primitive = slot;
+        closest.material = ref.material;
+        closest.objectHitPoint = detail.objectHitPoint;
+        closest.element = detail.element;
+        closest.u = detail.u;
+        closest.v = detail.v;
+    }
+}
+
+void CompiledScene::testPrimitive(uint32_t slot, const Ray& ray, float& tMax, HitRecord& closest) const {
+    switch (primitives[slot].type) {
+        case ShapeType::Sphere: testPool(spheres, slot, ray, tMax, closest); break;
+        case ShapeType::Cuboid: testPool(cuboids, slot, ray, tMax, closest); break;
+        case ShapeType::Instance: testPool(instances, slot, ray, tMax, closest); break;
+        case ShapeType::Generic: testPool(generics, slot, ray, tMax, closest); break;
+    }
+}
+
+HitRecord CompiledScene::intersect(const Ray& ray, TraversalStats* stats) const {
+    float tMax = std::numeric_limits<float>::infinity();
+    HitRecord closest;
+
+    // Leaves index the primitive table directly, since it is stored in leaf order
+    bvh.intersectOrdered(ray, tMax, [&](uint32_t slot, float& maxDistance) {
+        testPrimitive(slot, ray, maxDistance, closest);
+    }, stats);
+
+    return closest;
+}
+
+void CompiledScene::intersectPacket(const RayPacket& packet, HitRecord* hits, TraversalStats* stats) const {
+    int laneCount = packet.size();
+    float tMax[RayPacket::SIZE];
+    for (int lane = 0; lane < laneCount; ++lane) {
+        tMax[lane] = std::numeric_limits<float>::infinity();
+        hits[lane] = HitRecord();
+    }
+
+    bvh.intersectPacket(packet, tMax, [&](uint32_t slot, uint64_t laneMask) {
+        while (laneMask) {
+            int lane = lowest_set_bit(laneMask);
+            laneMask &= laneMask - 1;
+            testPrimitive(slot, packet.getRay(lane), tMax[lane], hits[lane]);
+        }
+    }, stats);
+}
+
+bool CompiledScene::blocks(uint32_t slot, const Ray& ray, float tMax) const {
+    const PrimitiveRef& ref = primitives[slot];
+    float distance;
+    HitRecord detail;
+    bool hit = false;
+    switch (ref.type) {
+        case ShapeType::Sphere: hit = hitDistance(spheres, ref.poolIndex, ray, tMax, distance, detail); break;
+        case ShapeType::Cuboid: hit = hitDistance(cuboids, ref.poolIndex, ray, tMax, distance, detail); break;
+        case ShapeType::Instance: {
+            // Any hit inside the instance will do, so its own BVH can stop early too
+            const Geometry& geometry = *instances.geometries[instances.geometryIndex[ref.poolIndex]];
+            return Instance::occludedKernel(geometry, ray, instances.worldToObject[ref.poolIndex], tMax);
+        }
+        case ShapeType::Generic: hit = hitDistance(generics, ref.poolIndex, ray, tMax, distance, detail); break;
+    }
+    return hit && distance <= tMax;
+}
+
+bool CompiledScene::occluded(const Ray& ray, float tMax, uint32_t* occluderHint, TraversalStats* stats) const {
+    // Neighbouring shading points are usually blocked by the same shape, so try it first
+    if (occluderHint && *occluderHint < primitives.size() && blocks(*occluderHint, ray, tMax)) {
+        if (stats) {
+            stats->rays += 1;
+            stats->primitiveTests += 1;
+        }
+        return true;
+    }
+
+    uint32_t blocker = 0;
+    bool blocked = bvh.occluded(ray, tMax, [&](uint32_t slot) {
+        if (occluderHint && slot == *occluderHint) {
+            return false;  // Already tested above
+        }
+        if (blocks(slot, ray, tMax)) {
+            blocker = slot;
+            return true;
+        }
+        return false;
+    }, stats);
+
+    if (blocked && occluderHint) {
+        *occluderHint = blocker;
+    }
+    return blocked;
+}
+
+glm::vec3 CompiledScene::resolveNormal(const Ray& ray, const HitRecord& hit) const {
+    const PrimitiveRef& ref = primitives[hit.primitive];
+    switch (ref.type) {
+        case ShapeType::Sphere: return Sphere::normalAt(hit.objectHitPoint, spheres.objectToWorld[ref.poolIndex]);
+        case ShapeType::Cuboid: return Cuboid::normalAt(hit.objectHitPoint, cuboids.objectToWorld[ref.poolIndex]);
+        case ShapeType::Instance: {
+            // The normal only depends on the element and the position on it
+            GeometryHit geometryHit = {0.0f, hit.element, hit.u, hit.v};
+            const Geometry& geometry = *instances.geometries[instances.geometryIndex[ref.poolIndex]];
+            return Instance::normalAt(geometry, geometryHit, instances.worldToObject[ref.poolIndex], ray.getDirection());
+        }
+        case ShapeType::Generic: return generics.shapes[ref.poolIndex]->intersect(ray).normal;
+    }
+    return glm::vec3(0.0f);
+}
+
+SurfacePoint CompiledScene::resolveSurface(const Ray& ray, const HitRecord& hit) const {
+    SurfacePoint surface;
+    surface.position = ray.at(hit.distance);
+    surface.normal = resolveNormal(ray, hit);
+    surface.material = &materials[hit.material];
+    return surface;
+}
+
+Intersection CompiledScene::toIntersection(const Ray& ray, const HitRecord& hit) const {
+    if (!hit.hit()) {
+        return Intersection();
+    }
+    return Intersection(hit.distance, materials[hit.material], resolveNormal(ray, hit));
+}
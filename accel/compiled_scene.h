@@ -0,0 +1,167 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "bvh.h"
+#include "../intersection.h"
+#include "../ray.h"
+#include "../ray_packet.h"
+#include "../shapes/shape.h"
+#include "../shapes/geometry.h"
+
+// Shape kinds with a dedicated pool in the compiled scene. Anything else is
+// kept as a Shape pointer and intersected through the virtual interface.
+enum class ShapeType : uint8_t {
+    Sphere,
+    Cuboid,
+    Instance,
+    Generic
+};
+
+// Entry of the primitive table: which pool a primitive lives in and where.
+// Primitives are stored in BVH leaf order, so a leaf covers a contiguous range.
+struct PrimitiveRef {
+    ShapeType type;
+    uint32_t poolIndex;
+    uint32_t shapeIndex;    // Position in Scene::shapes, used to break distance ties
+    uint32_t material;      // Index into the material table
+};
+
+// Structure-of-arrays storage for spheres
+struct SpherePool {
+    std::vector<glm::mat4> objectToWorld;
+    std::vector<glm::mat4> worldToObject;
+    std::vector<float> radius;
+
+    size_t size() const { return radius.size(); }
+    void clear();
+};
+
+// Structure-of-arrays storage for cuboids, whose dimensions live in the model matrix
+struct CuboidPool {
+    std::vector<glm::mat4> objectToWorld;
+    std::vector<glm::mat4> worldToObject;
+
+    size_t size() const { return objectToWorld.size(); }
+    void clear();
+};
+
+// Instances of shared geometry. Each distinct geometry is held once; instances
+// only store their matrices and which geometry they place.
+struct InstancePool {
+    std::vector<glm::mat4> objectToWorld;
+    std::vector<glm::mat4> worldToObject;
+    std::vector<uint32_t> geometryIndex;
+    std::vector<std::shared_ptr<const Geometry>> geometries;
+
+    size_t size() const { return geometryIndex.size(); }
+    void clear();
+};
+
+// Fallback storage for shape types without a specialised kernel
+struct GenericPool {
+    std::vector<std::shared_ptr<Shape>> shapes;
+
+    size_t size() const { return shapes.size(); }
+    void clear() { shapes.clear(); }
+};
+
+// Flattened, render-ready copy of a scene's geometry. The authoring shapes are
+// packed into per-type pools with precomputed world-to-object matrices and
+// intersected through statically dispatched kernels under a BVH. Materials are
+// stored once in a shared table and referenced by index from hit records.
+class CompiledScene {
+private:
+    BVH bvh;
+    std::vector<PrimitiveRef> primitives;
+    std::vector<Material> materials;
+    SpherePool spheres;
+    CuboidPool cuboids;
+    InstancePool instances;
+    GenericPool generics;
+    uint32_t shapeCount = 0;    // Shapes compiled, including any the BVH left out for empty bounds
+
+    // Distance-only kernel selected at compile time for each pool type. Fills the
+    // object-space hit point, or for instances the element and the position on it,
+    // which resolveNormal reads back later.
+    // Hits beyond tMax may be skipped, which lets instances stop their own search.
+    bool hitDistance(const SpherePool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const;
+    bool hitDistance(const CuboidPool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const;
+    bool hitDistance(const InstancePool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const;
+    bool hitDistance(const GenericPool& pool, uint32_t index, const Ray& ray, float tMax, float& distance, HitRecord& detail) const;
+
+    template <typename Pool>
+    void testPool(const Pool& pool, uint32_t slot, const Ray& ray, float& tMax, HitRecord& closest) const;
+
+    // Dispatches to the pool the primitive in the given slot lives in
+    void testPrimitive(uint32_t slot, const Ray& ray, float& tMax, HitRecord& closest) const;
+
+    // Distance-only test used by occlusion queries
+    bool blocks(uint32_t slot, const Ray& ray, float tMax) const;
+
+public:
+    // Packs the given shapes and builds the BVH over them
+    void build(const std::vector<std::shared_ptr<Shape>>& shapes);
+
+    // Adopts tables compiled earlier from shapeCount shapes, e.g. read back from a
+    // scene cache. Only sphere and cuboid pools can be restored this way.
+    void assign(uint32_t shapeCount, std::vector<PrimitiveRef>&& primitiveTable, std::vector<Material>&& materialTable,
+                SpherePool&& spherePool, CuboidPool&& cuboidPool, BVH&& hierarchy);
+
+    // Copies the current transforms of the shapes the scene was built from into
+    // the pools and refits the BVH around them. The shapes must be the same ones,
+    // in the same order. Returns the refitted BVH's SAH cost.
+    float refit(const std::vector<std::shared_ptr<Shape>>& shapes);
+
+    // Recreates the authoring shapes, ordered by shape index. Shapes the BVH left
+    // out have no primitive and come back as null, so this is only complete when
+    // every shape has one.
+    std::vector<std::shared_ptr<Shape>> toShapes() const;
+
+    void clear();
+    bool isEmpty() const { return primitives.empty(); }
+
+    // Closest hit along the ray
+    HitRecord intersect(const Ray& ray, TraversalStats* stats = nullptr) const;
+
+    // Tests the ray against the primitive in one slot alone, updating tMax and
+    // closest as traversal does when it is hit nearer, or as near with a lower
+    // shape index
+    void intersectPrimitive(uint32_t slot, const Ray& ray, float& tMax, HitRecord& closest) const {
+        testPrimitive(slot, ray, tMax, closest);
+    }
+
+    // Closest hits for every lane of a coherent packet, written to hits[0 .. packet.size())
+    void intersectPacket(const RayPacket& packet, HitRecord* hits, TraversalStats* stats = nullptr) const;
+
+    // Returns true if anything lies along the ray within tMax. occluderHint, when given,
+    // names a primitive slot to test before traversal (e.g. the last blocker found for
+    // the same light) and is updated with the blocker found, if any.
+    bool occluded(const Ray& ray, float tMax, uint32_t* occluderHint = nullptr, TraversalStats* stats = nullptr) const;
+
+    // Computes the world-space normal of a hit found along the given ray
+    glm::vec3 resolveNormal(const Ray& ray, const HitRecord& hit) const;
+
+    // Resolves position, normal and material of a hit for shading
+    SurfacePoint resolveSurface(const Ray& ray, const HitRecord& hit) const;
+
+    // Full intersection record, as returned by Shape::intersect
+    Intersection toIntersection(const Ray& ray, const HitRecord& hit) const;
+
+    const Material& getMaterial(uint32_t index) const { return materials[index]; }
+    const std::vector<Material>& getMaterials() const { return materials; }
+
+    const BVH& getBVH() const { return bvh; }
+    const std::vector<PrimitiveRef>& getPrimitives() const { return primitives; }
+    size_t getShapeCount() const { return shapeCount; }
+    const SpherePool& getSpheres() const { return spheres; }
+    const CuboidPool& getCuboids() const { return cuboids; }
+    size_t getSphereCount() const { return spheres.size(); }
+    size_t getCuboidCount() const { return cuboids.size(); }
+    size_t getInstanceCount() const { return instances.size(); }
+    size_t getGeometryCount() const { return instances.geometries.size(); }
+    const InstancePool& getInstances() const { return instances; }
+    const GenericPool& getGenerics() const { return generics; }
+    size_t getGenericCount() const { return generics.size(); }
+};
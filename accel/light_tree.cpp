@@ -0,0 +1,141 @@
+#include "light_tree.h"
+#include <algorithm>
+#include "../lights/light.h"
+
+// Distance from point to the nearest point of a box, 0 inside it
+static float distanceToBox(const AABB& box, const glm::vec3& point) {
+    glm::vec3 nearest = glm::max(box.min, glm::min(point, box.max));
+    return glm::length(point - nearest);
+}
+
+void LightTree::build(const std::vector<std::shared_ptr<Light>>& lights) {
+    nodes.clear();
+    lightCount = lights.size();
+    if (lights.empty()) {
+        return;
+    }
+
+    std::vector<glm::vec3> positions(lights.size());
+    std::vector<float> powers(lights.size());
+    std::vector<uint32_t> order(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        glm::vec3 emitted = lights[i]->getColor() * lights[i]->getIntensity();
+        positions[i] = lights[i]->getPosition();
+        powers[i] = std::max(std::max(emitted.r, emitted.g), std::max(emitted.b, 0.0f));
+        order[i] = static_cast<uint32_t>(i);
+    }
+
+    nodes.reserve(2 * lights.size());
+    buildRecursive(order, positions, powers, 0, static_cast<int>(lights.size()));
+}
+
+uint32_t LightTree::buildRecursive(std::vector<uint32_t>& order, const std::vector<glm::vec3>& positions,
+                                   const std::vector<float>& powers, int begin, int end) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node());
+
+    AABB bounds;
+    float power = 0.0f;
+    float maxPower = 0.0f;
+    for (int i = begin; i < end; ++i) {
+        bounds.expand(positions[order[i]]);
+        power += powers[order[i]];
+        maxPower = std::max(maxPower, powers[order[i]]);
+    }
+    nodes[index].bounds = bounds;
+    nodes[index].power = power;
+    nodes[index].maxPower = maxPower;
+
+    if (end - begin == 1) {
+        nodes[index].leaf = true;
+        nodes[index].light = order[begin];
+        return index;
+    }
+
+    // Median split along the widest axis keeps the tree balanced, so a
+    // sample costs log2 of the light count whatever their layout
+    glm::vec3 extent = bounds.extent();
+    int axis = extent.y > extent.x ? 1 : 0;
+    if (extent.z > extent[axis]) axis = 2;
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+        [&](uint32_t a, uint32_t b) { return positions[a][axis] < positions[b][axis]; });
+
+    buildRecursive(order, positions, powers, begin, mid);
+    uint32_t second = buildRecursive(order, positions, powers, mid, end);
+    nodes[index].second = second;
+    return index;
+}
+
+float LightTree::bound(const Node& node, const glm::vec3& point) const {
+    return node.maxPower * light_falloff(distanceToBox(node.bounds, point));
+}
+
+float LightTree::importance(const Node& node, const glm::vec3& point, float cutoff) const {
+    float falloff = light_falloff(distanceToBox(node.bounds, point));
+    if (node.maxPower * falloff < cutoff) {
+        return 0.0f;
+    }
+    return node.power * falloff;
+}
+
+void LightTree::collect(const glm::vec3& point, float cutoff, std::vector<uint32_t>& out) const {
+    if (nodes.empty()) {
+        return;
+    }
+
+    size_t first = out.size();
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (bound(node, point) < cutoff) {
+            continue;
+        }
+        if (node.leaf) {
+            out.push_back(node.light);
+        } else {
+            uint32_t index = static_cast<uint32_t>(&node - nodes.data());
+            stack[top++] = node.second;
+            stack[top++] = index + 1;
+        }
+    }
+
+    // Lights are shaded in index order, as when every light is evaluated
+    std::sort(out.begin() + first, out.end());
+}
+
+bool LightTree::sample(const glm::vec3& point, float cutoff, float u, uint32_t& light, float& probability) const {
+    if (nodes.empty() || importance(nodes[0], point, cutoff) <= 0.0f) {
+        return false;
+    }
+
+    uint32_t index = 0;
+    probability = 1.0f;
+    while (!nodes[index].leaf) {
+        const Node& node = nodes[index];
+        float left = importance(nodes[index + 1], point, cutoff);
+        float right = importance(nodes[node.second], point, cutoff);
+        float total = left + right;
+        if (total <= 0.0f) {
+            return false;
+        }
+
+        // Reuse u for the next level by rescaling it to the chosen child's share
+        float pLeft = left / total;
+        float pRight = right / total;
+        if (u < pLeft || pRight <= 0.0f) {
+            u = std::min(u / pLeft, 0.99999994f);
+            probability *= pLeft;
+            index = index + 1;
+        } else {
+            u = std::min(std::max(u - pLeft, 0.0f) / pRight, 0.99999994f);
+            probability *= pRight;
+            index = node.second;
+        }
+    }
+
+    light = nodes[index].light;
+    return true;
+}
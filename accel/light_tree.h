@@ -0,0 +1,59 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "aabb.h"
+
+class Light;
+
+// Bounding volume hierarchy over point lights, for scenes with too many lights
+// to test each one at every shading point. A light's power is the largest
+// channel of its colour times its intensity, and its estimated contribution at
+// a point is that power times light_falloff of the distance. The estimate
+// ignores the material and the angle of incidence, so it bounds what the light
+// can add to any channel of a surface whose diffuse and specular terms are at
+// most 1.
+class LightTree {
+private:
+    struct Node {
+        AABB bounds;            // Of the light positions below
+        float power = 0.0f;     // Summed over the lights below
+        float maxPower = 0.0f;  // Of the brightest single light below
+        uint32_t second = 0;    // Second child; the first child follows the node
+        uint32_t light = 0;     // Light index, for leaves
+        bool leaf = false;
+    };
+
+    std::vector<Node> nodes;
+    size_t lightCount = 0;
+
+    // Builds the subtree over lights [begin, end) of order
+    uint32_t buildRecursive(std::vector<uint32_t>& order, const std::vector<glm::vec3>& positions,
+                            const std::vector<float>& powers, int begin, int end);
+
+    // Largest contribution any light of the node can make at point
+    float bound(const Node& node, const glm::vec3& point) const;
+
+    // Sampling weight of a subtree: its total power at its nearest distance,
+    // or 0 if no light of it can reach cutoff
+    float importance(const Node& node, const glm::vec3& point, float cutoff) const;
+
+public:
+    // Rebuilds the hierarchy over the current positions and powers of lights
+    void build(const std::vector<std::shared_ptr<Light>>& lights);
+
+    // Number of lights the tree was built over
+    size_t size() const { return lightCount; }
+
+    // Appends the indices of lights whose estimated contribution at point is at
+    // least cutoff, in increasing order
+    void collect(const glm::vec3& point, float cutoff, std::vector<uint32_t>& out) const;
+
+    // Picks one light with probability roughly proportional to its estimated
+    // contribution at point, by descending the tree and choosing each child by
+    // its importance. Lights below cutoff are never picked. u is a uniform random
+    // number in [0, 1). Returns false if no light qualifies; otherwise sets light
+    // and the probability it was picked with.
+    bool sample(const glm::vec3& point, float cutoff, float u, uint32_t& light, float& probability) const;
+};
@@ -0,0 +1,523 @@
+// Benchmarks for the ray tracing kernels and for full frames of generated scenes.
+// Reports rays/sec, ns/ray and heap allocations, optionally as JSON for tracking
+// regressions between versions.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scene_generator.h"
+#include "../scene.h"
+#include "../shapes/sphere.h"
+#include "../shapes/cuboid.h"
+#include "../render/relighter.h"
+#include "../utils/utils.h"
+
+// Every heap allocation in the process goes through these, so benchmarks can
+// report how many allocations their hot loop performs
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+struct BenchmarkResult {
+    std::string name;
+    std::string params;     // Human-readable parameter summary, e.g. "objects=1000 lights=4"
+    uint64_t rays = 0;
+    double seconds = 0.0;
+    uint64_t allocations = 0;
+
+    double raysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+    double nsPerRay() const { return rays > 0 ? seconds * 1e9 / rays : 0.0; }
+    double allocationsPerRay() const { return rays > 0 ? static_cast<double>(allocations) / rays : 0.0; }
+};
+
+struct BenchmarkOptions {
+    double minSeconds = 0.5;    // Each kernel benchmark runs at least this long
+    bool quick = false;         // Smaller sweeps and frames, for smoke runs
+    int threads = 0;
+    std::string filter;         // Only run benchmarks whose name contains this
+    std::string jsonPath;
+    std::string label;          // Free-form tag stored in the JSON, e.g. a version
+};
+
+// Keeps results observable so the compiler cannot drop the benchmarked work
+static volatile float sink = 0.0f;
+
+class BenchmarkRunner {
+private:
+    BenchmarkOptions options;
+    std::vector<BenchmarkResult> results;
+
+    bool selected(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    void report(const BenchmarkResult& result) {
+        std::cout << std::left << std::setw(28) << result.name
+                  << std::setw(40) << result.params << std::right
+                  << std::setw(12) << std::fixed << std::setprecision(2) << result.raysPerSecond() / 1e6 << " Mrays/s"
+                  << std::setw(12) << std::setprecision(1) << result.nsPerRay() << " ns/ray"
+                  << std::setw(12) << std::setprecision(3) << result.allocationsPerRay() << " allocs/ray"
+                  << std::endl;
+        results.push_back(result);
+    }
+
+public:
+    explicit BenchmarkRunner(const BenchmarkOptions& opts) : options(opts) {}
+
+    const BenchmarkOptions& getOptions() const { return options; }
+
+    // Calls body(iteration) in growing batches until minSeconds have passed.
+    // raysPerCall is how many rays a single call traces.
+    void runKernel(const std::string& name, const std::string& params, uint64_t raysPerCall,
+                   const std::function<void(uint64_t)>& body) {
+        if (!selected(name)) return;
+
+        using Clock = std::chrono::steady_clock;
+        uint64_t iterations = 0;
+        uint64_t batch = 64;
+        uint64_t allocationsBefore = allocationCount.load();
+        auto start = Clock::now();
+        double elapsed = 0.0;
+
+        while (elapsed < options.minSeconds) {
+            for (uint64_t i = 0; i < batch; ++i) {
+                body(iterations + i);
+            }
+            iterations += batch;
+            batch *= 2;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        BenchmarkResult result;
+        result.name = name;
+        result.params = params;
+        result.rays = iterations * raysPerCall;
+        result.seconds = elapsed;
+        result.allocations = allocationCount.load() - allocationsBefore;
+        report(result);
+    }
+
+    // Renders one frame of a generated scene and reports the rays it traced.
+    // configure, when given, adjusts the render settings first.
+    void runFrame(const std::string& name, const SceneParams& params, int width, int height,
+                  const std::function<void(RenderSettings&)>& configure = nullptr) {
+        if (!selected(name)) return;
+
+        Scene scene;
+        generateScene(scene, params);
+        RenderSettings settings;
+        settings.threadCount = options.threads;
+        settings.showProgress = false;
+        if (configure) configure(settings);
+        scene.setRenderSettings(settings);
+        scene.build();
+
+        std::vector<unsigned char> frameBuffer;
+        uint64_t allocationsBefore = allocationCount.load();
+        scene.renderFrame(width, height, frameBuffer);
+
+        std::ostringstream summary;
+        summary << "objects=" << params.objectCount << " lights=" << params.lightCount
+                << " reflective=" << params.reflectiveFraction;
+
+        // Settings configure changed from their defaults
+        RenderSettings defaults;
+        if (settings.maxDepth != defaults.maxDepth) summary << " depth=" << settings.maxDepth;
+        if (settings.minThroughput != defaults.minThroughput) summary << " min=" << settings.minThroughput;
+        if (settings.russianRoulette) summary << " rr";
+        if (settings.lightCutoff != defaults.lightCutoff) summary << " cutoff=" << settings.lightCutoff;
+        if (settings.lightSamples != defaults.lightSamples) summary << " samples=" << settings.lightSamples;
+
+        BenchmarkResult result;
+        result.name = name;
+        result.params = summary.str();
+        result.rays = scene.getTraversalStats().rays;
+        result.seconds = scene.getLastRenderSeconds();
+        result.allocations = allocationCount.load() - allocationsBefore;
+        report(result);
+    }
+
+    // Captures a relighting cache for a generated scene, then repeatedly applies
+    // edit and relights until minSeconds have passed. Every pixel counts as one ray,
+    // so results compare with the camera rays a full frame would trace.
+    void runRelight(const std::string& name, const std::string& change, const SceneParams& params, int width, int height,
+                    const std::function<void(Scene&, Relighter&, int)>& edit) {
+        if (!selected(name)) return;
+
+        Scene scene;
+        generateScene(scene, params);
+        RenderSettings settings;
+        settings.threadCount = options.threads;
+        settings.showProgress = false;
+        scene.setRenderSettings(settings);
+
+        Relighter relighter(scene);
+        std::vector<unsigned char> frameBuffer;
+        relighter.render(width, height, frameBuffer);
+
+        using Clock = std::chrono::steady_clock;
+        int iterations = 0;
+        uint64_t allocationsBefore = allocationCount.load();
+        auto start = Clock::now();
+        double elapsed = 0.0;
+        while (elapsed < options.minSeconds) {
+            edit(scene, relighter, iterations++);
+            relighter.render(width, height, frameBuffer);
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        std::ostringstream summary;
+        summary << change << " objects=" << params.objectCount << " lights=" << params.lightCount;
+
+        BenchmarkResult result;
+        result.name = name;
+        result.params = summary.str();
+        result.rays = static_cast<uint64_t>(iterations) * width * height;
+        result.seconds = elapsed;
+        result.allocations = allocationCount.load() - allocationsBefore;
+        report(result);
+    }
+
+    bool writeJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+
+        out << "{\n  \"label\": \"" << json_escape(options.label) << "\",\n"
+            << "  \"threads\": " << options.threads << ",\n"
+            << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            out << "    {\"name\": \"" << json_escape(r.name) << "\", \"params\": \"" << json_escape(r.params) << "\""
+                << ", \"rays\": " << r.rays
+                << ", \"seconds\": " << r.seconds
+                << ", \"rays_per_second\": " << r.raysPerSecond()
+                << ", \"ns_per_ray\": " << r.nsPerRay()
+                << ", \"allocations\": " << r.allocations
+                << ", \"allocations_per_ray\": " << r.allocationsPerRay() << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+// Random rays starting around the origin and aimed at the unit region in front of it
+static std::vector<Ray> makeRaysTowardOrigin(int count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        glm::vec3 origin(unit(rng) * 5.0f, unit(rng) * 5.0f, 5.0f + unit(rng));
+        glm::vec3 target(unit(rng) * 1.5f, unit(rng) * 1.5f, unit(rng) * 1.5f);
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+static void runKernelBenchmarks(BenchmarkRunner& runner) {
+    const int RAY_COUNT = 4096;
+    std::vector<Ray> rays = makeRaysTowardOrigin(RAY_COUNT, 7);
+
+    Material material = Material();
+    material.color = glm::vec3(1.0f);
+    Sphere sphere(glm::vec3(0.0f), 1.0f, material);
+    runner.runKernel("Sphere::intersect", "", 1, [&](uint64_t i) {
+        sink = sink + sphere.intersect(rays[i % RAY_COUNT]).distance;
+    });
+
+    Cuboid cuboid(glm::vec3(0.0f), glm::vec3(1.5f, 1.0f, 0.5f), material);
+    runner.runKernel("Cuboid::intersect", "", 1, [&](uint64_t i) {
+        sink = sink + cuboid.intersect(rays[i % RAY_COUNT]).distance;
+    });
+
+    Camera camera(glm::vec3(0.0f, 4.0f, 10.0f), glm::vec3(0.0f, -0.3f, -1.0f));
+    runner.runKernel("Camera::getRay", "640x480", 1, [&](uint64_t i) {
+        int pixel = static_cast<int>(i % (640 * 480));
+        Ray ray = camera.getRay(float(pixel % 640) / 640.0f, float(pixel / 640) / 480.0f);
+        sink = sink + ray.getDirection().x;
+    });
+
+    // Scene queries run against a generated scene, with its camera's primary rays
+    SceneParams params;
+    params.objectCount = runner.getOptions().quick ? 100 : 1000;
+    params.lightCount = 4;
+    Scene scene;
+    generateScene(scene, params);
+    scene.build();
+    std::string summary = "objects=" + std::to_string(params.objectCount) + " lights=4";
+
+    const int SIDE = 64;
+    std::vector<Ray> primaryRays;
+    for (int y = 0; y < SIDE; ++y) {
+        for (int x = 0; x < SIDE; ++x) {
+            primaryRays.push_back(scene.getCamera().getRay(float(x) / SIDE, float(y) / SIDE));
+        }
+    }
+    runner.runKernel("findClosestIntersection", summary, 1, [&](uint64_t i) {
+        sink = sink + scene.findClosestIntersection(primaryRays[i % primaryRays.size()]).distance;
+    });
+
+    struct ShadingInput { glm::vec3 point; glm::vec3 normal; Material material; };
+    std::vector<ShadingInput> inputs;
+    for (const Ray& ray : primaryRays) {
+        Intersection hit = scene.findClosestIntersection(ray);
+        if (hit.hit) {
+            inputs.push_back({ray.at(hit.distance), hit.normal, hit.material});
+        }
+    }
+    if (!inputs.empty()) {
+        // One shadow ray per light for every call
+        runner.runKernel("calculateLighting", summary, params.lightCount, [&](uint64_t i) {
+            const ShadingInput& input = inputs[i % inputs.size()];
+            sink = sink + scene.calculateLighting(input.point, input.normal, input.material).r;
+        });
+    }
+}
+
+static void runFrameBenchmarks(BenchmarkRunner& runner) {
+    bool quick = runner.getOptions().quick;
+    int width = quick ? 160 : 320;
+    int height = quick ? 120 : 240;
+
+    // Object count sweep: rays/sec should fall off much slower than linearly
+    std::vector<int> objectCounts = quick ? std::vector<int>{10, 100, 1000}
+                                          : std::vector<int>{10, 100, 1000, 10000, 50000};
+    for (int count : objectCounts) {
+        SceneParams params;
+        params.objectCount = count;
+        runner.runFrame("frame/objects", params, width, height);
+    }
+
+    // Light count sweep: every light adds a shadow ray per shading point
+    for (int lights : quick ? std::vector<int>{1, 4} : std::vector<int>{1, 4, 16, 64}) {
+        SceneParams params;
+        params.objectCount = 1000;
+        params.lightCount = lights;
+        runner.runFrame("frame/lights", params, width, height);
+    }
+
+    // Reflection depth: mirrors everywhere, followed to growing depths, then
+    // with weak reflections cut off or left to Russian roulette
+    for (int depth : quick ? std::vector<int>{1, 3, 8} : std::vector<int>{1, 2, 3, 5, 8, 16}) {
+        SceneParams params;
+        params.objectCount = 1000;
+        params.reflectiveFraction = 1.0f;
+        runner.runFrame("frame/depth", params, width, height, [depth](RenderSettings& settings) {
+            settings.maxDepth = depth;
+        });
+    }
+    for (bool roulette : {false, true}) {
+        SceneParams params;
+        params.objectCount = 1000;
+        params.reflectiveFraction = 1.0f;
+        runner.runFrame(roulette ? "frame/roulette" : "frame/min-throughput", params, width, height,
+            [roulette](RenderSettings& settings) {
+                settings.maxDepth = 8;
+                settings.minThroughput = 0.1f;
+                settings.russianRoulette = roulette;
+            });
+    }
+
+    // Many lights: culling skips lights too far away to matter, sampling bounds
+    // the shadow rays per hit whatever the light count
+    for (int lights : quick ? std::vector<int>{64} : std::vector<int>{64, 256}) {
+        SceneParams params;
+        params.objectCount = 1000;
+        params.lightCount = lights;
+        runner.runFrame("frame/light-cutoff", params, width, height, [](RenderSettings& settings) {
+            settings.lightCutoff = 0.01f;
+        });
+        runner.runFrame("frame/light-samples", params, width, height, [](RenderSettings& settings) {
+            settings.lightSamples = 8;
+        });
+    }
+
+    // Reflection sweep: more reflective objects mean more secondary rays per pixel
+    for (float fraction : quick ? std::vector<float>{0.0f, 1.0f} : std::vector<float>{0.0f, 0.25f, 0.5f, 1.0f}) {
+        SceneParams params;
+        params.objectCount = 1000;
+        params.reflectiveFraction = fraction;
+        runner.runFrame("frame/reflections", params, width, height);
+    }
+}
+
+// The same frames rendered pixel by pixel and through the wavefront pipeline. Sorted ray
+// streams pay off as scenes outgrow the caches and reflections scatter rays.
+static void runWavefrontBenchmarks(BenchmarkRunner& runner) {
+    bool quick = runner.getOptions().quick;
+    int width = quick ? 160 : 320;
+    int height = quick ? 120 : 240;
+
+    for (int count : quick ? std::vector<int>{1000} : std::vector<int>{1000, 50000}) {
+        for (float fraction : quick ? std::vector<float>{1.0f} : std::vector<float>{0.0f, 0.5f, 1.0f}) {
+            SceneParams params;
+            params.objectCount = count;
+            params.lightCount = 4;
+            params.reflectiveFraction = fraction;
+            runner.runFrame("pipeline/depth-first", params, width, height);
+            runner.runFrame("pipeline/wavefront", params, width, height, [](RenderSettings& settings) {
+                settings.wavefront = true;
+            });
+        }
+    }
+}
+
+// Relighting a cached frame after the edits an artist makes most, for comparison
+// with rendering the same frame from scratch under frame/relight
+static void runRelightBenchmarks(BenchmarkRunner& runner) {
+    bool quick = runner.getOptions().quick;
+    int width = quick ? 160 : 320;
+    int height = quick ? 120 : 240;
+
+    SceneParams params;
+    params.objectCount = 1000;
+    params.lightCount = 4;
+    params.reflectiveFraction = 0.25f;
+    runner.runFrame("frame/relight", params, width, height);
+
+    // Colour and material edits reuse every shadow ray
+    runner.runRelight("relight/light", "color", params, width, height, [](Scene& scene, Relighter&, int i) {
+        scene.getLights()[0]->setColor(glm::vec3(1.0f, 0.5f + 0.5f * (i % 2), 1.0f));
+    });
+    runner.runRelight("relight/material", "diffuse", params, width, height, [](Scene&, Relighter& relighter, int i) {
+        Material material = relighter.getMaterials()[0];
+        material.diffuse = glm::vec3(0.3f + 0.1f * (i % 5));
+        relighter.setMaterial(0, material);
+    });
+
+    // Moving a light retraces its shadow rays only
+    runner.runRelight("relight/light", "move", params, width, height, [](Scene& scene, Relighter&, int i) {
+        glm::vec3 position = scene.getLights()[0]->getPosition();
+        position.x += (i % 2) ? 0.5f : -0.5f;
+        scene.getLights()[0]->setPosition(position);
+    });
+}
+
+// Encoders on a rendered frame, counting one ray per pixel so the rate reads as
+// pixels per second
+static void runEncodeBenchmarks(BenchmarkRunner& runner) {
+    bool quick = runner.getOptions().quick;
+    int width = quick ? 320 : 1280;
+    int height = quick ? 240 : 720;
+
+    SceneParams params;
+    params.objectCount = 1000;
+    Scene scene;
+    generateScene(scene, params);
+    RenderSettings settings;
+    settings.threadCount = runner.getOptions().threads;
+    settings.showProgress = false;
+    scene.setRenderSettings(settings);
+    std::vector<unsigned char> frameBuffer;
+    scene.renderFrame(width, height, frameBuffer);
+
+    std::string summary = std::to_string(width) + "x" + std::to_string(height);
+    const std::pair<const char*, ImageFormat> formats[] = {
+        {"encode/png", ImageFormat::Png},
+        {"encode/png-parallel", ImageFormat::ParallelPng},
+        {"encode/ppm", ImageFormat::Ppm},
+    };
+    for (const auto& format : formats) {
+        std::unique_ptr<ImageEncoder> encoder = make_image_encoder(format.second, PngOptions(), scene.getThreadPool());
+        std::vector<unsigned char> output;
+        runner.runKernel(format.first, summary, static_cast<uint64_t>(width) * height, [&](uint64_t) {
+            output.clear();
+            encoder->encode(width, height, frameBuffer, output);
+            sink = sink + output.size();
+        });
+    }
+}
+
+// The denoiser on a frame shaded with sampled lights, one ray per pixel as for
+// the encoders. Its cost is fixed per pixel whatever the scene, so it compares
+// directly with the frame/light-samples render of the same size.
+static void runDenoiseBenchmarks(BenchmarkRunner& runner) {
+    bool quick = runner.getOptions().quick;
+    int width = quick ? 160 : 320;
+    int height = quick ? 120 : 240;
+
+    SceneParams params;
+    params.objectCount = 1000;
+    params.lightCount = 64;
+    Scene scene;
+    generateScene(scene, params);
+    RenderSettings settings;
+    settings.threadCount = runner.getOptions().threads;
+    settings.showProgress = false;
+    settings.lightSamples = 8;
+    scene.setRenderSettings(settings);
+    std::vector<unsigned char> frameBuffer;
+    scene.renderFrame(width, height, frameBuffer);
+    FeatureBuffers features;
+    scene.renderFeatures(width, height, features);
+
+    for (int passes : quick ? std::vector<int>{2} : std::vector<int>{1, 2, 4}) {
+        DenoiseOptions denoiseOptions;
+        denoiseOptions.iterations = passes;
+        Denoiser denoiser(denoiseOptions, scene.getThreadPool());
+        std::vector<unsigned char> image;
+        std::string summary = std::to_string(width) + "x" + std::to_string(height) + " passes=" + std::to_string(passes);
+        runner.runKernel("denoise/atrous", summary, static_cast<uint64_t>(width) * height, [&](uint64_t) {
+            image = frameBuffer;
+            denoiser.denoise(features, image);
+            sink = sink + image[0];
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.quick = true;
+            options.minSeconds = 0.1;
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.minSeconds = std::atof(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--label" && i + 1 < argc) {
+            options.label = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--min-time SECONDS] [--threads N]"
+                      << " [--filter NAME] [--json FILE] [--label TEXT]" << std::endl;
+            return -1;
+        }
+    }
+
+    BenchmarkRunner runner(options);
+    runKernelBenchmarks(runner);
+    runFrameBenchmarks(runner);
+    runWavefrontBenchmarks(runner);
+    runRelightBenchmarks(runner);
+    runEncodeBenchmarks(runner);
+    runDenoiseBenchmarks(runner);
+
+    if (!options.jsonPath.empty() && !runner.writeJson(options.jsonPath)) {
+        std::cerr << "Failed to write " << options.jsonPath << std::endl;
+        return -1;
+    }
+    return 0;
+}
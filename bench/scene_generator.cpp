@@ -0,0 +1,57 @@
+#include "scene_generator.h"
+#include <cmath>
+#include <memory>
+#include <random>
+#include "../shapes/sphere.h"
+#include "../shapes/cuboid.h"
+
+static Material randomMaterial(std::mt19937& rng, bool reflective) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    Material material;
+    material.color = glm::vec3(unit(rng), unit(rng), unit(rng));
+    material.ambient = glm::vec3(0.1f);
+    material.diffuse = glm::vec3(0.5f + 0.4f * unit(rng));
+    material.specular = glm::vec3(unit(rng));
+    material.shininess = 8.0f + 56.0f * unit(rng);
+    material.reflectiveness = reflective ? 0.3f + 0.5f * unit(rng) : 0.0f;
+    return material;
+}
+
+void generateScene(Scene& scene, const SceneParams& params) {
+    std::mt19937 rng(params.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Objects fill a square region whose area grows with their count, so density stays constant
+    float extent = 2.0f * std::sqrt(static_cast<float>(std::max(params.objectCount, 1)));
+
+    Camera camera(glm::vec3(0.0f, extent * 0.6f, extent * 1.2f), glm::vec3(0.0f, -0.5f, -1.0f), 45.0f, 4.0f / 3.0f);
+    scene.setCamera(camera);
+
+    Material floorMaterial = randomMaterial(rng, false);
+    floorMaterial.color = glm::vec3(0.5f);
+    scene.addShape(std::make_shared<Cuboid>(glm::vec3(0.0f, -0.05f, 0.0f),
+                                            glm::vec3(extent * 2.0f, 0.1f, extent * 2.0f), floorMaterial));
+
+    for (int i = 0; i < params.objectCount; ++i) {
+        glm::vec3 position((unit(rng) - 0.5f) * extent * 2.0f,
+                           0.5f + unit(rng) * 2.0f,
+                           (unit(rng) - 0.5f) * extent * 2.0f);
+        Material material = randomMaterial(rng, unit(rng) < params.reflectiveFraction);
+
+        if (i % 2 == 0) {
+            scene.addShape(std::make_shared<Sphere>(position, 0.2f + 0.4f * unit(rng), material));
+        } else {
+            glm::vec3 dimensions(0.3f + 0.6f * unit(rng), 0.3f + 0.6f * unit(rng), 0.3f + 0.6f * unit(rng));
+            scene.addShape(std::make_shared<Cuboid>(position, dimensions, material));
+        }
+    }
+
+    for (int i = 0; i < params.lightCount; ++i) {
+        glm::vec3 position((unit(rng) - 0.5f) * extent * 2.0f,
+                           4.0f + unit(rng) * 4.0f,
+                           (unit(rng) - 0.5f) * extent * 2.0f);
+        float intensity = 4.0f / params.lightCount + 1.0f;
+        scene.addLight(std::make_shared<Light>(position, glm::vec3(1.0f), intensity));
+    }
+}
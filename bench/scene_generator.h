@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include "../scene.h"
+
+// Parameters of a procedurally generated benchmark scene
+struct SceneParams {
+    int objectCount = 100;          // Spheres and cuboids scattered above a floor
+    int lightCount = 1;             // Point lights spread over the scene
+    float reflectiveFraction = 0.0f;// Share of objects with a reflective material
+    uint32_t seed = 1;
+};
+
+// Fills a scene with random spheres and cuboids above a floor,
+// framed by a camera that sees all of it. Identical parameters give identical scenes.
+void generateScene(Scene& scene, const SceneParams& params);
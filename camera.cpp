@@ -1,10 +1,14 @@
 #include "camera.h"
+#include <algorithm>
 
 Camera::Camera(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspect)
     : fieldOfView(fov)
     , aspectRatio(aspect)
     , position(pos)
     , direction(glm::normalize(dir))
+    , inverseView(1.0f)
+    , inverseProjection(1.0f)
+    , viewProjection(1.0f)
 {
     updateViewMatrix();
     updateProjectionMatrix();
@@ -13,6 +17,7 @@ Camera::Camera(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspe
 glm::vec3 Camera::getPosition() const { return position; }
 glm::vec3 Camera::getDirection() const { return direction; }
 float Camera::getFieldOfView() const { return fieldOfView; }
+float Camera::getAspectRatio() const { return aspectRatio; }
 
 void Camera::setPosition(const glm::vec3& pos) { 
     position = pos; 
@@ -45,6 +50,8 @@ void Camera::updateViewMatrix() {
         position + direction,
         glm::vec3(0.0f, 1.0f, 0.0f)
     );
+    inverseView = glm::inverse(transform.viewMatrix);
+    updateRayBasis();
 }
 
 void Camera::updateProjectionMatrix() {
@@ -54,18 +61,66 @@ void Camera::updateProjectionMatrix() {
         0.1f,
         100.0f
     );
+    inverseProjection = glm::inverse(transform.projectionMatrix);
+    updateRayBasis();
 }
 
-Ray Camera::getRay(float x, float y) const {
+glm::vec3 Camera::screenToWorld(float x, float y) const {
     // Convert screen space to camera space
-    glm::vec4 rayStart = glm::inverse(transform.projectionMatrix) * 
+    glm::vec4 rayStart = inverseProjection * 
         glm::vec4(x * 2.0f - 1.0f, 1.0f - y * 2.0f, -1.0f, 1.0f);
     rayStart /= rayStart.w;
     
     // Convert to world space
-    glm::mat4 invView = glm::inverse(transform.viewMatrix);
-    glm::vec3 worldRayStart = Transform::transformPoint(glm::vec3(rayStart), invView);
-    glm::vec3 worldRayDir = glm::normalize(worldRayStart - position);
+    return Transform::transformPoint(glm::vec3(rayStart), inverseView);
+}
+
+void Camera::updateRayBasis() {
+    // The near-plane point is affine in screen coordinates for a perspective projection,
+    // so three samples give the whole mapping
+    glm::vec3 planeOrigin = screenToWorld(0.0f, 0.0f);
+    planeDeltaX = screenToWorld(1.0f, 0.0f) - planeOrigin;
+    planeDeltaY = screenToWorld(0.0f, 1.0f) - planeOrigin;
+    planeOffset = planeOrigin - position;
+    viewProjection = transform.projectionMatrix * transform.viewMatrix;
+}
+
+Ray Camera::getRay(float x, float y) const {
+    glm::vec3 worldRayDir = glm::normalize(planeOffset + y * planeDeltaY + x * planeDeltaX);
     
-    return Ray(position, worldRayDir);
+    return Ray(position, worldRayDir, Ray::UnitDirection());
+}
+
+bool Camera::projectPoint(const glm::vec3& point, glm::vec2& screen) const {
+    glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+    if (clip.w <= 0.0f) {
+        return false;
+    }
+    // Inverse of screenToWorld's mapping from screen to normalized device coordinates
+    screen = glm::vec2(clip.x / clip.w * 0.5f + 0.5f, 0.5f - clip.y / clip.w * 0.5f);
+    return true;
+}
+
+void Camera::getRayPacket(int x0, int y0, int blockWidth, int blockHeight,
+                          int imageWidth, int imageHeight, RayPacket& packet) const {
+    packet.origin = position;
+    packet.x0 = x0;
+    packet.y0 = y0;
+    packet.width = std::min(blockWidth, RayPacket::WIDTH);
+    packet.height = std::min(blockHeight, RayPacket::HEIGHT);
+
+    // Step across the block from the cached basis instead of going through the matrices
+    for (int j = 0; j < packet.height; ++j) {
+        float v = float(y0 + j) / float(imageHeight);
+        glm::vec3 rowStart = planeOffset + v * planeDeltaY;
+        for (int i = 0; i < packet.width; ++i) {
+            float u = float(x0 + i) / float(imageWidth);
+            glm::vec3 dir = glm::normalize(rowStart + u * planeDeltaX);
+
+            int lane = j * packet.width + i;
+            packet.dirX[lane] = dir.x;
+            packet.dirY[lane] = dir.y;
+            packet.dirZ[lane] = dir.z;
+        }
+    }
 } 
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "ray.h"
+#include "ray_packet.h"
 #include "transforms.h"
 
 class Camera {
@@ -12,6 +13,26 @@ private:
     glm::vec3 position;
     glm::vec3 direction;
 
+    // Cached inverses of the view and projection matrices
+    glm::mat4 inverseView;
+    glm::mat4 inverseProjection;
+
+    // World space to clip space, projectionMatrix * viewMatrix
+    glm::mat4 viewProjection;
+
+    // Offset from the camera position to the image plane at screen (0, 0), and its
+    // change per unit of screen x and y. The primary ray through screen (x, y) points
+    // along planeOffset + y * planeDeltaY + x * planeDeltaX.
+    glm::vec3 planeOffset;
+    glm::vec3 planeDeltaX;
+    glm::vec3 planeDeltaY;
+
+    // Recomputes the image plane basis from the cached inverse matrices
+    void updateRayBasis();
+
+    // Maps screen coordinates to a world-space point on the near plane
+    glm::vec3 screenToWorld(float x, float y) const;
+
 public:
     Camera(const glm::vec3& pos = glm::vec3(0.0f),
            const glm::vec3& dir = glm::vec3(0.0f, 0.0f, -1.0f),
@@ -22,6 +43,7 @@ public:
     glm::vec3 getPosition() const;
     glm::vec3 getDirection() const;
     float getFieldOfView() const;
+    float getAspectRatio() const;
 
     // Setters
     void setPosition(const glm::vec3& pos);
@@ -38,4 +60,14 @@ public:
 
     // Ray generation
     Ray getRay(float x, float y) const;
+
+    // Fills a packet with the primary rays of a pixel block of a width x height image,
+    // using the same screen mapping as getRay(float(x) / width, float(y) / height)
+    void getRayPacket(int x0, int y0, int blockWidth, int blockHeight,
+                      int imageWidth, int imageHeight, RayPacket& packet) const;
+
+    // Projects a world-space point to the screen coordinates getRay takes, so the
+    // ray getRay(screen.x, screen.y) passes through it. Returns false for points
+    // behind or level with the camera, which have no such coordinates.
+    bool projectPoint(const glm::vec3& point, glm::vec2& screen) const;
 }; 
\ No newline at end of file
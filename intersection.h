@@ -1,5 +1,6 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
 #include "utils/material.h"
 
 struct Intersection {
@@ -21,4 +22,37 @@ struct Intersection {
         , material(mat)
         , normal(norm)
     {}
-}; 
\ No newline at end of file
+}; 
+
+// Compact record of a hit found during traversal. It carries only what is needed
+// to pick the closest hit; the normal and material are resolved afterwards, and
+// only for the hit that ends up being shaded.
+struct HitRecord {
+    static const uint32_t NONE = 0xffffffffu;
+
+    float distance;             // World-space distance along the ray
+    uint32_t primitive;         // Slot in the compiled scene's primitive table, NONE for a miss
+    uint32_t material;          // Index into the scene's material table
+    glm::vec3 objectHitPoint;   // Object-space hit point, from which the normal is derived
+    uint32_t element;           // Part of the primitive that was hit, e.g. a triangle of an instance
+    float u, v;                 // Position on that element, e.g. barycentric weights
+
+    HitRecord()
+        : distance(-1.0f)
+        , primitive(NONE)
+        , material(0)
+        , objectHitPoint(0.0f)
+        , element(0)
+        , u(0.0f)
+        , v(0.0f)
+    {}
+
+    bool hit() const { return primitive != NONE; }
+};
+
+// Shading inputs of a resolved hit
+struct SurfacePoint {
+    glm::vec3 position;
+    glm::vec3 normal;
+    const Material* material;   // Points into the scene's material table
+};
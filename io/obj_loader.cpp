@@ -0,0 +1,183 @@
+#include "obj_loader.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../shapes/triangle_mesh.h"
+
+// Parse state carried across chunks
+struct ObjParser {
+    MeshGeometry& mesh;
+    uint32_t positionCount = 0;
+    uint32_t normalCount = 0;
+    int lineNumber = 0;
+    std::string error;
+
+    explicit ObjParser(MeshGeometry& target) : mesh(target) {}
+
+    static const char* skipSpace(const char* p) {
+        while (*p == ' ' || *p == '\t') ++p;
+        return p;
+    }
+
+    bool fail(const char* message) {
+        error = "line " + std::to_string(lineNumber) + ": " + message;
+        return false;
+    }
+
+    // Three finite numbers; strtof would also take "nan" and "inf"
+    bool readVector(const char* p, glm::vec3& value) {
+        for (int i = 0; i < 3; ++i) {
+            char* end;
+            value[i] = std::strtof(p, &end);
+            if (end == p || !std::isfinite(value[i])) {
+                return false;
+            }
+            p = end;
+        }
+        return true;
+    }
+
+    // Resolves a 1-based or negative (relative) OBJ index against count entries
+    static bool resolveIndex(long index, uint32_t count, uint32_t& resolved) {
+        if (index > 0 && static_cast<unsigned long>(index) <= count) {
+            resolved = static_cast<uint32_t>(index - 1);
+            return true;
+        }
+        if (index < 0 && static_cast<unsigned long>(-index) <= count) {
+            resolved = static_cast<uint32_t>(count + index);
+            return true;
+        }
+        return false;
+    }
+
+    // Face corners are "v", "v/vt", "v//vn" or "v/vt/vn"
+    bool readCorner(const char*& p, uint32_t& position, uint32_t& normal) {
+        char* end;
+        long index = std::strtol(p, &end, 10);
+        if (end == p || !resolveIndex(index, positionCount, position)) {
+            return false;
+        }
+        p = end;
+        normal = MeshGeometry::NO_NORMAL;
+
+        if (*p == '/') {
+            ++p;
+            if (*p != '/') {
+                std::strtol(p, &end, 10);   // Texture coordinate, unused
+                p = end;
+            }
+            if (*p == '/') {
+                ++p;
+                index = std::strtol(p, &end, 10);
+                if (end == p || !resolveIndex(index, normalCount, normal)) {
+                    return false;
+                }
+                p = end;
+            }
+        }
+        return true;
+    }
+
+    bool parseLine(const char* p) {
+        ++lineNumber;
+        p = skipSpace(p);
+
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            glm::vec3 value;
+            if (!readVector(p + 2, value)) return fail("bad vertex");
+            mesh.addPosition(value);
+            positionCount++;
+        } else if (p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+            glm::vec3 value;
+            if (!readVector(p + 3, value)) return fail("bad normal");
+            mesh.addNormal(value);
+            normalCount++;
+        } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            // Fan triangulation around the first corner, up to any trailing # comment
+            p = skipSpace(p + 2);
+            uint32_t firstPosition = 0, firstNormal = MeshGeometry::NO_NORMAL;
+            uint32_t previousPosition = 0, previousNormal = MeshGeometry::NO_NORMAL;
+            int corners = 0;
+            while (*p != '\0' && *p != '#') {
+                uint32_t position, normal;
+                if (!readCorner(p, position, normal)) return fail("bad face index");
+                if (corners == 0) {
+                    firstPosition = position;
+                    firstNormal = normal;
+                } else if (corners >= 2) {
+                    mesh.addTriangle(firstPosition, previousPosition, position, firstNormal, previousNormal, normal);
+                }
+                previousPosition = position;
+                previousNormal = normal;
+                corners++;
+                p = skipSpace(p);
+                if (*p == '\r') break;
+            }
+            if (corners < 3) return fail("face with fewer than three corners");
+        }
+        // Comments, texture coordinates, groups, materials and blank lines are skipped
+        return true;
+    }
+};
+
+bool load_obj(const char* filename, MeshGeometry& mesh, std::string& error) {
+    std::FILE* file = std::fopen(filename, "rb");
+    if (!file) {
+        error = std::string(filename) + ": cannot open file";
+        return false;
+    }
+
+    // Lines are parsed straight out of the chunk buffer; a line cut off at the end
+    // of a chunk is moved to the front and completed by the next read
+    const size_t CHUNK_SIZE = 1 << 20;
+    std::vector<char> buffer(CHUNK_SIZE + 1);
+    size_t carried = 0;
+    ObjParser parser(mesh);
+    bool ok = true;
+
+    while (ok) {
+        size_t read = std::fread(buffer.data() + carried, 1, CHUNK_SIZE - carried, file);
+        size_t filled = carried + read;
+        bool atEnd = read == 0;
+        if (atEnd && filled == 0) {
+            break;
+        }
+        if (atEnd) {
+            // Last line without a trailing newline
+            buffer[filled++] = '\n';
+        }
+
+        size_t lineStart = 0;
+        for (size_t i = 0; i < filled && ok; ++i) {
+            if (buffer[i] == '\n') {
+                buffer[i] = '\0';
+                ok = parser.parseLine(&buffer[lineStart]);
+                lineStart = i + 1;
+            }
+        }
+
+        carried = filled - lineStart;
+        if (carried == CHUNK_SIZE) {
+            ok = parser.fail("line too long");
+        }
+        std::memmove(buffer.data(), buffer.data() + lineStart, carried);
+        if (atEnd) {
+            break;
+        }
+    }
+
+    bool readError = std::ferror(file) != 0;
+    std::fclose(file);
+
+    if (!ok || readError) {
+        error = std::string(filename) + ": " + (readError ? std::string("read failed") : parser.error);
+        return false;
+    }
+    if (mesh.getTriangleCount() == 0) {
+        error = std::string(filename) + ": no faces";
+        return false;
+    }
+    return true;
+}
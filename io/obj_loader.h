@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+
+class MeshGeometry;
+
+// Reads the vertices, vertex normals and faces of a Wavefront OBJ file into
+// mesh. Polygons are split into triangle fans; texture coordinates, groups and
+// materials are ignored. The file is read in fixed-size chunks and parsed in
+// place, so memory use is the mesh itself and one chunk, with no allocation
+// per line or per face. The mesh still has to be built before use.
+bool load_obj(const char* filename, MeshGeometry& mesh, std::string& error);
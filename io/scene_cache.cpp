@@ -0,0 +1,312 @@
+#include "scene_cache.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../scene.h"
+
+static const char CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+static const uint32_t CACHE_VERSION = 2;
+
+// Tables that are copied as raw bytes must keep their layout
+static_assert(sizeof(Material) == 14 * sizeof(float), "Material layout changed");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "glm::mat4 layout changed");
+static_assert(sizeof(BVHNode) == 6 * sizeof(float) + 8, "BVHNode layout changed");
+
+// Fixed-size file header. Every field is written explicitly, so padding never
+// reaches the file and equal scenes give identical caches.
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;     // Reads back differently on a machine of the other byte order
+
+    uint32_t lightCount;
+    uint32_t materialCount;
+    uint32_t primitiveCount;
+    uint32_t sphereCount;
+    uint32_t cuboidCount;
+    uint32_t nodeCount;
+
+    float cameraPosition[3];
+    float cameraDirection[3];
+    float cameraFieldOfView;
+    float cameraAspectRatio;
+
+    // BuildStats, kept so printStats reports the original build
+    double buildMilliseconds;
+    int32_t buildMaxDepth;
+    int32_t buildLeafCount;
+    float buildSahCost;
+    uint32_t shapeCount;        // Shapes the scene was compiled from; each has one primitive
+};
+
+struct LightRecord {
+    float position[3];
+    float color[3];
+    float intensity;
+};
+
+struct PrimitiveRecord {
+    uint32_t type;
+    uint32_t poolIndex;
+    uint32_t shapeIndex;
+    uint32_t material;
+};
+
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// Size of the file described by a header, or 0 if the counts do not add up
+static uint64_t expectedSize(const CacheHeader& header) {
+    return sizeof(CacheHeader)
+        + uint64_t(header.lightCount) * sizeof(LightRecord)
+        + uint64_t(header.materialCount) * sizeof(Material)
+        + uint64_t(header.primitiveCount) * sizeof(PrimitiveRecord)
+        + uint64_t(header.sphereCount) * (2 * sizeof(glm::mat4) + sizeof(float))
+        + uint64_t(header.cuboidCount) * 2 * sizeof(glm::mat4)
+        + uint64_t(header.nodeCount) * sizeof(BVHNode)
+        + uint64_t(header.primitiveCount) * sizeof(uint32_t);
+}
+
+template <typename T>
+static void writeArray(std::ofstream& out, const std::vector<T>& values) {
+    out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+bool save_scene_cache(const char* filename, Scene& scene, std::string& error) {
+    if (scene.needsBuild()) {
+        scene.build();
+    }
+
+    const CompiledScene& compiled = scene.getCompiledScene();
+    if (compiled.getGenericCount() > 0 || compiled.getInstanceCount() > 0) {
+        error = "only spheres and cuboids can be cached";
+        return false;
+    }
+    // A shape the BVH left out has no primitive to store, so it could not be recreated
+    if (compiled.getShapeCount() != compiled.getPrimitives().size()) {
+        error = "shapes with empty bounds cannot be cached";
+        return false;
+    }
+
+    const Camera& camera = scene.getCamera();
+    const BuildStats& buildStats = compiled.getBVH().getBuildStats();
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.lightCount = static_cast<uint32_t>(scene.getLights().size());
+    header.materialCount = static_cast<uint32_t>(compiled.getMaterials().size());
+    header.primitiveCount = static_cast<uint32_t>(compiled.getPrimitives().size());
+    header.sphereCount = static_cast<uint32_t>(compiled.getSphereCount());
+    header.cuboidCount = static_cast<uint32_t>(compiled.getCuboidCount());
+    header.nodeCount = static_cast<uint32_t>(compiled.getBVH().getNodes().size());
+    header.shapeCount = static_cast<uint32_t>(compiled.getShapeCount());
+    for (int i = 0; i < 3; ++i) {
+        header.cameraPosition[i] = camera.getPosition()[i];
+        header.cameraDirection[i] = camera.getDirection()[i];
+    }
+    header.cameraFieldOfView = camera.getFieldOfView();
+    header.cameraAspectRatio = camera.getAspectRatio();
+    header.buildMilliseconds = buildStats.buildMilliseconds;
+    header.buildMaxDepth = buildStats.maxDepth;
+    header.buildLeafCount = buildStats.leafCount;
+    header.buildSahCost = buildStats.sahCost;
+
+    std::vector<LightRecord> lights;
+    for (const auto& light : scene.getLights()) {
+        LightRecord record;
+        for (int i = 0; i < 3; ++i) {
+            record.position[i] = light->getPosition()[i];
+            record.color[i] = light->getColor()[i];
+        }
+        record.intensity = light->getIntensity();
+        lights.push_back(record);
+    }
+
+    std::vector<PrimitiveRecord> primitives;
+    for (const PrimitiveRef& ref : compiled.getPrimitives()) {
+        primitives.push_back({static_cast<uint32_t>(ref.type), ref.poolIndex, ref.shapeIndex, ref.material});
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        error = std::string(filename) + ": cannot open file for writing";
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(out, lights);
+    writeArray(out, compiled.getMaterials());
+    writeArray(out, primitives);
+    writeArray(out, compiled.getSpheres().objectToWorld);
+    writeArray(out, compiled.getSpheres().worldToObject);
+    writeArray(out, compiled.getSpheres().radius);
+    writeArray(out, compiled.getCuboids().objectToWorld);
+    writeArray(out, compiled.getCuboids().worldToObject);
+    writeArray(out, compiled.getBVH().getNodes());
+    writeArray(out, compiled.getBVH().getPrimitiveIndices());
+
+    if (!out.flush()) {
+        error = std::string(filename) + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+private:
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+public:
+    bool open(const char* filename) {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            size = static_cast<size_t>(info.st_size);
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        return data != MAP_FAILED;
+    }
+
+    ~MappedFile() {
+        if (data != MAP_FAILED) {
+            munmap(data, size);
+        }
+    }
+
+    const unsigned char* bytes() const { return static_cast<const unsigned char*>(data); }
+    size_t getSize() const { return size; }
+};
+
+// Copies consecutive tables out of the mapped file
+class TableReader {
+private:
+    const unsigned char* cursor;
+
+public:
+    explicit TableReader(const unsigned char* start) : cursor(start) {}
+
+    template <typename T>
+    std::vector<T> read(uint32_t count) {
+        // Written through bytes: glm and Material types are not formally trivially
+        // copyable, but the static_asserts above pin down their layout
+        std::vector<T> values(count);
+        std::memcpy(reinterpret_cast<unsigned char*>(values.data()), cursor, count * sizeof(T));
+        cursor += count * sizeof(T);
+        return values;
+    }
+};
+
+bool load_scene_cache(const char* filename, Scene& scene, std::string& error) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        error = std::string(filename) + ": cannot open file";
+        return false;
+    }
+
+    CacheHeader header;
+    if (file.getSize() < sizeof(header)) {
+        error = std::string(filename) + ": not a scene cache";
+        return false;
+    }
+    std::memcpy(&header, file.bytes(), sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) {
+        error = std::string(filename) + ": not a scene cache";
+        return false;
+    }
+    if (header.version != CACHE_VERSION || header.byteOrderMark != BYTE_ORDER_MARK) {
+        error = std::string(filename) + ": written by an incompatible build, recreate it";
+        return false;
+    }
+    if (expectedSize(header) != file.getSize()) {
+        error = std::string(filename) + ": truncated or corrupt";
+        return false;
+    }
+
+    TableReader reader(file.bytes() + sizeof(header));
+    std::vector<LightRecord> lights = reader.read<LightRecord>(header.lightCount);
+    std::vector<Material> materials = reader.read<Material>(header.materialCount);
+    std::vector<PrimitiveRecord> records = reader.read<PrimitiveRecord>(header.primitiveCount);
+
+    SpherePool spheres;
+    spheres.objectToWorld = reader.read<glm::mat4>(header.sphereCount);
+    spheres.worldToObject = reader.read<glm::mat4>(header.sphereCount);
+    spheres.radius = reader.read<float>(header.sphereCount);
+
+    CuboidPool cuboids;
+    cuboids.objectToWorld = reader.read<glm::mat4>(header.cuboidCount);
+    cuboids.worldToObject = reader.read<glm::mat4>(header.cuboidCount);
+
+    std::vector<BVHNode> nodes = reader.read<BVHNode>(header.nodeCount);
+    std::vector<uint32_t> indices = reader.read<uint32_t>(header.primitiveCount);
+
+    // Validate every index before the renderer trusts it. Each shape must have
+    // exactly one primitive, or recreating the shapes would leave gaps.
+    if (header.shapeCount != header.primitiveCount) {
+        error = std::string(filename) + ": corrupt primitive table";
+        return false;
+    }
+    std::vector<bool> seenShapes(header.shapeCount, false);
+    std::vector<PrimitiveRef> primitives(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        const PrimitiveRecord& record = records[i];
+        bool valid = record.material < header.materialCount && record.shapeIndex < header.shapeCount &&
+            !seenShapes[record.shapeIndex] &&
+            ((record.type == static_cast<uint32_t>(ShapeType::Sphere) && record.poolIndex < header.sphereCount) ||
+             (record.type == static_cast<uint32_t>(ShapeType::Cuboid) && record.poolIndex < header.cuboidCount));
+        if (!valid) {
+            error = std::string(filename) + ": corrupt primitive table";
+            return false;
+        }
+        seenShapes[record.shapeIndex] = true;
+        primitives[i] = {static_cast<ShapeType>(record.type), record.poolIndex, record.shapeIndex, record.material};
+    }
+    if (!BVH::isValidLayout(nodes, indices, header.primitiveCount)) {
+        error = std::string(filename) + ": corrupt hierarchy";
+        return false;
+    }
+
+    BuildStats buildStats;
+    buildStats.buildMilliseconds = header.buildMilliseconds;
+    buildStats.primitiveCount = static_cast<int>(header.primitiveCount);
+    buildStats.nodeCount = static_cast<int>(header.nodeCount);
+    buildStats.leafCount = header.buildLeafCount;
+    buildStats.maxDepth = header.buildMaxDepth;
+    buildStats.sahCost = header.buildSahCost;
+
+    BVH bvh;
+    bvh.assign(std::move(nodes), std::move(indices), buildStats);
+    CompiledScene compiled;
+    compiled.assign(header.shapeCount, std::move(primitives), std::move(materials), std::move(spheres), std::move(cuboids), std::move(bvh));
+
+    scene.setCamera(Camera(glm::vec3(header.cameraPosition[0], header.cameraPosition[1], header.cameraPosition[2]),
+                           glm::vec3(header.cameraDirection[0], header.cameraDirection[1], header.cameraDirection[2]),
+                           header.cameraFieldOfView, header.cameraAspectRatio));
+    for (const LightRecord& light : lights) {
+        scene.addLight(std::make_shared<Light>(glm::vec3(light.position[0], light.position[1], light.position[2]),
+                                               glm::vec3(light.color[0], light.color[1], light.color[2]),
+                                               light.intensity));
+    }
+    scene.setCompiledScene(std::move(compiled));
+    return true;
+}
+
+bool is_scene_cache(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(CACHE_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0;
+}
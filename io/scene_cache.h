@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+class Scene;
+
+// Binary cache of a compiled scene: camera, lights, the material table, the
+// sphere and cuboid pools and the prebuilt BVH. Loading one maps the file and
+// copies each table straight into place, so a large scene is ready to render
+// without parsing its description or building its hierarchy.
+//
+// Caches are tied to the build that wrote them (same struct layouts and byte
+// order); a mismatch is detected from the header and reported as an error.
+
+// Builds the scene if needed and writes its compiled form. Scenes holding shape
+// types other than spheres and cuboids cannot be cached.
+bool save_scene_cache(const char* filename, Scene& scene, std::string& error);
+
+// Sets the camera, adds the lights and adopts the compiled geometry of a cache
+bool load_scene_cache(const char* filename, Scene& scene, std::string& error);
+
+// True if the file starts with the scene cache signature
+bool is_scene_cache(const char* filename);
@@ -0,0 +1,472 @@
+#include "scene_file.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <vector>
+#include "../scene.h"
+#include "../shapes/sphere.h"
+#include "../shapes/cuboid.h"
+#include "../shapes/triangle_mesh.h"
+#include "../utils/thread_pool.h"
+#include "../render/animation.h"
+#include "obj_loader.h"
+
+// One parsed line: a keyword, an optional name (for material definitions) and
+// its properties, each holding either numbers or a single word
+struct Statement {
+    std::string keyword;
+    std::string name;
+    std::map<std::string, std::vector<float>> numbers;
+    std::map<std::string, std::string> words;
+};
+
+// State shared by the statements of one file
+struct LoadContext {
+    std::string directory;      // Relative mesh paths are resolved against the scene file's directory
+    std::map<std::string, Material> materials;
+    std::map<std::string, std::shared_ptr<const MeshGeometry>> meshes;     // Each OBJ file is loaded once
+    std::map<std::string, std::shared_ptr<const MeshGeometry>> geometries; // Named by geometry statements
+    std::unique_ptr<ThreadPool> pool;   // Created for the first mesh, to build its BVH
+    std::map<std::string, size_t> shapeNames;  // Shapes and lights given a name, for keyframes
+    std::map<std::string, size_t> lightNames;
+    Animation* animation = nullptr;     // Receives keyframes; they are skipped when null
+};
+
+static bool parseNumber(const std::string& token, float& value) {
+    char* end = nullptr;
+    value = std::strtof(token.c_str(), &end);
+    return end != token.c_str() && *end == '\0';
+}
+
+static bool parseStatement(const std::string& line, Statement& statement, std::string& error) {
+    std::istringstream tokens(line);
+    std::vector<std::string> words;
+    std::string token;
+    while (tokens >> token) {
+        words.push_back(token);
+    }
+
+    size_t i = 0;
+    statement.keyword = words[i++];
+    if (statement.keyword == "material" || statement.keyword == "geometry" || statement.keyword == "keyframe") {
+        if (i >= words.size()) {
+            error = statement.keyword + " needs a name";
+            return false;
+        }
+        statement.name = words[i++];
+    }
+
+    while (i < words.size()) {
+        std::string property = words[i++];
+        if (statement.numbers.count(property) || statement.words.count(property)) {
+            error = "property '" + property + "' given twice";
+            return false;
+        }
+
+        std::vector<float> values;
+        float value;
+        while (i < words.size() && parseNumber(words[i], value)) {
+            // strtof also reads "nan" and "inf", which would reach the BVH and the cache
+            if (!std::isfinite(value)) {
+                error = "property '" + property + "' has a value that is not a finite number";
+                return false;
+            }
+            values.push_back(value);
+            i++;
+        }
+
+        if (!values.empty()) {
+            statement.numbers[property] = values;
+        } else if (i < words.size()) {
+            statement.words[property] = words[i++];
+        } else {
+            error = "property '" + property + "' has no value";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks that a statement only uses the given properties, to catch typos
+static bool checkProperties(const Statement& statement, const std::set<std::string>& allowed, std::string& error) {
+    for (const auto& entry : statement.numbers) {
+        if (!allowed.count(entry.first)) {
+            error = "unknown property '" + entry.first + "' for " + statement.keyword;
+            return false;
+        }
+    }
+    for (const auto& entry : statement.words) {
+        if (!allowed.count(entry.first)) {
+            error = "unknown property '" + entry.first + "' for " + statement.keyword;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads a property of one or three numbers. Missing optional properties keep value.
+static bool getVec3(const Statement& statement, const std::string& property, glm::vec3& value, bool required,
+                    std::string& error) {
+    auto found = statement.numbers.find(property);
+    if (found == statement.numbers.end()) {
+        if (required) {
+            error = statement.keyword + " needs '" + property + "'";
+        }
+        return !required;
+    }
+
+    const std::vector<float>& values = found->second;
+    if (values.size() == 1) {
+        value = glm::vec3(values[0]);
+    } else if (values.size() == 3) {
+        value = glm::vec3(values[0], values[1], values[2]);
+    } else {
+        error = "'" + property + "' takes one or three numbers";
+        return false;
+    }
+    return true;
+}
+
+static bool getFloat(const Statement& statement, const std::string& property, float& value, bool required,
+                     std::string& error) {
+    auto found = statement.numbers.find(property);
+    if (found == statement.numbers.end()) {
+        if (required) {
+            error = statement.keyword + " needs '" + property + "'";
+        }
+        return !required;
+    }
+    if (found->second.size() != 1) {
+        error = "'" + property + "' takes one number";
+        return false;
+    }
+    value = found->second[0];
+    return true;
+}
+
+static bool getMaterial(const Statement& statement, const LoadContext& context, Material& material,
+                        std::string& error) {
+    auto name = statement.words.find("material");
+    if (name == statement.words.end()) {
+        error = statement.keyword + " needs 'material'";
+        return false;
+    }
+    auto found = context.materials.find(name->second);
+    if (found == context.materials.end()) {
+        error = "unknown material '" + name->second + "'";
+        return false;
+    }
+    material = found->second;
+    return true;
+}
+
+static bool loadMesh(const std::string& file, LoadContext& context, std::shared_ptr<const MeshGeometry>& geometry,
+                     std::string& error) {
+    std::string path = file;
+    if (!path.empty() && path[0] != '/' && !context.directory.empty()) {
+        path = context.directory + "/" + path;
+    }
+
+    auto found = context.meshes.find(path);
+    if (found != context.meshes.end()) {
+        geometry = found->second;
+        return true;
+    }
+
+    auto mesh = std::make_shared<MeshGeometry>();
+    if (!load_obj(path.c_str(), *mesh, error)) {
+        return false;
+    }
+    if (!context.pool) {
+        context.pool = std::make_unique<ThreadPool>();
+    }
+    mesh->build(context.pool.get());
+
+    geometry = mesh;
+    context.meshes[path] = geometry;
+    return true;
+}
+
+// Shapes, lights and the camera share one namespace, so a keyframe names one target
+static bool checkNameFree(const LoadContext& context, const std::string& name, std::string& error) {
+    if (context.shapeNames.count(name) || context.lightNames.count(name) || name == "camera") {
+        error = "name '" + name + "' is already in use";
+        return false;
+    }
+    return true;
+}
+
+// Records the name of the shape just added, if the statement gave it one
+static bool nameShape(const Statement& statement, const Scene& scene, LoadContext& context, std::string& error) {
+    auto name = statement.words.find("name");
+    if (name == statement.words.end()) {
+        return true;
+    }
+    if (!checkNameFree(context, name->second, error)) {
+        return false;
+    }
+    context.shapeNames[name->second] = scene.getShapeCount() - 1;
+    return true;
+}
+
+// keyframe TARGET time T ..., where the target is "camera", a named shape or a named light
+static bool applyKeyframe(const Statement& statement, Scene& scene, LoadContext& context, std::string& error) {
+    float time;
+    if (!getFloat(statement, "time", time, true, error)) {
+        return false;
+    }
+
+    if (statement.name == "camera") {
+        CameraKey key{time, scene.getCamera().getPosition(), scene.getCamera().getDirection()};
+        if (!checkProperties(statement, {"time", "position", "direction"}, error) ||
+            !getVec3(statement, "position", key.position, false, error) ||
+            !getVec3(statement, "direction", key.direction, false, error)) {
+            return false;
+        }
+        if (context.animation) context.animation->addCameraKey(key);
+        return true;
+    }
+
+    auto shape = context.shapeNames.find(statement.name);
+    if (shape != context.shapeNames.end()) {
+        // Unset properties keep the shape where and as it was authored
+        glm::vec3 origin(scene.getShape(shape->second)->getModelMatrix()[3]);
+        TransformKey key{time, origin, glm::vec3(0.0f), glm::vec3(1.0f)};
+        if (!checkProperties(statement, {"time", "position", "rotate", "scale"}, error) ||
+            !getVec3(statement, "position", key.position, false, error) ||
+            !getVec3(statement, "rotate", key.rotation, false, error) ||
+            !getVec3(statement, "scale", key.scale, false, error)) {
+            return false;
+        }
+        if (context.animation) context.animation->addShapeKey(shape->second, key);
+        return true;
+    }
+
+    auto light = context.lightNames.find(statement.name);
+    if (light != context.lightNames.end()) {
+        LightKey key{time, glm::vec3(0.0f)};
+        if (!checkProperties(statement, {"time", "position"}, error) ||
+            !getVec3(statement, "position", key.position, true, error)) {
+            return false;
+        }
+        if (context.animation) context.animation->addLightKey(light->second, key);
+        return true;
+    }
+
+    error = "unknown keyframe target '" + statement.name + "'";
+    return false;
+}
+
+static bool applyStatement(const Statement& statement, Scene& scene, LoadContext& context, std::string& error) {
+    const std::string& keyword = statement.keyword;
+
+    if (keyword == "camera") {
+        glm::vec3 position(0.0f);
+        glm::vec3 direction(0.0f, 0.0f, -1.0f);
+        float fov = 45.0f;
+        float aspect = 16.0f / 9.0f;
+        if (!checkProperties(statement, {"position", "direction", "fov", "aspect"}, error) ||
+            !getVec3(statement, "position", position, false, error) ||
+            !getVec3(statement, "direction", direction, false, error) ||
+            !getFloat(statement, "fov", fov, false, error) ||
+            !getFloat(statement, "aspect", aspect, false, error)) {
+            return false;
+        }
+        scene.setCamera(Camera(position, direction, fov, aspect));
+        return true;
+    }
+
+    if (keyword == "material") {
+        // Defaults match a plain, non-reflective diffuse surface
+        Material material;
+        material.color = glm::vec3(1.0f);
+        material.ambient = glm::vec3(0.1f);
+        material.diffuse = glm::vec3(0.7f);
+        material.specular = glm::vec3(0.0f);
+        material.shininess = 1.0f;
+        material.reflectiveness = 0.0f;
+        if (!checkProperties(statement, {"color", "ambient", "diffuse", "specular", "shininess", "reflectiveness"}, error) ||
+            !getVec3(statement, "color", material.color, false, error) ||
+            !getVec3(statement, "ambient", material.ambient, false, error) ||
+            !getVec3(statement, "diffuse", material.diffuse, false, error) ||
+            !getVec3(statement, "specular", material.specular, false, error) ||
+            !getFloat(statement, "shininess", material.shininess, false, error) ||
+            !getFloat(statement, "reflectiveness", material.reflectiveness, false, error)) {
+            return false;
+        }
+        context.materials[statement.name] = material;
+        return true;
+    }
+
+    if (keyword == "sphere") {
+        glm::vec3 position;
+        float radius;
+        Material material;
+        if (!checkProperties(statement, {"position", "radius", "material", "name"}, error) ||
+            !getVec3(statement, "position", position, true, error) ||
+            !getFloat(statement, "radius", radius, true, error) ||
+            !getMaterial(statement, context, material, error)) {
+            return false;
+        }
+        scene.addShape(std::make_shared<Sphere>(position, radius, material));
+        return nameShape(statement, scene, context, error);
+    }
+
+    if (keyword == "cuboid") {
+        glm::vec3 position;
+        glm::vec3 size;
+        Material material;
+        if (!checkProperties(statement, {"position", "size", "material", "name"}, error) ||
+            !getVec3(statement, "position", position, true, error) ||
+            !getVec3(statement, "size", size, true, error) ||
+            !getMaterial(statement, context, material, error)) {
+            return false;
+        }
+        scene.addShape(std::make_shared<Cuboid>(position, size, material));
+        return nameShape(statement, scene, context, error);
+    }
+
+    if (keyword == "mesh") {
+        glm::vec3 position(0.0f);
+        glm::vec3 scale(1.0f);
+        Material material;
+        auto file = statement.words.find("file");
+        if (file == statement.words.end()) {
+            error = "mesh needs 'file'";
+            return false;
+        }
+        std::shared_ptr<const MeshGeometry> geometry;
+        if (!checkProperties(statement, {"file", "position", "scale", "material", "name"}, error) ||
+            !getVec3(statement, "position", position, false, error) ||
+            !getVec3(statement, "scale", scale, false, error) ||
+            !getMaterial(statement, context, material, error) ||
+            !loadMesh(file->second, context, geometry, error)) {
+            return false;
+        }
+        scene.addShape(std::make_shared<TriangleMesh>(geometry, position, scale, material));
+        return nameShape(statement, scene, context, error);
+    }
+
+    if (keyword == "geometry") {
+        auto file = statement.words.find("file");
+        if (file == statement.words.end()) {
+            error = "geometry needs 'file'";
+            return false;
+        }
+        std::shared_ptr<const MeshGeometry> geometry;
+        if (!checkProperties(statement, {"file"}, error) || !loadMesh(file->second, context, geometry, error)) {
+            return false;
+        }
+        context.geometries[statement.name] = geometry;
+        return true;
+    }
+
+    if (keyword == "instance") {
+        glm::vec3 position(0.0f);
+        glm::vec3 rotation(0.0f);
+        glm::vec3 scale(1.0f);
+        Material material;
+        auto name = statement.words.find("geometry");
+        if (name == statement.words.end()) {
+            error = "instance needs 'geometry'";
+            return false;
+        }
+        auto geometry = context.geometries.find(name->second);
+        if (geometry == context.geometries.end()) {
+            error = "unknown geometry '" + name->second + "'";
+            return false;
+        }
+        if (!checkProperties(statement, {"geometry", "position", "rotate", "scale", "material", "name"}, error) ||
+            !getVec3(statement, "position", position, false, error) ||
+            !getVec3(statement, "rotate", rotation, false, error) ||
+            !getVec3(statement, "scale", scale, false, error) ||
+            !getMaterial(statement, context, material, error)) {
+            return false;
+        }
+
+        // Scale, then rotate about x, y and z in turn, then translate
+        glm::mat4 objectToWorld = glm::translate(glm::mat4(1.0f), position);
+        objectToWorld = glm::rotate(objectToWorld, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+        objectToWorld = glm::rotate(objectToWorld, glm::radians(rotation.y), glm::vec3(0, 1, 0));
+        objectToWorld = glm::rotate(objectToWorld, glm::radians(rotation.x), glm::vec3(1, 0, 0));
+        objectToWorld = glm::scale(objectToWorld, scale);
+        scene.addShape(std::make_shared<Instance>(geometry->second, objectToWorld, material));
+        return nameShape(statement, scene, context, error);
+    }
+
+    if (keyword == "light") {
+        glm::vec3 position;
+        glm::vec3 color(1.0f);
+        float intensity = 1.0f;
+        if (!checkProperties(statement, {"position", "color", "intensity", "name"}, error) ||
+            !getVec3(statement, "position", position, true, error) ||
+            !getVec3(statement, "color", color, false, error) ||
+            !getFloat(statement, "intensity", intensity, false, error)) {
+            return false;
+        }
+        auto name = statement.words.find("name");
+        if (name != statement.words.end() && !checkNameFree(context, name->second, error)) {
+            return false;
+        }
+        scene.addLight(std::make_shared<Light>(position, color, intensity));
+        if (name != statement.words.end()) {
+            context.lightNames[name->second] = scene.getLights().size() - 1;
+        }
+        return true;
+    }
+
+    if (keyword == "keyframe") {
+        return applyKeyframe(statement, scene, context, error);
+    }
+
+    error = "unknown statement '" + keyword + "'";
+    return false;
+}
+
+bool load_scene(const char* filename, Scene& scene, std::string& error, Animation* animation,
+                std::vector<std::string>* meshFiles) {
+    std::ifstream file(filename);
+    if (!file) {
+        error = std::string(filename) + ": cannot open file";
+        return false;
+    }
+
+    LoadContext context;
+    context.animation = animation;
+    std::string name(filename);
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos) {
+        context.directory = name.substr(0, slash);
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        Statement statement;
+        std::string message;
+        if (!parseStatement(line, statement, message) || !applyStatement(statement, scene, context, message)) {
+            error = std::string(filename) + ":" + std::to_string(lineNumber) + ": " + message;
+            return false;
+        }
+    }
+
+    if (meshFiles) {
+        for (const auto& mesh : context.meshes) {
+            meshFiles->push_back(mesh.first);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class Scene;
+struct Animation;
+
+// Loads a text scene description into scene. Each line holds one statement: a
+// keyword followed by named properties, and '#' starts a comment.
+//
+//   camera position 0 4 10 direction 0 -0.3 -1 fov 45 aspect 1.333
+//   material red color 1 0 0 ambient 0.1 diffuse 0.7 specular 1 shininess 32 reflectiveness 0
+//   sphere position 0 0 0 radius 1 material red
+//   cuboid position 0 -1.5 0 size 10 0.1 10 material red
+//   light position 2 4 3 color 1 1 1 intensity 1
+//   mesh file bunny.obj position 0 0 0 scale 10 material red
+//   geometry chair file chair.obj
+//   instance geometry chair position 2 0 1 rotate 0 90 0 scale 1 material red
+//   sphere position 0 0 0 radius 1 material red name ball
+//   keyframe ball time 1 position 0 2 0 rotate 0 45 0 scale 1
+//   keyframe camera time 1 position 0 4 8 direction 0 -0.3 -1
+//
+// Colour and coefficient properties take either three numbers or one number
+// used for all channels. Materials must be defined before they are used. Mesh
+// paths are relative to the scene file, and meshes naming the same file share
+// one copy of its geometry. Instances place a named geometry with their own
+// transform (rotation in degrees about x, then y, then z) and material.
+// Shapes and lights may be named, each with a name of its own other than
+// "camera", and keyframes then move them (or the camera) over time: a shape key
+// places the shape's origin and rotates and scales it about that origin, with
+// unset properties keeping the authored placement.
+// Keyframes are added to animation when one is given, and ignored otherwise.
+// meshFiles, when given, receives the path of every OBJ file the scene loaded.
+// On failure error holds "file:line: message" and the scene may be partly filled.
+bool load_scene(const char* filename, Scene& scene, std::string& error, Animation* animation = nullptr,
+                std::vector<std::string>* meshFiles = nullptr);
@@ -2,6 +2,12 @@
 #include <glm/glm.hpp>
 #include "../transforms.h"
 
+// Distance falloff of a light's contribution in Scene::directLighting:
+// inverse square law with smoothing, 1 at the light itself
+inline float light_falloff(float distance) {
+    return 1.0f / (1.0f + 0.09f * distance + 0.032f * distance * distance);
+}
+
 class Light {
 protected:
     Transform transform;
@@ -46,4 +52,7 @@ public:
         position = pos;
         transform.modelMatrix = glm::translate(glm::mat4(1.0f), position);
     }
+
+    void setColor(const glm::vec3& col) { color = col; }
+    void setIntensity(float intens) { intensity = intens; }
 }; 
\ No newline at end of file
@@ -1,19 +1,28 @@
 #include "scene.h"
 #include "shapes/sphere.h"
 #include "shapes/cuboid.h"
+#include "io/scene_file.h"
+#include "io/scene_cache.h"
+#include "render/animation.h"
+#include "render/sequence_renderer.h"
+#include "render/distributed_renderer.h"
+#include "server/render_daemon.h"
+#include <chrono>
 #include <memory>
 #include <iostream>
+#include <string>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
 
-int main() {
-    const int width = 800;
-    const int height = 600;
-
-    // Create camera and scene
+// The built-in demo scene, used when no scene file is given
+static void addDefaultScene(Scene& scene) {
+    // Create camera
     Camera camera(
         glm::vec3(0, 4, 10),     // Position: higher up and further back
         glm::vec3(0, -0.3f, -1)  // Direction: looking slightly downward
     );
-    Scene scene(camera);
+    scene.setCamera(camera);
 
     // Create a material for the sphere
     Material sphereMaterial;
@@ -72,13 +81,276 @@ int main() {
         1.0f                     // intensity
     );
     scene.addLight(light);
+}
+
+int main(int argc, char** argv) {
+    const int width = 800;
+    const int height = 600;
+
+    RenderSettings settings;
+    std::string statsPath;
+    std::string heatmapPath;
+    std::string referencePath;
+    std::string scenePath;
+    std::string cachePath;
+    std::string daemonSocket;
+    std::string checkpointPath;
+    int processCount = 0;
+    SequenceSettings sequence;
+    sequence.width = width;
+    sequence.height = height;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            settings.threadCount = std::atoi(argv[++i]);
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            settings.tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--spp" && i + 1 < argc) {
+            settings.samplesPerPixel = std::atoi(argv[++i]);
+        } else if (arg == "--max-spp" && i + 1 < argc) {
+            settings.maxSamplesPerPixel = std::atoi(argv[++i]);
+        } else if (arg == "--max-depth" && i + 1 < argc) {
+            settings.maxDepth = std::atoi(argv[++i]);
+        } else if (arg == "--min-throughput" && i + 1 < argc) {
+            settings.minThroughput = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--roulette") {
+            settings.russianRoulette = true;
+        } else if (arg == "--light-cutoff" && i + 1 < argc) {
+            settings.lightCutoff = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--light-samples" && i + 1 < argc) {
+            settings.lightSamples = std::atoi(argv[++i]);
+        } else if (arg == "--wavefront") {
+            settings.wavefront = true;
+        } else if (arg == "--rasterize") {
+            settings.rasterize = true;
+        } else if (arg == "--progressive" && i + 1 < argc) {
+            settings.progressiveBlock = std::atoi(argv[++i]);
+        } else if (arg == "--deadline" && i + 1 < argc) {
+            settings.deadlineSeconds = std::atof(argv[++i]) / 1000.0;
+        } else if (arg == "--denoise") {
+            settings.denoise = true;
+        } else if (arg == "--denoise-passes" && i + 1 < argc) {
+            settings.denoise = true;
+            settings.denoiseOptions.iterations =
+                std::min(std::max(std::atoi(argv[++i]), 1), DenoiseOptions::MAX_ITERATIONS);
+        } else if (arg == "--write-aovs") {
+            settings.writeFeatures = true;
+        } else if (arg == "--reference" && i + 1 < argc) {
+            referencePath = argv[++i];
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (arg == "--stream") {
+            settings.streamOutput = true;
+        } else if (arg == "--png-level" && i + 1 < argc) {
+            char* end = nullptr;
+            long level = std::strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || level < 0 || level > 9) {
+                std::cerr << "--png-level takes a zlib level from 0 to 9, got " << argv[i] << std::endl;
+                return -1;
+            }
+            settings.pngOptions.compressionLevel = static_cast<int>(level);
+        } else if (arg == "--png-filter" && i + 1 < argc) {
+            std::string filter = argv[++i];
+            if (filter == "none") settings.pngOptions.filter = PngFilter::None;
+            else if (filter == "sub") settings.pngOptions.filter = PngFilter::Sub;
+            else if (filter == "up") settings.pngOptions.filter = PngFilter::Up;
+            else if (filter == "average") settings.pngOptions.filter = PngFilter::Average;
+            else if (filter == "paeth") settings.pngOptions.filter = PngFilter::Paeth;
+            else if (filter == "all") settings.pngOptions.filter = PngFilter::Default;
+            else {
+                std::cerr << "Unknown PNG filter " << filter << ", expected none, sub, up, average, paeth or all"
+                          << std::endl;
+                return -1;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            if (!parse_image_format(argv[++i], settings.imageFormat)) {
+                std::cerr << "Unknown format " << argv[i] << ", expected png, png-parallel, ppm or raw" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scenePath = argv[++i];
+        } else if (arg == "--write-cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--processes" && i + 1 < argc) {
+            processCount = std::atoi(argv[++i]);
+        } else if (arg == "--daemon" && i + 1 < argc) {
+            daemonSocket = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            sequence.frameCount = std::atoi(argv[++i]);
+        } else if (arg == "--frame-pattern" && i + 1 < argc) {
+            sequence.outputPattern = argv[++i];
+        } else if (arg == "--profile") {
+            settings.collectTimings = true;
+        } else if (arg == "--stats-json" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (arg == "--heatmap" && i + 1 < argc) {
+            heatmapPath = argv[++i];
+            settings.recordPixelCost = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--tile-size N] [--spp N] [--max-spp N] [--wavefront] [--rasterize]"
+                      << " [--max-depth N] [--min-throughput X] [--roulette] [--light-cutoff X] [--light-samples N]"
+                      << " [--progressive N] [--deadline MS] [--denoise] [--denoise-passes N] [--write-aovs] [--reference FILE]"
+                      << " [--checkpoint FILE] [--stream] [--png-level 0-9] [--png-filter none|sub|up|average|paeth|all]"
+                      << " [--format png|png-parallel|ppm|raw]"
+                      << " [--profile] [--stats-json FILE] [--heatmap FILE]"
+                      << " [--scene FILE] [--write-cache FILE] [--frames N] [--frame-pattern PATTERN]"
+                      << " [--processes N] [--daemon SOCKET]" << std::endl;
+            return -1;
+        }
+    }
+
+    // A deadline only has something to cut short in progressive mode
+    if (settings.deadlineSeconds > 0.0 && settings.progressiveBlock <= 1) {
+        settings.progressiveBlock = 8;
+    }
+    // The comparison reads the written image back as PNG, so check before rendering
+    if (!referencePath.empty() && settings.imageFormat != ImageFormat::Png &&
+        settings.imageFormat != ImageFormat::ParallelPng) {
+        std::cerr << "--reference needs PNG output" << std::endl;
+        return -1;
+    }
+    // Progressive passes take one sample per pixel
+    if (settings.progressiveBlock > 1 && (settings.samplesPerPixel > 1 || settings.maxSamplesPerPixel > 1)) {
+        std::cerr << "--progressive and --deadline take one sample per pixel and cannot be combined with --spp or --max-spp"
+                  << std::endl;
+        return -1;
+    }
+    // Worker processes and animations render whole frames, with nothing to cut short
+    if (settings.progressiveBlock > 1 && (processCount > 0 || sequence.frameCount > 1)) {
+        std::cerr << "--progressive and --deadline cannot be combined with --processes or --frames" << std::endl;
+        return -1;
+    }
+    // The wavefront path evaluates every light, so Scene falls back to tracing pixel by pixel
+    if (settings.wavefront && (settings.lightCutoff > 0.0f || settings.lightSamples > 0)) {
+        std::cerr << "Warning: --wavefront does not cull or sample lights; rendering pixel by pixel for "
+                  << (settings.lightSamples > 0 ? "--light-samples" : "--light-cutoff") << std::endl;
+        settings.wavefront = false;
+    }
 
-    // Render to PNG
-    if (!scene.renderToPNG("output.png", width, height)) {
-        std::cerr << "Failed to write PNG file" << std::endl;
+    // A checkpointed frame lives in its file, not in memory, and is rendered tile by tile
+    if (!checkpointPath.empty() &&
+        (settings.denoise || settings.writeFeatures || settings.progressiveBlock > 1 || !heatmapPath.empty() ||
+         processCount > 0 || sequence.frameCount > 1 || !daemonSocket.empty())) {
+        std::cerr << "--checkpoint cannot be combined with --denoise, --write-aovs, --progressive, --deadline,"
+                  << " --heatmap, --processes, --frames or --daemon" << std::endl;
         return -1;
     }
 
-    std::cout << "Rendered image saved to output.png" << std::endl;
+    std::string error;
+    if (!daemonSocket.empty()) {
+        // Scenes are named by each request instead of on the command line
+        DaemonSettings daemonSettings;
+        daemonSettings.socketPath = daemonSocket;
+        daemonSettings.renderSettings = settings;
+        daemonSettings.renderSettings.showProgress = false;
+        RenderDaemon daemon(daemonSettings);
+        std::cout << "Listening on " << daemonSocket << std::endl;
+        if (!daemon.run(error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    Scene scene;
+    scene.setRenderSettings(settings);
+
+    Animation animation;
+    if (scenePath.empty()) {
+        addDefaultScene(scene);
+    } else if (is_scene_cache(scenePath.c_str()) ? !load_scene_cache(scenePath.c_str(), scene, error)
+                                                 : !load_scene(scenePath.c_str(), scene, error, &animation)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+
+    if (!cachePath.empty() && !save_scene_cache(cachePath.c_str(), scene, error)) {
+        std::cerr << cachePath << ": " << error << std::endl;
+        return -1;
+    }
+
+    if (sequence.frameCount > 1) {
+        // Animations keep the scene and its BVH across frames; the progress bar would only clutter the timings
+        settings.showProgress = false;
+        scene.setRenderSettings(settings);
+        SequenceRenderer renderer(scene, animation);
+        if (!renderer.render(sequence, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+        renderer.printTimings(std::cout);
+        return 0;
+    }
+
+    // Render to an image file
+    std::string outputPath = std::string("output.") + image_format_extension(settings.imageFormat);
+    if (processCount > 0) {
+        DistributedSettings distributed;
+        distributed.workerCount = processCount;
+        DistributedRenderer renderer(scene, distributed);
+        if (!renderer.renderToPNG(outputPath.c_str(), width, height, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+        std::cout << "Rendered image saved to " << outputPath << std::endl;
+        renderer.printReport(std::cout);
+        return 0;
+    }
+
+    if (settings.progressiveBlock > 1) {
+        auto start = std::chrono::steady_clock::now();
+        scene.setFrameCallback([start](const std::vector<unsigned char>&, int spacing) {
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Pass at spacing " << spacing << " ready after " << milliseconds << " ms" << std::endl;
+        });
+    }
+
+    if (!checkpointPath.empty()) {
+        if (!scene.renderToCheckpointedPNG(outputPath.c_str(), width, height, checkpointPath, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+    } else if (!scene.renderToPNG(outputPath.c_str(), width, height)) {
+        std::cerr << "Failed to write " << outputPath << std::endl;
+        return -1;
+    }
+
+    std::cout << "Rendered image saved to " << outputPath << std::endl;
+    scene.printStats(std::cout);
+
+    if (!statsPath.empty()) {
+        std::ofstream statsFile(statsPath);
+        scene.getRenderStats().writeJson(statsFile);
+        if (!statsFile) {
+            std::cerr << "Failed to write " << statsPath << std::endl;
+            return -1;
+        }
+    }
+
+    if (!heatmapPath.empty() && !write_cost_heatmap(heatmapPath.c_str(), width, height, scene.getPixelCost())) {
+        std::cerr << "Failed to write " << heatmapPath << std::endl;
+        return -1;
+    }
+
+    if (!referencePath.empty()) {
+        // Both images are read back from disk, so the comparison sees exactly what was encoded
+        int imageWidth = 0, imageHeight = 0, referenceWidth = 0, referenceHeight = 0;
+        std::vector<unsigned char> image;
+        std::vector<unsigned char> reference;
+        ImageError imageError;
+        if (!read_png(outputPath.c_str(), imageWidth, imageHeight, image) ||
+            !read_png(referencePath.c_str(), referenceWidth, referenceHeight, reference)) {
+            std::cerr << "Failed to read " << outputPath << " or " << referencePath << std::endl;
+            return -1;
+        }
+        if (imageWidth != referenceWidth || imageHeight != referenceHeight ||
+            !compare_images(image, reference, imageError)) {
+            std::cerr << referencePath << " is " << referenceWidth << "x" << referenceHeight
+                      << ", expected " << imageWidth << "x" << imageHeight << std::endl;
+            return -1;
+        }
+        std::cout << "Error vs " << referencePath << ": RMSE " << imageError.rmse
+                  << ", PSNR " << imageError.psnr << " dB" << std::endl;
+    }
     return 0;
 }
@@ -7,11 +7,19 @@ private:
     glm::vec3 direction;
 
 public:
+    // Tag for constructing a ray whose direction is already unit length
+    struct UnitDirection {};
+
     Ray(const glm::vec3& orig, const glm::vec3& dir)
         : origin(orig)
         , direction(glm::normalize(dir))  // Ensure direction is normalized
     {}
 
+    Ray(const glm::vec3& orig, const glm::vec3& unitDir, UnitDirection)
+        : origin(orig)
+        , direction(unitDir)
+    {}
+
     glm::vec3 getOrigin() const { return origin; }
     glm::vec3 getDirection() const { return direction; }
 
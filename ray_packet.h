@@ -0,0 +1,32 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "ray.h"
+
+// Coherent bundle of primary rays for a block of neighbouring pixels. All rays
+// share the camera origin; directions are stored structure-of-arrays so the
+// per-lane loops in packet traversal vectorize.
+struct RayPacket {
+    static constexpr int WIDTH = 8;
+    static constexpr int HEIGHT = 8;
+    static constexpr int SIZE = WIDTH * HEIGHT;
+
+    glm::vec3 origin;
+    float dirX[SIZE];
+    float dirY[SIZE];
+    float dirZ[SIZE];
+
+    // Pixel block covered by the packet. Blocks at image edges may be smaller
+    // than WIDTH x HEIGHT; lane i maps to pixel (x0 + i % width, y0 + i / width).
+    int x0, y0;
+    int width, height;
+
+    int size() const { return width * height; }
+
+    glm::vec3 getDirection(int lane) const {
+        return glm::vec3(dirX[lane], dirY[lane], dirZ[lane]);
+    }
+
+    Ray getRay(int lane) const {
+        return Ray(origin, getDirection(lane), Ray::UnitDirection());
+    }
+};
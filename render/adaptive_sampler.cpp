@@ -0,0 +1,162 @@
+#include "adaptive_sampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "../scene.h"
+
+// Radical inverse of i in the given base, the building block of the Halton sequence
+static float radicalInverse(uint32_t i, uint32_t base) {
+    float inverseBase = 1.0f / base;
+    float factor = inverseBase;
+    float result = 0.0f;
+    while (i > 0) {
+        result += (i % base) * factor;
+        i /= base;
+        factor *= inverseBase;
+    }
+    return result;
+}
+
+// Integer hash used to decorrelate the sample patterns of neighbouring pixels
+static uint32_t hashPixel(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static float luminance(const glm::vec3& color) {
+    return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+bool AdaptiveSampler::isEnabled(const RenderSettings& settings) {
+    return settings.samplesPerPixel > 1 || settings.maxSamplesPerPixel > settings.samplesPerPixel;
+}
+
+AdaptiveSampler::AdaptiveSampler(const Scene& scene, const RenderSettings& settings, int width, int height,
+                                 int firstRow, int rowCount, float* pixelCost)
+    : scene(scene)
+    , settings(settings)
+    , width(width)
+    , height(height)
+    , firstRow(firstRow)
+    , rowCount(rowCount)
+    , colorSum(width * rowCount, glm::vec3(0.0f))
+    , luminanceSum(width * rowCount, 0.0f)
+    , luminanceSquaredSum(width * rowCount, 0.0f)
+    , sampleCount(width * rowCount, 0)
+    , baseLuminance(width * rowCount, 0.0f)
+    , pixelCost(pixelCost)
+    , totalSamples(0)
+    , refinedPixels(0)
+{
+    this->settings.samplesPerPixel = std::max(this->settings.samplesPerPixel, 1);
+    this->settings.maxSamplesPerPixel = std::min(std::max(this->settings.maxSamplesPerPixel, this->settings.samplesPerPixel), 65535);
+}
+
+void AdaptiveSampler::takeSamples(int x, int y, int first, int count) {
+    // Halton (2, 3) points are stratified for every prefix length, so samples added
+    // later keep filling the gaps left by earlier ones. A per-pixel toroidal shift
+    // keeps neighbouring pixels from sharing one pattern.
+    uint32_t hash = hashPixel(x, y);
+    float shiftX = (hash & 0xffff) / 65536.0f;
+    float shiftY = (hash >> 16) / 65536.0f;
+
+    int index = indexOf(x, y);
+    std::chrono::steady_clock::time_point start;
+    if (pixelCost) start = std::chrono::steady_clock::now();
+
+    for (int k = first; k < first + count; ++k) {
+        float sx = radicalInverse(k + 1, 2) + shiftX;
+        float sy = radicalInverse(k + 1, 3) + shiftY;
+        sx -= std::floor(sx);
+        sy -= std::floor(sy);
+
+        Ray ray = scene.getCamera().getRay((x + sx) / float(width), (y + sy) / float(height));
+        glm::vec3 color = scene.shadeRay(ray);
+
+        float l = luminance(color);
+        colorSum[index] += color;
+        luminanceSum[index] += l;
+        luminanceSquaredSum[index] += l * l;
+    }
+    sampleCount[index] += count;
+    totalSamples.fetch_add(count, std::memory_order_relaxed);
+
+    if (pixelCost) {
+        pixelCost[static_cast<size_t>(y) * width + x] +=
+            std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+float AdaptiveSampler::standardError(int index) const {
+    float n = sampleCount[index];
+    if (n < 2.0f) {
+        return 0.0f;
+    }
+    float mean = luminanceSum[index] / n;
+    float variance = std::max(luminanceSquaredSum[index] / n - mean * mean, 0.0f) * n / (n - 1.0f);
+    return std::sqrt(variance / n);
+}
+
+bool AdaptiveSampler::needsRefinement(int x, int y) const {
+    int index = indexOf(x, y);
+    if (standardError(index) > settings.varianceThreshold) {
+        return true;
+    }
+
+    float center = baseLuminance[index];
+    const int offsets[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+    for (const auto& offset : offsets) {
+        int nx = x + offset[0];
+        int ny = y + offset[1];
+        if (nx < 0 || ny < firstRow || nx >= width || ny >= firstRow + rowCount) continue;
+        if (std::abs(baseLuminance[indexOf(nx, ny)] - center) > settings.contrastThreshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AdaptiveSampler::sampleTile(const Tile& tile) {
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            takeSamples(x, y, 0, settings.samplesPerPixel);
+            int index = indexOf(x, y);
+            baseLuminance[index] = luminanceSum[index] / sampleCount[index];
+        }
+    }
+}
+
+void AdaptiveSampler::refineTile(const Tile& tile) {
+    int step = settings.samplesPerPixel;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            int index = indexOf(x, y);
+            if (sampleCount[index] >= settings.maxSamplesPerPixel || !needsRefinement(x, y)) {
+                continue;
+            }
+            refinedPixels.fetch_add(1, std::memory_order_relaxed);
+
+            // Keep adding batches while the estimate is still noisy. Pixels flagged only
+            // by neighbour contrast get at least one extra batch.
+            do {
+                int count = std::min(step, settings.maxSamplesPerPixel - sampleCount[index]);
+                takeSamples(x, y, sampleCount[index], count);
+            } while (sampleCount[index] < settings.maxSamplesPerPixel &&
+                     standardError(index) > settings.varianceThreshold);
+        }
+    }
+}
+
+void AdaptiveSampler::resolveTile(const Tile& tile, const ImageRows& out) const {
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            int index = indexOf(x, y);
+            storePixel(out.pixel(x, y), colorSum[index] / float(sampleCount[index]));
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "../render_settings.h"
+#include "tile.h"
+
+class Scene;
+
+// Multi-sample pixel estimator. Every pixel first gets settings.samplesPerPixel
+// stratified samples; a second pass then spends extra samples, up to
+// settings.maxSamplesPerPixel, only on pixels that are noisy or sit on an edge.
+// Both passes work on tiles and may run concurrently for different tiles.
+// A sampler covers rows [firstRow, firstRow + rowCount) of the image, so a
+// streamed render can keep estimates for one band at a time.
+class AdaptiveSampler {
+private:
+    const Scene& scene;
+    RenderSettings settings;
+    int width;
+    int height;
+    int firstRow;
+    int rowCount;
+
+    // Running sums per pixel, filled by sampleTile and extended by refineTile
+    std::vector<glm::vec3> colorSum;
+    std::vector<float> luminanceSum;
+    std::vector<float> luminanceSquaredSum;
+    std::vector<uint16_t> sampleCount;
+
+    // Mean luminance after the base pass, used for the neighbour contrast test
+    std::vector<float> baseLuminance;
+
+    // Optional full-frame buffer, indexed y * width + x, that takeSamples adds its time to
+    float* pixelCost;
+
+    std::atomic<uint64_t> totalSamples;
+    std::atomic<uint64_t> refinedPixels;
+
+    // Traces samples [first, first + count) of a pixel's sample sequence
+    void takeSamples(int x, int y, int first, int count);
+
+    int indexOf(int x, int y) const { return (y - firstRow) * width + x; }
+
+    bool needsRefinement(int x, int y) const;
+    float standardError(int index) const;
+
+public:
+    AdaptiveSampler(const Scene& scene, const RenderSettings& settings, int width, int height,
+                    int firstRow, int rowCount, float* pixelCost = nullptr);
+
+    // Base pass: the same number of samples for every pixel of the tile
+    void sampleTile(const Tile& tile);
+
+    // Refinement pass. Reads base-pass luminance of neighbouring tiles, so it
+    // must only start once sampleTile has run for every tile of the frame.
+    void refineTile(const Tile& tile);
+
+    // Writes the averaged colours of a tile
+    void resolveTile(const Tile& tile, const ImageRows& out) const;
+
+    uint64_t getTotalSamples() const { return totalSamples.load(); }
+    uint64_t getRefinedPixels() const { return refinedPixels.load(); }
+
+    // True when the settings ask for more than the classic single sample per pixel
+    static bool isEnabled(const RenderSettings& settings);
+};
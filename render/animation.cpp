@@ -0,0 +1,104 @@
+#include "animation.h"
+#include <algorithm>
+#include <limits>
+#include "../transforms.h"
+
+// Inserts a key after any keys with the same or an earlier time
+template <typename Key>
+static void insertKey(std::vector<Key>& keys, const Key& key) {
+    auto position = std::upper_bound(keys.begin(), keys.end(), key,
+        [](const Key& a, const Key& b) { return a.time < b.time; });
+    keys.insert(position, key);
+}
+
+// Finds the keys around time and how far time lies between them. keys must not be empty.
+template <typename Key>
+static void bracket(const std::vector<Key>& keys, float time, const Key*& before, const Key*& after, float& t) {
+    auto next = std::upper_bound(keys.begin(), keys.end(), time,
+        [](float value, const Key& key) { return value < key.time; });
+    if (next == keys.begin()) {
+        before = after = &keys.front();
+        t = 0.0f;
+    } else if (next == keys.end()) {
+        before = after = &keys.back();
+        t = 0.0f;
+    } else {
+        before = &*(next - 1);
+        after = &*next;
+        float span = after->time - before->time;
+        t = span > 0.0f ? (time - before->time) / span : 1.0f;
+    }
+}
+
+void Animation::addCameraKey(const CameraKey& key) {
+    insertKey(camera, key);
+}
+
+void Animation::addShapeKey(size_t shapeIndex, const TransformKey& key) {
+    for (ShapeTrack& track : shapes) {
+        if (track.shapeIndex == shapeIndex) {
+            insertKey(track.keys, key);
+            return;
+        }
+    }
+    shapes.push_back({shapeIndex, {key}});
+}
+
+void Animation::addLightKey(size_t lightIndex, const LightKey& key) {
+    for (LightTrack& track : lights) {
+        if (track.lightIndex == lightIndex) {
+            insertKey(track.keys, key);
+            return;
+        }
+    }
+    lights.push_back({lightIndex, {key}});
+}
+
+float Animation::startTime() const {
+    float start = std::numeric_limits<float>::infinity();
+    if (!camera.empty()) start = std::min(start, camera.front().time);
+    for (const ShapeTrack& track : shapes) start = std::min(start, track.keys.front().time);
+    for (const LightTrack& track : lights) start = std::min(start, track.keys.front().time);
+    return isEmpty() ? 0.0f : start;
+}
+
+float Animation::endTime() const {
+    float end = -std::numeric_limits<float>::infinity();
+    if (!camera.empty()) end = std::max(end, camera.back().time);
+    for (const ShapeTrack& track : shapes) end = std::max(end, track.keys.back().time);
+    for (const LightTrack& track : lights) end = std::max(end, track.keys.back().time);
+    return isEmpty() ? 0.0f : end;
+}
+
+CameraKey Animation::sample(const std::vector<CameraKey>& keys, float time) {
+    const CameraKey* before;
+    const CameraKey* after;
+    float t;
+    bracket(keys, time, before, after, t);
+    return {time, glm::mix(before->position, after->position, t), glm::mix(before->direction, after->direction, t)};
+}
+
+TransformKey Animation::sample(const std::vector<TransformKey>& keys, float time) {
+    const TransformKey* before;
+    const TransformKey* after;
+    float t;
+    bracket(keys, time, before, after, t);
+    return {time, glm::mix(before->position, after->position, t), glm::mix(before->rotation, after->rotation, t),
+            glm::mix(before->scale, after->scale, t)};
+}
+
+LightKey Animation::sample(const std::vector<LightKey>& keys, float time) {
+    const LightKey* before;
+    const LightKey* after;
+    float t;
+    bracket(keys, time, before, after, t);
+    return {time, glm::mix(before->position, after->position, t)};
+}
+
+glm::mat4 Animation::toMatrix(const TransformKey& key) {
+    glm::mat4 matrix = glm::translate(glm::mat4(1.0f), key.position);
+    matrix = glm::rotate(matrix, glm::radians(key.rotation.z), glm::vec3(0, 0, 1));
+    matrix = glm::rotate(matrix, glm::radians(key.rotation.y), glm::vec3(0, 1, 0));
+    matrix = glm::rotate(matrix, glm::radians(key.rotation.x), glm::vec3(1, 0, 0));
+    return glm::scale(matrix, key.scale);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+// Camera pose at a point in time
+struct CameraKey {
+    float time;
+    glm::vec3 position;
+    glm::vec3 direction;
+};
+
+// Placement of a shape at a point in time. The shape is scaled and rotated
+// (degrees about x, then y, then z) about its own origin, then moved so that
+// origin sits at position.
+struct TransformKey {
+    float time;
+    glm::vec3 position;
+    glm::vec3 rotation;
+    glm::vec3 scale;
+};
+
+// Light position at a point in time
+struct LightKey {
+    float time;
+    glm::vec3 position;
+};
+
+struct ShapeTrack {
+    size_t shapeIndex;      // Position in the scene's shape list
+    std::vector<TransformKey> keys;
+};
+
+struct LightTrack {
+    size_t lightIndex;      // Position in the scene's light list
+    std::vector<LightKey> keys;
+};
+
+// Keyframed motion of a scene's camera, shapes and lights. Keys are kept sorted
+// by time; between two keys values are interpolated linearly, and outside the
+// keyed range the first or last key holds.
+struct Animation {
+    std::vector<CameraKey> camera;
+    std::vector<ShapeTrack> shapes;
+    std::vector<LightTrack> lights;
+
+    void addCameraKey(const CameraKey& key);
+    void addShapeKey(size_t shapeIndex, const TransformKey& key);
+    void addLightKey(size_t lightIndex, const LightKey& key);
+
+    bool isEmpty() const { return camera.empty() && shapes.empty() && lights.empty(); }
+
+    // Earliest and latest key time over all tracks, 0 when there are no keys
+    float startTime() const;
+    float endTime() const;
+
+    static CameraKey sample(const std::vector<CameraKey>& keys, float time);
+    static TransformKey sample(const std::vector<TransformKey>& keys, float time);
+    static LightKey sample(const std::vector<LightKey>& keys, float time);
+
+    // Object-to-world matrix of a key: scale, rotate, then translate
+    static glm::mat4 toMatrix(const TransformKey& key);
+};
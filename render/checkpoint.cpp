@@ -0,0 +1,259 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../scene.h"
+#include "../utils/fingerprint.h"
+
+static const char MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+static const uint32_t VERSION = 1;
+
+// Pixels start on a page boundary, so syncing them never touches the flags' page
+static uint64_t pageAlign(uint64_t offset) {
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    return (offset + page - 1) / page * page;
+}
+
+// msync needs a page-aligned start; widens [begin, begin + bytes) to whole pages
+static bool syncRange(unsigned char* map, size_t begin, size_t bytes) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = begin / page * page;
+    return msync(map + start, bytes + (begin - start), MS_SYNC) == 0;
+}
+
+FrameCheckpoint::~FrameCheckpoint() {
+    close();
+}
+
+bool FrameCheckpoint::open(const std::string& filePath, int frameWidth, int frameHeight, int tileSize,
+                           uint64_t fingerprint, std::string& error) {
+    close();
+    if (frameWidth <= 0 || frameHeight <= 0 || tileSize <= 0) {
+        error = "invalid frame or tile size";
+        return false;
+    }
+
+    int tilesX = (frameWidth + tileSize - 1) / tileSize;
+    int tilesY = (frameHeight + tileSize - 1) / tileSize;
+    uint64_t pixelOffset = pageAlign(sizeof(Header) + static_cast<uint64_t>(tilesX) * tilesY);
+    uint64_t fileBytes = pixelOffset + static_cast<uint64_t>(frameWidth) * frameHeight * 3;
+
+    fd = ::open(filePath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = filePath + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        error = filePath + ": " + std::strerror(errno);
+        close();
+        return false;
+    }
+
+    bool fresh = info.st_size == 0;
+    if (fresh) {
+        // Extends the file without writing it, so untouched pages take no disk space
+        if (ftruncate(fd, static_cast<off_t>(fileBytes)) != 0) {
+            error = filePath + ": " + std::strerror(errno);
+            close();
+            return false;
+        }
+    } else if (static_cast<uint64_t>(info.st_size) != fileBytes) {
+        error = filePath + " is not a checkpoint of this frame";
+        close();
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        error = filePath + ": " + std::strerror(errno);
+        close();
+        return false;
+    }
+    map = static_cast<unsigned char*>(mapped);
+    mapBytes = fileBytes;
+    path = filePath;
+    width = frameWidth;
+    height = frameHeight;
+    tileCount = tilesX * tilesY;
+    flags = map + sizeof(Header);
+    pixels = map + pixelOffset;
+
+    // A crash between sizing the file and syncing its header leaves the header
+    // zeroed; no tile can have been flagged yet, so the file is started over
+    Header* header = reinterpret_cast<Header*>(map);
+    if (!fresh && std::all_of(map, map + sizeof(Header), [](unsigned char byte) { return byte == 0; })) {
+        std::memset(flags, 0, static_cast<size_t>(tileCount));
+        fresh = true;
+    }
+    if (fresh) {
+        Header created = {};
+        std::memcpy(created.magic, MAGIC, sizeof(MAGIC));
+        created.version = VERSION;
+        created.width = frameWidth;
+        created.height = frameHeight;
+        created.tileSize = tileSize;
+        created.tileCount = static_cast<uint32_t>(tileCount);
+        created.fingerprint = fingerprint;
+        created.pixelOffset = pixelOffset;
+        *header = created;
+        if (!syncRange(map, 0, sizeof(Header))) {
+            error = filePath + ": " + std::strerror(errno);
+            close();
+            return false;
+        }
+    } else if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION) {
+        error = filePath + " is not a checkpoint file";
+        close();
+        return false;
+    } else if (header->width != frameWidth || header->height != frameHeight || header->tileSize != tileSize ||
+               header->tileCount != static_cast<uint32_t>(tileCount) || header->pixelOffset != pixelOffset) {
+        error = filePath + " is a checkpoint of a different frame size or tiling";
+        close();
+        return false;
+    } else if (header->fingerprint != fingerprint) {
+        error = filePath + " was rendered from a different scene or settings";
+        close();
+        return false;
+    }
+
+    resumedTiles = 0;
+    for (int tile = 0; tile < tileCount; ++tile) {
+        if (flags[tile]) resumedTiles++;
+    }
+    pending.clear();
+    lastCommit = std::chrono::steady_clock::now();
+    return true;
+}
+
+void FrameCheckpoint::markDone(int tile) {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    pending.push_back(tile);
+    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - lastCommit).count() >= commitSeconds) {
+        commitLocked();
+    }
+}
+
+bool FrameCheckpoint::commit() {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    return commitLocked();
+}
+
+bool FrameCheckpoint::commitLocked() {
+    lastCommit = std::chrono::steady_clock::now();
+    if (!map || pending.empty()) {
+        return map != nullptr;
+    }
+
+    // Pixels reach the disk before the flags that vouch for them. Tiles still
+    // rendering may write pixels meanwhile; their flags wait for a later commit.
+    size_t pixelOffset = static_cast<size_t>(pixels - map);
+    if (!syncRange(map, pixelOffset, mapBytes - pixelOffset)) {
+        return false;
+    }
+    for (int tile : pending) {
+        flags[tile] = 1;
+    }
+    pending.clear();
+    return syncRange(map, 0, pixelOffset);
+}
+
+void FrameCheckpoint::close() {
+    if (map) {
+        commit();
+        munmap(map, mapBytes);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    map = nullptr;
+    mapBytes = 0;
+    flags = nullptr;
+    pixels = nullptr;
+    tileCount = 0;
+    resumedTiles = 0;
+}
+
+void FrameCheckpoint::remove() {
+    std::string removed = path;
+    close();
+    if (!removed.empty()) {
+        std::remove(removed.c_str());
+    }
+    path.clear();
+}
+
+uint64_t checkpoint_fingerprint(const Scene& scene, int width, int height) {
+    Fingerprint fingerprint;
+    fingerprint.add(width);
+    fingerprint.add(height);
+
+    const Camera& camera = scene.getCamera();
+    fingerprint.add(camera.getPosition());
+    fingerprint.add(camera.getDirection());
+    fingerprint.add(camera.getFieldOfView());
+    fingerprint.add(camera.getAspectRatio());
+
+    // Settings that change pixels; threads, output and instrumentation do not
+    const RenderSettings& settings = scene.getRenderSettings();
+    fingerprint.add(settings.tileSize);
+    fingerprint.add(settings.samplesPerPixel);
+    fingerprint.add(settings.maxSamplesPerPixel);
+    fingerprint.add(settings.varianceThreshold);
+    fingerprint.add(settings.contrastThreshold);
+    fingerprint.add(settings.maxDepth);
+    fingerprint.add(settings.minThroughput);
+    fingerprint.add(settings.russianRoulette);
+    fingerprint.add(settings.lightCutoff);
+    fingerprint.add(settings.lightSamples);
+
+    for (const auto& light : scene.getLights()) {
+        fingerprint.add(light->getPosition());
+        fingerprint.add(light->getColor());
+        fingerprint.add(light->getIntensity());
+    }
+
+    const CompiledScene& compiled = scene.getCompiledScene();
+    for (const Material& material : compiled.getMaterials()) {
+        fingerprint.add(material.color);
+        fingerprint.add(material.ambient);
+        fingerprint.add(material.diffuse);
+        fingerprint.add(material.specular);
+        fingerprint.add(material.shininess);
+        fingerprint.add(material.reflectiveness);
+    }
+
+    // Every primitive's placement and the whole hierarchy, so moving, resizing or
+    // retyping any shape is noticed. This is cheap next to rendering the frame.
+    fingerprint.add(static_cast<uint64_t>(compiled.getShapeCount()));
+    for (const PrimitiveRef& ref : compiled.getPrimitives()) {
+        fingerprint.add(static_cast<uint32_t>(ref.type));
+        fingerprint.add(ref.poolIndex);
+        fingerprint.add(ref.shapeIndex);
+        fingerprint.add(ref.material);
+    }
+    fingerprint.addArray(compiled.getSpheres().objectToWorld);
+    fingerprint.addArray(compiled.getSpheres().radius);
+    fingerprint.addArray(compiled.getCuboids().objectToWorld);
+    const InstancePool& instances = compiled.getInstances();
+    fingerprint.addArray(instances.objectToWorld);
+    fingerprint.addArray(instances.geometryIndex);
+    for (const auto& geometry : instances.geometries) {
+        geometry->addToFingerprint(fingerprint);
+    }
+    // Other shape types only expose their placement and extent
+    for (const auto& shape : compiled.getGenerics().shapes) {
+        fingerprint.add(shape->getModelMatrix());
+        fingerprint.add(shape->getBounds().min);
+        fingerprint.add(shape->getBounds().max);
+    }
+    fingerprint.addArray(compiled.getBVH().getNodes());
+    fingerprint.addArray(compiled.getBVH().getPrimitiveIndices());
+    return fingerprint.value();
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Scene;
+
+// A frame buffer and a completion flag per tile, kept in a memory-mapped file so
+// a long render survives a crash or preemption and resumes where it stopped.
+// Tiles are numbered as Scene::makeTiles numbers them, row-major.
+//
+// Render threads write pixels straight into the mapping. Finished tiles are
+// only flagged in memory at first; commit() syncs the pixels to disk before it
+// writes their flags, so a tile flagged in the file is complete on disk even
+// after a power loss. A crash loses at most the tiles since the last commit.
+class FrameCheckpoint {
+private:
+    // At the start of the file, followed by the tile flags and, page-aligned, the pixels
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        int32_t tileSize;
+        uint32_t tileCount;
+        uint32_t reserved;
+        uint64_t fingerprint;       // Of the scene and settings the pixels were rendered with
+        uint64_t pixelOffset;
+    };
+
+    std::string path;
+    int fd = -1;
+    unsigned char* map = nullptr;
+    size_t mapBytes = 0;
+    unsigned char* flags = nullptr;
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int tileCount = 0;
+    int resumedTiles = 0;
+
+    std::mutex commitMutex;         // Guards pending and lastCommit
+    std::vector<int> pending;       // Finished tiles whose flags are not in the file yet
+    std::chrono::steady_clock::time_point lastCommit;
+    double commitSeconds = 10.0;
+
+    bool commitLocked();
+
+public:
+    FrameCheckpoint() = default;
+    ~FrameCheckpoint();
+
+    FrameCheckpoint(const FrameCheckpoint&) = delete;
+    FrameCheckpoint& operator=(const FrameCheckpoint&) = delete;
+
+    // Maps the checkpoint file at path, creating it if it does not exist. An
+    // existing file is resumed if it was written for the same frame size, tile
+    // size and fingerprint, and refused otherwise; one whose header never reached
+    // the disk is started over. The file is sparse, so a fresh one takes no disk
+    // space until tiles are written.
+    bool open(const std::string& path, int width, int height, int tileSize, uint64_t fingerprint, std::string& error);
+
+    // Seconds between the commits markDone makes on its own, 10 by default
+    void setCommitInterval(double seconds) { commitSeconds = seconds; }
+
+    // Frame pixels, width * height * 3 bytes, row-major
+    unsigned char* getPixels() const { return pixels; }
+
+    int getTileCount() const { return tileCount; }
+
+    // Tiles that were already complete when the file was opened
+    int getResumedTiles() const { return resumedTiles; }
+
+    bool isDone(int tile) const { return flags[tile] != 0; }
+
+    // Notes that a tile's pixels are finished, committing if the interval has
+    // passed. Safe to call from several threads.
+    void markDone(int tile);
+
+    // Syncs the pixels to disk, then the flags of the tiles finished since the last commit
+    bool commit();
+
+    // Commits and unmaps the file; remove also deletes it
+    void close();
+    void remove();
+};
+
+// Hash of what a frame's pixels depend on: frame size, camera, render settings,
+// lights, materials, every compiled shape and mesh, and the BVH. The scene must
+// have been built.
+uint64_t checkpoint_fingerprint(const Scene& scene, int width, int height);
@@ -0,0 +1,258 @@
+#include "denoiser.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../utils/thread_pool.h"
+#include "../utils/utils.h"
+
+// Weights of the 3 taps along each axis, a linear B-spline
+static const int TAPS = 3;
+static const float KERNEL[TAPS] = {0.25f, 0.5f, 0.25f};
+
+// Rows handed to a worker at a time
+static const int ROWS_PER_TASK = 8;
+
+// Approximates exp(-x) for x >= 0 by (1 - x/4)^4, which reaches 0 at x = 4
+// instead of tailing off. It takes no division or branch, so loops calling it
+// vectorize.
+static inline float negativeExp(float x) {
+    float t = 1.0f - 0.25f * x;
+    t = 0.5f * (t + std::fabs(t));
+    t *= t;
+    return t * t;
+}
+
+// Pixels of a row filtered together. Their sums live in a local TapSums, which
+// the compiler can tell apart from the planes, so the tap loop needs no aliasing
+// checks to vectorize.
+static const int CHUNK = 64;
+
+struct TapSums {
+    float r[CHUNK];
+    float g[CHUNK];
+    float b[CHUNK];
+    float w[CHUNK];
+    float depthInverse[CHUNK];  // Of each pixel's depth tolerance, so taps multiply rather than divide
+};
+
+void FeatureBuffers::resize(int newWidth, int newHeight) {
+    width = newWidth;
+    height = newHeight;
+    size_t count = static_cast<size_t>(width) * height;
+    for (int c = 0; c < 3; ++c) {
+        normal[c].assign(count, 0.0f);
+        albedo[c].assign(count, 0.0f);
+    }
+    depth.assign(count, 0.0f);
+}
+
+// Converts a 0..1 value to a byte, rounding to nearest
+static unsigned char toByte(float value) {
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+bool FeatureBuffers::write(const std::string& stem) const {
+    size_t count = static_cast<size_t>(width) * height;
+    float farthest = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        farthest = std::max(farthest, depth[i]);
+    }
+
+    std::vector<unsigned char> normalImage(count * 3);
+    std::vector<unsigned char> depthImage(count * 3);
+    std::vector<unsigned char> albedoImage(count * 3);
+    for (size_t i = 0; i < count; ++i) {
+        float closeness = depth[i] > 0.0f && farthest > 0.0f ? 1.0f - depth[i] / farthest : 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            normalImage[i * 3 + c] = depth[i] > 0.0f ? toByte(normal[c][i] * 0.5f + 0.5f) : 0;
+            depthImage[i * 3 + c] = toByte(closeness);
+            albedoImage[i * 3 + c] = toByte(albedo[c][i]);
+        }
+    }
+
+    return write_png((stem + "_normal.png").c_str(), width, height, normalImage) &&
+           write_png((stem + "_depth.png").c_str(), width, height, depthImage) &&
+           write_png((stem + "_albedo.png").c_str(), width, height, albedoImage);
+}
+
+// Pointers to the start of one row of every plane the filter reads
+struct PlaneRow {
+    const float* color[3];
+    const float* normal[3];
+    const float* depth;
+    const float* albedo[3];
+
+    PlaneRow(const std::vector<float>* colorPlanes, const FeatureBuffers& features, size_t row) {
+        for (int c = 0; c < 3; ++c) {
+            color[c] = colorPlanes[c].data() + row;
+            normal[c] = features.normal[c].data() + row;
+            albedo[c] = features.albedo[c].data() + row;
+        }
+        depth = features.depth.data() + row;
+    }
+};
+
+// Inverse squared sigmas of one pass; depth is the tolerance per unit of depth instead
+struct EdgeScales {
+    float color;
+    float depth;
+    float albedo;
+};
+
+// Adds tap (x + offset) of row q to the sums of pixels [x0, x1) of row p, with
+// kernel weight h; the sum of pixel x is at x - base. Everything is straight-line
+// arithmetic on contiguous floats so the loop vectorizes.
+static inline void accumulateTap(const PlaneRow& p, const PlaneRow& q, int offset, int x0, int x1, int base, float h,
+                                 const EdgeScales& scales, TapSums& sums) {
+    const float* pR = p.color[0];
+    const float* pG = p.color[1];
+    const float* pB = p.color[2];
+    const float* pNx = p.normal[0];
+    const float* pNy = p.normal[1];
+    const float* pNz = p.normal[2];
+    const float* pZ = p.depth;
+    const float* pAr = p.albedo[0];
+    const float* pAg = p.albedo[1];
+    const float* pAb = p.albedo[2];
+    const float* qR = q.color[0] + offset;
+    const float* qG = q.color[1] + offset;
+    const float* qB = q.color[2] + offset;
+    const float* qNx = q.normal[0] + offset;
+    const float* qNy = q.normal[1] + offset;
+    const float* qNz = q.normal[2] + offset;
+    const float* qZ = q.depth + offset;
+    const float* qAr = q.albedo[0] + offset;
+    const float* qAg = q.albedo[1] + offset;
+    const float* qAb = q.albedo[2] + offset;
+    float colorScale = scales.color;
+    float albedoScale = scales.albedo;
+
+    for (int x = x0; x < x1; ++x) {
+        float dr = pR[x] - qR[x];
+        float dg = pG[x] - qG[x];
+        float db = pB[x] - qB[x];
+        float ar = pAr[x] - qAr[x];
+        float ag = pAg[x] - qAg[x];
+        float ab = pAb[x] - qAb[x];
+        float dz = std::fabs(pZ[x] - qZ[x]) * sums.depthInverse[x - base];
+
+        // Normals must agree closely: max(cos, 0)^128, the max written without a
+        // branch. Misses have zero normals, so they never mix with surfaces.
+        float n = pNx[x] * qNx[x] + pNy[x] * qNy[x] + pNz[x] * qNz[x];
+        n = 0.5f * (n + std::fabs(n));
+        n *= n; n *= n; n *= n; n *= n; n *= n; n *= n; n *= n;
+
+        float w = h * n * negativeExp((dr * dr + dg * dg + db * db) * colorScale + dz +
+                                      (ar * ar + ag * ag + ab * ab) * albedoScale);
+        sums.r[x - base] += w * qR[x];
+        sums.g[x - base] += w * qG[x];
+        sums.b[x - base] += w * qB[x];
+        sums.w[x - base] += w;
+    }
+}
+
+void Denoiser::denoise(const FeatureBuffers& features, std::vector<unsigned char>& image) const {
+    int width = features.width;
+    int height = features.height;
+    size_t count = static_cast<size_t>(width) * height;
+    if (count == 0 || options.iterations <= 0 || image.size() < count * 3) {
+        return;
+    }
+
+    std::vector<float> color[3];
+    std::vector<float> filtered[3];
+    for (int c = 0; c < 3; ++c) {
+        color[c].resize(count);
+        filtered[c].resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            color[c][i] = image[i * 3 + c] * (1.0f / 255.0f);
+        }
+    }
+
+    int passes = std::min(options.iterations, DenoiseOptions::MAX_ITERATIONS);
+    for (int pass = 0; pass < passes; ++pass) {
+        int step = 1 << pass;
+        float colorSigma = options.colorSigma / step;
+        EdgeScales scales;
+        scales.color = 1.0f / std::max(colorSigma * colorSigma, 1e-12f);
+        scales.depth = std::max(options.depthSigma, 1e-6f) * step;
+        scales.albedo = 1.0f / std::max(options.albedoSigma * options.albedoSigma, 1e-12f);
+
+        auto filterRow = [&](int y) {
+            PlaneRow p(color, features, static_cast<size_t>(y) * width);
+            size_t row = static_cast<size_t>(y) * width;
+            for (int begin = 0; begin < width; begin += CHUNK) {
+                int end = std::min(begin + CHUNK, width);
+                TapSums sums = {};
+                for (int x = begin; x < end; ++x) {
+                    sums.depthInverse[x - begin] = 1.0f / (scales.depth * p.depth[x] + 1e-4f);
+                }
+                for (int ky = 0; ky < TAPS; ++ky) {
+                    int qy = y + (ky - TAPS / 2) * step;
+                    if (qy < 0 || qy >= height) continue;
+
+                    PlaneRow q(color, features, static_cast<size_t>(qy) * width);
+                    for (int kx = 0; kx < TAPS; ++kx) {
+                        // Only pixels whose tap lies inside the row take it
+                        int offset = (kx - TAPS / 2) * step;
+                        int x0 = std::max(begin, -offset);
+                        int x1 = std::min(end, width - offset);
+                        if (x0 < x1) {
+                            accumulateTap(p, q, offset, x0, x1, begin, KERNEL[kx] * KERNEL[ky], scales, sums);
+                        }
+                    }
+                }
+
+                // Pixels that took no weight, i.e. misses, keep their colour
+                for (int x = begin; x < end; ++x) {
+                    float weight = sums.w[x - begin];
+                    bool weighted = weight > 0.0f;
+                    float inverse = weighted ? 1.0f / weight : 0.0f;
+                    filtered[0][row + x] = weighted ? sums.r[x - begin] * inverse : p.color[0][x];
+                    filtered[1][row + x] = weighted ? sums.g[x - begin] * inverse : p.color[1][x];
+                    filtered[2][row + x] = weighted ? sums.b[x - begin] * inverse : p.color[2][x];
+                }
+            }
+        };
+
+        int taskCount = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+        auto filterRows = [&](int task) {
+            int end = std::min((task + 1) * ROWS_PER_TASK, height);
+            for (int y = task * ROWS_PER_TASK; y < end; ++y) {
+                filterRow(y);
+            }
+        };
+        if (pool) {
+            pool->parallelFor(taskCount, filterRows);
+        } else {
+            for (int task = 0; task < taskCount; ++task) filterRows(task);
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            color[c].swap(filtered[c]);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            image[i * 3 + c] = toByte(color[c][i]);
+        }
+    }
+}
+
+bool compare_images(const std::vector<unsigned char>& image, const std::vector<unsigned char>& reference,
+                    ImageError& error) {
+    if (image.size() != reference.size() || image.empty()) {
+        return false;
+    }
+
+    double squared = 0.0;
+    for (size_t i = 0; i < image.size(); ++i) {
+        double d = static_cast<double>(image[i]) - reference[i];
+        squared += d * d;
+    }
+    double mse = squared / image.size();
+    error.rmse = std::sqrt(mse);
+    error.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Auxiliary buffers (AOVs) of a frame: what each pixel's camera ray hit first.
+// Planes are stored separately, row-major, so the filter reads them with
+// contiguous loads. Pixels whose ray missed have depth 0 and a zero normal
+// and albedo.
+struct FeatureBuffers {
+    int width = 0;
+    int height = 0;
+    std::vector<float> normal[3];   // World-space unit normal, per axis
+    std::vector<float> depth;       // Distance along the camera ray
+    std::vector<float> albedo[3];   // Material::color, per channel
+
+    void resize(int width, int height);
+
+    // Writes <stem>_normal.png, <stem>_depth.png and <stem>_albedo.png. Normals are
+    // mapped from [-1, 1] to [0, 255] and depth from [0, farthest hit] to [255, 0].
+    bool write(const std::string& stem) const;
+};
+
+// Parameters of the edge-stopping weights; larger sigmas blur across stronger edges
+struct DenoiseOptions {
+    static constexpr int MAX_ITERATIONS = 8;    // Taps 511 pixels across; further passes are clamped away
+
+    int iterations = 2;         // Passes, each spreading its taps twice as far apart (3, 7, 15 ... pixels across)
+    float colorSigma = 0.5f;    // Colour difference (0..1 RGB distance) at which weights fall off; halved every pass
+    float depthSigma = 0.05f;   // Depth difference, relative to the pixel's depth and the tap distance
+    float albedoSigma = 0.1f;   // Albedo difference
+};
+
+// Edge-aware à-trous wavelet filter (Dammertz et al. 2010). Each pass averages
+// a 3x3 linear B-spline kernel whose taps lie 2^pass pixels apart, weighting every
+// tap by how close its colour, normal, depth and albedo are to the centre
+// pixel's, so noise is smoothed within a surface but not across silhouettes,
+// creases or texture boundaries. Rows are filtered in parallel, and the
+// weights are computed tap by tap over runs of planar floats so the
+// compiler can vectorize the inner loops.
+class Denoiser {
+private:
+    DenoiseOptions options;
+    ThreadPool* pool;
+
+public:
+    // pool may be nullptr to filter on the calling thread
+    explicit Denoiser(const DenoiseOptions& options = DenoiseOptions(), ThreadPool* pool = nullptr)
+        : options(options), pool(pool) {}
+
+    // Filters an RGB frame of features.width x features.height pixels in place
+    void denoise(const FeatureBuffers& features, std::vector<unsigned char>& image) const;
+};
+
+// Difference between two RGB images of the same size, over all channels
+struct ImageError {
+    double rmse = 0.0;      // Root mean squared error, in 0..255 units
+    double psnr = 0.0;      // Peak signal-to-noise ratio in dB, infinite for identical images
+};
+
+// Measures image against reference. Returns false if their sizes differ.
+bool compare_images(const std::vector<unsigned char>& image, const std::vector<unsigned char>& reference,
+                    ImageError& error);
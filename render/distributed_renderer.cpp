@@ -0,0 +1,307 @@
+#include "distributed_renderer.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include "../scene.h"
+
+// Coordinator to worker
+struct JobMessage {
+    int32_t tileIndex;      // -1 tells the worker to exit
+    Tile tile;
+    int32_t width;
+    int32_t height;
+};
+
+// Worker to coordinator, followed by the tile's pixels, row by row
+struct ResultMessage {
+    int32_t tileIndex;
+    uint32_t byteCount;
+    uint64_t rays;
+    double seconds;
+};
+
+// Every fd here is a socketpair end; MSG_NOSIGNAL turns a write to a dead peer into
+// EPIPE instead of a process-wide SIGPIPE
+static bool writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t got = ::read(fd, bytes, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+DistributedRenderer::DistributedRenderer(Scene& scene, const DistributedSettings& settings)
+    : scene(scene)
+    , settings(settings)
+{}
+
+void DistributedRenderer::workerLoop(int fd) {
+    // Workers render serially; the parallelism is in the number of processes
+    RenderSettings renderSettings = scene.getRenderSettings();
+    renderSettings.threadCount = 1;
+    renderSettings.showProgress = false;
+    scene.setRenderSettings(renderSettings);
+
+    JobMessage job;
+    std::vector<unsigned char> rows;
+    std::vector<unsigned char> pixels;
+    while (readAll(fd, &job, sizeof(job)) && job.tileIndex >= 0) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t raysBefore = scene.getTraversalStats().rays;
+
+        // The tile is rendered into full-width rows and then cut out
+        const Tile& tile = job.tile;
+        int tileWidth = tile.x1 - tile.x0;
+        int tileHeight = tile.y1 - tile.y0;
+        rows.resize(static_cast<size_t>(job.width) * tileHeight * 3);
+        scene.renderSingleTile(tile, job.width, job.height, ImageRows{rows.data(), job.width, tile.y0, tileHeight});
+        pixels.resize(static_cast<size_t>(tileWidth) * tileHeight * 3);
+        for (int y = 0; y < tileHeight; ++y) {
+            std::copy_n(&rows[(static_cast<size_t>(y) * job.width + tile.x0) * 3], tileWidth * 3,
+                        &pixels[static_cast<size_t>(y) * tileWidth * 3]);
+        }
+
+        ResultMessage result{job.tileIndex, static_cast<uint32_t>(pixels.size()),
+                             scene.getTraversalStats().rays - raysBefore, secondsSince(start)};
+        if (!writeAll(fd, &result, sizeof(result)) || !writeAll(fd, pixels.data(), pixels.size())) {
+            break;
+        }
+    }
+}
+
+bool DistributedRenderer::renderFrame(int width, int height, std::vector<unsigned char>& frameBuffer, std::string& error) {
+    auto frameStart = std::chrono::steady_clock::now();
+
+    // Build before forking so workers inherit the compiled scene instead of each building it
+    scene.refit();
+
+    int tileSize = scene.getRenderSettings().tileSize > 0 ? scene.getRenderSettings().tileSize : 32;
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            tiles.push_back({x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)});
+        }
+    }
+
+    struct Worker {
+        int fd = -1;
+        int tile = -1;      // Tile being rendered, -1 when idle
+        std::chrono::steady_clock::time_point started;
+    };
+    std::vector<Worker> workers(std::max(settings.workerCount, 1));
+    reports.assign(workers.size(), WorkerReport());
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            error = "socketpair failed";
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only this worker's end stays open, so the coordinator sees each death as EOF
+            close(sockets[0]);
+            for (size_t j = 0; j < i; ++j) close(workers[j].fd);
+            workerLoop(sockets[1]);
+            _exit(0);
+        }
+        close(sockets[1]);
+        if (pid < 0) {
+            close(sockets[0]);
+            reports[i].died = true;
+            continue;
+        }
+        workers[i].fd = sockets[0];
+        reports[i].pid = pid;
+    }
+
+    frameBuffer.assign(static_cast<size_t>(width) * height * 3, 0);
+    std::deque<int> pending;
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i) pending.push_back(i);
+    std::vector<char> done(tiles.size(), 0);
+    size_t remaining = tiles.size();
+    std::vector<double> tileSeconds;
+
+    auto retire = [&](size_t w) {
+        if (workers[w].tile >= 0 && !done[workers[w].tile]) {
+            pending.push_front(workers[w].tile);
+        }
+        close(workers[w].fd);
+        workers[w].fd = -1;
+        workers[w].tile = -1;
+        reports[w].died = true;
+    };
+
+    auto send = [&](size_t w, int tileIndex) {
+        JobMessage job{tileIndex, tiles[tileIndex], width, height};
+        workers[w].tile = tileIndex;
+        workers[w].started = std::chrono::steady_clock::now();
+        if (!writeAll(workers[w].fd, &job, sizeof(job))) {
+            retire(w);
+        }
+    };
+
+    std::vector<unsigned char> pixels;
+    while (remaining > 0) {
+        // Idle workers take queued tiles first, then back up the slowest running tile
+        for (size_t w = 0; w < workers.size(); ++w) {
+            if (workers[w].fd < 0 || workers[w].tile >= 0) continue;
+            while (!pending.empty() && done[pending.front()]) pending.pop_front();
+            if (!pending.empty()) {
+                int tileIndex = pending.front();
+                pending.pop_front();
+                send(w, tileIndex);
+                continue;
+            }
+            if (tileSeconds.empty()) continue;
+
+            std::vector<double> sorted = tileSeconds;
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            double limit = std::max(settings.minSlowSeconds, settings.slowFactor * sorted[sorted.size() / 2]);
+            int slowest = -1;
+            double slowestSeconds = limit;
+            for (const Worker& other : workers) {
+                if (other.fd < 0 || other.tile < 0 || done[other.tile]) continue;
+                bool duplicated = std::count_if(workers.begin(), workers.end(),
+                    [&](const Worker& x) { return x.fd >= 0 && x.tile == other.tile; }) > 1;
+                double running = secondsSince(other.started);
+                if (!duplicated && running > slowestSeconds) {
+                    slowest = other.tile;
+                    slowestSeconds = running;
+                }
+            }
+            if (slowest >= 0) send(w, slowest);
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for (size_t w = 0; w < workers.size(); ++w) {
+            if (workers[w].fd >= 0 && workers[w].tile >= 0) {
+                fds.push_back({workers[w].fd, POLLIN, 0});
+                owners.push_back(w);
+            }
+        }
+        if (fds.empty()) {
+            error = "all worker processes died";
+            break;
+        }
+
+        // Wake up now and then to look for slow tiles even when nothing arrives
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+            error = "poll failed";
+            break;
+        }
+
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            size_t w = owners[i];
+
+            ResultMessage result;
+            const Tile& tile = tiles[workers[w].tile];
+            int tileWidth = tile.x1 - tile.x0;
+            size_t expected = static_cast<size_t>(tileWidth) * (tile.y1 - tile.y0) * 3;
+            pixels.resize(expected);
+            if (!readAll(workers[w].fd, &result, sizeof(result)) || result.tileIndex != workers[w].tile ||
+                result.byteCount != expected || !readAll(workers[w].fd, pixels.data(), expected)) {
+                retire(w);
+                continue;
+            }
+
+            WorkerReport& report = reports[w];
+            report.busySeconds += result.seconds;
+            report.rays += result.rays;
+            workers[w].tile = -1;
+            if (done[result.tileIndex]) {
+                report.duplicateTiles++;
+                continue;
+            }
+
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                std::copy_n(&pixels[static_cast<size_t>(y - tile.y0) * tileWidth * 3], tileWidth * 3,
+                            &frameBuffer[(static_cast<size_t>(y) * width + tile.x0) * 3]);
+            }
+            done[result.tileIndex] = 1;
+            remaining--;
+            report.tiles++;
+            report.pixels += expected / 3;
+            tileSeconds.push_back(result.seconds);
+        }
+    }
+
+    // Idle workers exit when told to; ones still on a backed-up tile are not waited for
+    for (size_t w = 0; w < workers.size(); ++w) {
+        if (workers[w].fd < 0) continue;
+        JobMessage quit{-1, Tile{0, 0, 0, 0}, 0, 0};
+        if (workers[w].tile >= 0 || !writeAll(workers[w].fd, &quit, sizeof(quit))) {
+            kill(reports[w].pid, SIGKILL);
+        }
+        close(workers[w].fd);
+    }
+    for (const WorkerReport& report : reports) {
+        if (report.pid > 0) waitpid(report.pid, nullptr, 0);
+    }
+
+    frameSeconds = secondsSince(frameStart);
+    return remaining == 0;
+}
+
+bool DistributedRenderer::renderToPNG(const char* filename, int width, int height, std::string& error) {
+    std::vector<unsigned char> frameBuffer;
+    if (!renderFrame(width, height, frameBuffer, error)) {
+        return false;
+    }
+
+    const RenderSettings& renderSettings = scene.getRenderSettings();
+    std::unique_ptr<ImageEncoder> encoder = make_image_encoder(renderSettings.imageFormat, renderSettings.pngOptions, nullptr);
+    if (!encoder->write(filename, width, height, frameBuffer)) {
+        error = std::string(filename) + ": failed to write image";
+        return false;
+    }
+    return true;
+}
+
+void DistributedRenderer::printReport(std::ostream& out) const {
+    double busy = 0.0;
+    uint64_t pixels = 0;
+    for (size_t w = 0; w < reports.size(); ++w) {
+        const WorkerReport& report = reports[w];
+        out << "Worker " << w << " (pid " << report.pid << "): " << report.tiles << " tiles";
+        if (report.duplicateTiles > 0) out << " (+" << report.duplicateTiles << " duplicates)";
+        out << ", " << report.pixelsPerSecond() / 1e6 << " Mpixels/s, "
+            << (report.busySeconds > 0.0 ? report.rays / report.busySeconds / 1e6 : 0.0) << " Mrays/s, "
+            << report.busySeconds << " s busy" << (report.died ? ", died" : "") << std::endl;
+        busy += report.busySeconds;
+        pixels += report.pixels;
+    }
+
+    // Efficiency compares the frame time with the busy time spread evenly over every worker
+    double efficiency = frameSeconds > 0.0 ? busy / (frameSeconds * reports.size()) : 0.0;
+    out << "Distributed frame: " << pixels << " pixels in " << frameSeconds << " s across "
+        << reports.size() << " workers, " << efficiency * 100.0 << "% efficiency" << std::endl;
+}
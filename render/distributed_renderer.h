@@ -0,0 +1,71 @@
+#pragma once
+#include <sys/types.h>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "tile.h"
+
+class Scene;
+
+// Options for DistributedRenderer
+struct DistributedSettings {
+    int workerCount;        // Worker processes forked per frame
+    double slowFactor;      // A tile running this many times longer than the median
+                            // tile so far is handed to an idle worker as well
+    double minSlowSeconds;  // ... but never before it has run this long
+
+    DistributedSettings()
+        : workerCount(2)
+        , slowFactor(4.0)
+        , minSlowSeconds(0.5)
+    {}
+};
+
+// What one worker process did during the last frame
+struct WorkerReport {
+    pid_t pid = 0;
+    int tiles = 0;              // Tiles whose result was used
+    int duplicateTiles = 0;     // Tiles finished after another worker had already delivered them
+    uint64_t pixels = 0;
+    uint64_t rays = 0;          // BVH queries, as counted by the worker
+    double busySeconds = 0.0;   // Time the worker spent rendering, as it reported
+    bool died = false;          // Lost mid-frame; its tile went back to the queue
+
+    double pixelsPerSecond() const { return busySeconds > 0.0 ? pixels / busySeconds : 0.0; }
+};
+
+// Renders a frame across forked worker processes that share nothing with the
+// coordinator but a socket each. The scene is built before forking, so every
+// worker starts with its own copy of the compiled geometry. Tiles are handed
+// out one at a time as workers finish; a worker that dies has its tile
+// requeued, and a tile that runs much longer than the rest is also given to an
+// idle worker, the first result to arrive being kept.
+//
+// Messages are fixed-size native-endian structs, since both ends are the same
+// binary; see distributed_renderer.cpp.
+class DistributedRenderer {
+private:
+    Scene& scene;
+    DistributedSettings settings;
+    std::vector<WorkerReport> reports;
+    double frameSeconds = 0.0;
+
+    // Body of a forked worker: renders tiles read from fd until told to stop
+    void workerLoop(int fd);
+
+public:
+    DistributedRenderer(Scene& scene, const DistributedSettings& settings);
+
+    // Renders into an RGB frame buffer of width * height * 3 bytes.
+    // Fails if every worker died before the frame was complete.
+    bool renderFrame(int width, int height, std::vector<unsigned char>& frameBuffer, std::string& error);
+
+    // renderFrame, then writes the frame with the scene's configured encoder
+    bool renderToPNG(const char* filename, int width, int height, std::string& error);
+
+    const std::vector<WorkerReport>& getWorkerReports() const { return reports; }
+
+    // Per-worker throughput and how well the frame scaled across workers
+    void printReport(std::ostream& out) const;
+};
@@ -0,0 +1,207 @@
+#include "rasterizer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../camera.h"
+#include "../accel/compiled_scene.h"
+
+void PrimaryRasterizer::clear() {
+    width = 0;
+    height = 0;
+    binSize = 0;
+    binsX = 0;
+    binsY = 0;
+    leaves.clear();
+    binStart.clear();
+    binLeaves.clear();
+}
+
+// Pixel index just below or above a screen coordinate, kept within [-1, limit + 1]
+// so far-off projections cannot overflow the conversion
+static int toPixel(float screen, int size, bool roundUp) {
+    float pixel = std::min(std::max(screen * size, -1.0f), static_cast<float>(size) + 1.0f);
+    return static_cast<int>(roundUp ? std::ceil(pixel) : std::floor(pixel));
+}
+
+void PrimaryRasterizer::setup(const Camera& camera, const CompiledScene& compiled, uint64_t version, int frameWidth,
+                              int frameHeight, int tileSize) {
+    clear();
+    width = frameWidth;
+    height = frameHeight;
+    eye = camera.getPosition();
+    viewDirection = camera.getDirection();
+    fieldOfView = camera.getFieldOfView();
+    aspectRatio = camera.getAspectRatio();
+    geometryVersion = version;
+    binSize = std::max(tileSize, 1);
+    binsX = (width + binSize - 1) / binSize;
+    binsY = (height + binSize - 1) / binSize;
+
+    for (const BVHNode& node : compiled.getBVH().getNodes()) {
+        if (node.count == 0) continue;
+
+        ScreenLeaf leaf;
+        leaf.bounds = node.bounds;
+        leaf.firstSlot = node.offset;
+        leaf.count = node.count;
+        glm::vec3 outside = glm::max(glm::max(node.bounds.min - eye, eye - node.bounds.max), glm::vec3(0.0f));
+        leaf.nearDistance = glm::length(outside);
+
+        // The box projects inside the hull of its corners while they are all in
+        // front of the camera; otherwise it may reach any pixel
+        glm::vec2 lo(std::numeric_limits<float>::max());
+        glm::vec2 hi(-std::numeric_limits<float>::max());
+        bool inFront = true;
+        for (int i = 0; i < 8 && inFront; ++i) {
+            glm::vec3 corner((i & 1) ? node.bounds.max.x : node.bounds.min.x,
+                             (i & 2) ? node.bounds.max.y : node.bounds.min.y,
+                             (i & 4) ? node.bounds.max.z : node.bounds.min.z);
+            glm::vec2 screen;
+            inFront = camera.projectPoint(corner, screen);
+            lo = glm::min(lo, screen);
+            hi = glm::max(hi, screen);
+        }
+
+        // Pixel x is sampled at screen x / width; a pixel of margin absorbs rounding
+        if (inFront) {
+            leaf.x0 = std::max(toPixel(lo.x, width, false) - 1, 0);
+            leaf.y0 = std::max(toPixel(lo.y, height, false) - 1, 0);
+            leaf.x1 = std::min(toPixel(hi.x, width, true) + 2, width);
+            leaf.y1 = std::min(toPixel(hi.y, height, true) + 2, height);
+        } else {
+            leaf.x0 = 0;
+            leaf.y0 = 0;
+            leaf.x1 = width;
+            leaf.y1 = height;
+        }
+        if (leaf.x0 < leaf.x1 && leaf.y0 < leaf.y1) {
+            leaves.push_back(leaf);
+        }
+    }
+
+    std::sort(leaves.begin(), leaves.end(), [](const ScreenLeaf& a, const ScreenLeaf& b) {
+        return a.nearDistance < b.nearDistance;
+    });
+
+    // Counted, then filled in sorted order, so every bin lists its leaves front to back
+    int binCount = binsX * binsY;
+    binStart.assign(binCount + 1, 0);
+    for (const ScreenLeaf& leaf : leaves) {
+        for (int by = leaf.y0 / binSize; by <= (leaf.y1 - 1) / binSize; ++by) {
+            for (int bx = leaf.x0 / binSize; bx <= (leaf.x1 - 1) / binSize; ++bx) {
+                binStart[by * binsX + bx + 1]++;
+            }
+        }
+    }
+    for (int bin = 0; bin < binCount; ++bin) {
+        binStart[bin + 1] += binStart[bin];
+    }
+    binLeaves.resize(binStart[binCount]);
+    std::vector<uint32_t> fill(binStart.begin(), binStart.end() - 1);
+    for (uint32_t index = 0; index < leaves.size(); ++index) {
+        const ScreenLeaf& leaf = leaves[index];
+        for (int by = leaf.y0 / binSize; by <= (leaf.y1 - 1) / binSize; ++by) {
+            for (int bx = leaf.x0 / binSize; bx <= (leaf.x1 - 1) / binSize; ++bx) {
+                binLeaves[fill[by * binsX + bx]++] = index;
+            }
+        }
+    }
+}
+
+bool PrimaryRasterizer::isSetUp(const Camera& camera, uint64_t version, int frameWidth, int frameHeight) const {
+    return binSize > 0 && width == frameWidth && height == frameHeight && geometryVersion == version &&
+           eye == camera.getPosition() && viewDirection == camera.getDirection() &&
+           fieldOfView == camera.getFieldOfView() && aspectRatio == camera.getAspectRatio();
+}
+
+void PrimaryRasterizer::gatherLeaves(const Tile& tile, TileVisibility& visibility) const {
+    visibility.tileLeaves.clear();
+    int bx0 = tile.x0 / binSize;
+    int by0 = tile.y0 / binSize;
+    int bx1 = (tile.x1 - 1) / binSize;
+    int by1 = (tile.y1 - 1) / binSize;
+    for (int by = by0; by <= by1; ++by) {
+        for (int bx = bx0; bx <= bx1; ++bx) {
+            int bin = by * binsX + bx;
+            for (uint32_t i = binStart[bin]; i < binStart[bin + 1]; ++i) {
+                const ScreenLeaf& leaf = leaves[binLeaves[i]];
+                if (leaf.x0 < tile.x1 && tile.x0 < leaf.x1 && leaf.y0 < tile.y1 && tile.y0 < leaf.y1) {
+                    visibility.tileLeaves.push_back(binLeaves[i]);
+                }
+            }
+        }
+    }
+
+    // A tile that is not lined up with the bins sees some leaves from several of them
+    if (bx0 != bx1 || by0 != by1) {
+        std::sort(visibility.tileLeaves.begin(), visibility.tileLeaves.end());
+        visibility.tileLeaves.erase(std::unique(visibility.tileLeaves.begin(), visibility.tileLeaves.end()),
+                                    visibility.tileLeaves.end());
+    }
+}
+
+void PrimaryRasterizer::rasterizeTile(const Camera& camera, const CompiledScene& compiled, const Tile& tile,
+                                      TileVisibility& visibility, RenderStats& counters) const {
+    int tileWidth = tile.x1 - tile.x0;
+    size_t pixelCount = static_cast<size_t>(tileWidth) * (tile.y1 - tile.y0);
+    visibility.hits.assign(pixelCount, HitRecord());
+    gatherLeaves(tile, visibility);
+
+    uint64_t tests = 0;
+    RayPacket packet;
+    for (int by = tile.y0; by < tile.y1; by += RayPacket::HEIGHT) {
+        for (int bx = tile.x0; bx < tile.x1; bx += RayPacket::WIDTH) {
+            camera.getRayPacket(bx, by, tile.x1 - bx, tile.y1 - by, width, height, packet);
+            int bx1 = bx + packet.width;
+            int by1 = by + packet.height;
+            visibility.blockLeaves.clear();
+            for (uint32_t index : visibility.tileLeaves) {
+                const ScreenLeaf& leaf = leaves[index];
+                if (leaf.x0 < bx1 && bx < leaf.x1 && leaf.y0 < by1 && by < leaf.y1) {
+                    visibility.blockLeaves.push_back(index);
+                }
+            }
+            if (visibility.blockLeaves.empty()) continue;
+
+            for (int lane = 0; lane < packet.size(); ++lane) {
+                int x = packet.x0 + lane % packet.width;
+                int y = packet.y0 + lane / packet.width;
+                Ray ray = packet.getRay(lane);
+                glm::vec3 invDir = 1.0f / ray.getDirection();
+                float depth = std::numeric_limits<float>::infinity();
+                HitRecord hit;
+                for (uint32_t index : visibility.blockLeaves) {
+                    // Depth test: leaves are front to back, so once one lies behind the
+                    // closest hit all the rest do too. Equal distances are still tested,
+                    // as a tie goes to the lower shape index.
+                    const ScreenLeaf& leaf = leaves[index];
+                    if (leaf.nearDistance > depth) break;
+                    if (x < leaf.x0 || x >= leaf.x1 || y < leaf.y0 || y >= leaf.y1) continue;
+
+                    // Shape kernels can report grazing hits just outside their bounds,
+                    // which traversal never reaches
+                    float entry;
+                    if (!leaf.bounds.intersect(packet.origin, invDir, depth, entry)) continue;
+                    for (uint32_t slot = leaf.firstSlot; slot < leaf.firstSlot + leaf.count; ++slot) {
+                        compiled.intersectPrimitive(slot, ray, depth, hit);
+                    }
+                    tests += leaf.count;
+                }
+                size_t pixel = static_cast<size_t>(y - tile.y0) * tileWidth + (x - tile.x0);
+                visibility.hits[pixel] = hit;
+            }
+        }
+    }
+    counters.rasterizedPixels += pixelCount;
+    counters.rasterTests += tests;
+}
+
+void PrimaryRasterizer::resolvePacket(const RayPacket& packet, const Tile& tile, const TileVisibility& visibility,
+                                      HitRecord* hits) {
+    int tileWidth = tile.x1 - tile.x0;
+    for (int lane = 0; lane < packet.size(); ++lane) {
+        int x = packet.x0 + lane % packet.width;
+        int y = packet.y0 + lane / packet.width;
+        hits[lane] = visibility.hits[static_cast<size_t>(y - tile.y0) * tileWidth + (x - tile.x0)];
+    }
+}
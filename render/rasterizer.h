@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "render_stats.h"
+#include "tile.h"
+#include "../accel/aabb.h"
+#include "../intersection.h"
+#include "../ray_packet.h"
+
+class Camera;
+class CompiledScene;
+
+// Primary visibility of one tile, row-major within the tile, and the scratch
+// lists rasterizing it needs. One per thread, reused from tile to tile.
+struct TileVisibility {
+    std::vector<HitRecord> hits;        // Closest hit of the camera ray, as traversal would report it
+    std::vector<uint32_t> tileLeaves;   // Leaves that may cover the tile, front to back
+    std::vector<uint32_t> blockLeaves;  // Of those, the ones that may cover the current block
+};
+
+// Resolves what each camera ray hits first by rasterizing instead of tracing.
+// Once per frame, the boxes of the BVH's leaves are projected through the
+// camera's view and projection matrices, sorted front to back and binned by
+// the screen tiles they overlap. A tile's pixels then only test the primitives
+// of the leaves drawn over them, nearest leaf first, and stop at the first
+// leaf lying behind the depth found so far, so hidden geometry is skipped
+// without walking the BVH. A pixel inside a leaf's rectangle still takes the
+// slab test traversal would make against its box before the exact shape
+// kernels, so the result matches a traced render. The kernels fill in the
+// full hit record, which shading then starts from.
+//
+// Only corner rays through pixels are rasterized: one sample per pixel, as
+// Scene::renderTile traces without anti-aliasing.
+class PrimaryRasterizer {
+private:
+    // A leaf as drawn on screen
+    struct ScreenLeaf {
+        AABB bounds;
+        int x0, y0, x1, y1;     // Pixels [x0, x1) x [y0, y1) whose rays may hit its primitives
+        float nearDistance;     // Distance from the camera to the leaf's box; no hit inside is closer
+        uint32_t firstSlot;     // Primitive slots [firstSlot, firstSlot + count)
+        uint32_t count;
+    };
+
+    // What the leaves were projected for; a change to any of it calls for a new setup
+    int width = 0;
+    int height = 0;
+    glm::vec3 eye = glm::vec3(0.0f);
+    glm::vec3 viewDirection = glm::vec3(0.0f);
+    float fieldOfView = 0.0f;
+    float aspectRatio = 0.0f;
+    uint64_t geometryVersion = 0;
+
+    int binSize = 0;
+    int binsX = 0;
+    int binsY = 0;
+    std::vector<ScreenLeaf> leaves;     // Sorted front to back
+    std::vector<uint32_t> binStart;     // Leaves of bin b are binLeaves[binStart[b] .. binStart[b + 1])
+    std::vector<uint32_t> binLeaves;
+
+    // Fills visibility.tileLeaves with the leaves that may cover the tile, front to back
+    void gatherLeaves(const Tile& tile, TileVisibility& visibility) const;
+
+public:
+    // Projects and bins the scene's leaves for a width x height frame, with bins
+    // of binSize pixels lined up with the render tiles. geometryVersion names the
+    // state of the BVH, as counted by the caller.
+    void setup(const Camera& camera, const CompiledScene& compiled, uint64_t geometryVersion, int width, int height,
+               int binSize);
+
+    // True if setup was last called for this camera, BVH version and frame size
+    bool isSetUp(const Camera& camera, uint64_t geometryVersion, int frameWidth, int frameHeight) const;
+
+    void clear();
+
+    // Fills visibility with the closest hit for every pixel of the tile. Rays are made by Camera::getRayPacket, as when traced.
+    // Adds the pixels and shape tests to counters.
+    void rasterizeTile(const Camera& camera, const CompiledScene& compiled, const Tile& tile,
+                       TileVisibility& visibility, RenderStats& counters) const;
+
+    // Hit records for a packet of a rasterized tile, copied from its pixels
+    static void resolvePacket(const RayPacket& packet, const Tile& tile, const TileVisibility& visibility,
+                              HitRecord* hits);
+};
@@ -0,0 +1,233 @@
+#include "relighter.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include "tile.h"
+#include "../ray_packet.h"
+#include "../scene.h"
+
+// Runs task(i) for i in [0, count) on the scene's workers, or inline for a serial render
+static void forEach(ThreadPool* pool, int count, const std::function<void(int)>& task) {
+    if (pool) {
+        pool->parallelFor(count, task);
+    } else {
+        for (int i = 0; i < count; ++i) task(i);
+    }
+}
+
+Relighter::Relighter(Scene& scene) : scene(scene) {}
+
+void Relighter::setMaterial(uint32_t index, const Material& material) {
+    materials[index] = material;
+}
+
+size_t Relighter::getMemoryBytes() const {
+    return chainStart.size() * sizeof(uint32_t) + surfaces.size() * sizeof(GBufferSurface) +
+           visibility.size() * sizeof(uint32_t);
+}
+
+bool Relighter::needsCapture(int frameWidth, int frameHeight) const {
+    if (!valid || frameWidth != width || frameHeight != height || scene.getMaxDepth() != maxDepth) {
+        return true;
+    }
+
+    const Camera& camera = scene.getCamera();
+    if (camera.getPosition() != cameraPosition || camera.getDirection() != cameraDirection ||
+        camera.getFieldOfView() != cameraFieldOfView) {
+        return true;
+    }
+
+    for (size_t i = 0; i < materials.size(); ++i) {
+        if (materials[i].reflectiveness > 0.0f && !reflectionsTraced[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Relighter::capture(int frameWidth, int frameHeight) {
+    width = frameWidth;
+    height = frameHeight;
+    const Camera& camera = scene.getCamera();
+    cameraPosition = camera.getPosition();
+    cameraDirection = camera.getDirection();
+    cameraFieldOfView = camera.getFieldOfView();
+
+    reflectionsTraced.resize(materials.size());
+    for (size_t i = 0; i < materials.size(); ++i) {
+        reflectionsTraced[i] = materials[i].reflectiveness > 0.0f;
+    }
+
+    // Bands of one packet row are traced independently, each compacting its chains
+    // in row-major order, and then stitched together
+    maxDepth = scene.getMaxDepth();
+    const CompiledScene& compiled = scene.getCompiledScene();
+    int bandCount = (height + RayPacket::HEIGHT - 1) / RayPacket::HEIGHT;
+    std::vector<std::vector<GBufferSurface>> bandSurfaces(bandCount);
+    std::vector<uint8_t> chainLength(static_cast<size_t>(width) * height, 0);
+
+    forEach(scene.getThreadPool(), bandCount, [&](int band) {
+        int y0 = band * RayPacket::HEIGHT;
+        int rows = std::min(RayPacket::HEIGHT, height - y0);
+        std::vector<GBufferSurface> chains(static_cast<size_t>(width) * rows * maxDepth);
+        RayPacket packet;
+        HitRecord hits[RayPacket::SIZE];
+
+        for (int bx = 0; bx < width; bx += RayPacket::WIDTH) {
+            camera.getRayPacket(bx, y0, width - bx, rows, width, height, packet);
+            compiled.intersectPacket(packet, hits);
+
+            for (int lane = 0; lane < packet.size(); ++lane) {
+                int x = packet.x0 + lane % packet.width;
+                int y = packet.y0 + lane / packet.width;
+                GBufferSurface* chain = &chains[(static_cast<size_t>(y - y0) * width + x) * maxDepth];
+                int length = 0;
+
+                // Follows reflections the way Scene::shadeSurface does
+                Ray ray = packet.getRay(lane);
+                HitRecord hit = hits[lane];
+                while (hit.hit()) {
+                    SurfacePoint surface = compiled.resolveSurface(ray, hit);
+                    chain[length++] = {surface.position, surface.normal, hit.material};
+                    if (length >= maxDepth || materials[hit.material].reflectiveness <= 0.0f) {
+                        break;
+                    }
+                    ray = Ray(surface.position + surface.normal * 0.001f, glm::reflect(ray.getDirection(), surface.normal));
+                    hit = compiled.intersect(ray);
+                }
+                chainLength[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>(length);
+            }
+        }
+
+        std::vector<GBufferSurface>& out = bandSurfaces[band];
+        for (size_t pixel = 0; pixel < static_cast<size_t>(width) * rows; ++pixel) {
+            size_t length = chainLength[static_cast<size_t>(y0) * width + pixel];
+            out.insert(out.end(), chains.begin() + pixel * maxDepth, chains.begin() + pixel * maxDepth + length);
+        }
+    });
+
+    chainStart.resize(chainLength.size() + 1);
+    chainStart[0] = 0;
+    for (size_t i = 0; i < chainLength.size(); ++i) {
+        chainStart[i + 1] = chainStart[i] + chainLength[i];
+    }
+    surfaces.clear();
+    surfaces.reserve(chainStart.back());
+    for (const auto& band : bandSurfaces) {
+        surfaces.insert(surfaces.end(), band.begin(), band.end());
+    }
+
+    // Every light has to be traced against the new surfaces
+    lightPositions.clear();
+    visibility.clear();
+    valid = true;
+    stats.captured = true;
+}
+
+void Relighter::updateVisibility() {
+    const auto& lights = scene.getLights();
+    int words = static_cast<int>((lights.size() + 31) / 32);
+    if (words != lightWords || lights.size() < lightPositions.size() ||
+        visibility.size() != surfaces.size() * words) {
+        lightWords = words;
+        visibility.assign(surfaces.size() * words, 0);
+        lightPositions.clear();
+    }
+
+    std::vector<uint32_t> stale;
+    for (size_t i = 0; i < lights.size(); ++i) {
+        if (i >= lightPositions.size() || lightPositions[i] != lights[i]->getPosition()) {
+            stale.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    if (stale.empty()) {
+        return;
+    }
+
+    const int CHUNK = 4096;
+    int chunkCount = static_cast<int>((surfaces.size() + CHUNK - 1) / CHUNK);
+    forEach(scene.getThreadPool(), chunkCount, [&](int chunk) {
+        size_t end = std::min(surfaces.size(), static_cast<size_t>(chunk + 1) * CHUNK);
+        for (size_t s = static_cast<size_t>(chunk) * CHUNK; s < end; ++s) {
+            const GBufferSurface& surface = surfaces[s];
+            uint32_t* bits = &visibility[s * lightWords];
+            for (uint32_t l : stale) {
+                glm::vec3 lightPosition = lights[l]->getPosition();
+                glm::vec3 lightDir = glm::normalize(lightPosition - surface.position);
+                float lightDistance = glm::length(lightPosition - surface.position);
+                Ray shadowRay(surface.position + surface.normal * 0.001f, lightDir);
+                uint32_t mask = 1u << (l % 32);
+                if (scene.occluded(shadowRay, lightDistance)) {
+                    bits[l / 32] &= ~mask;
+                } else {
+                    bits[l / 32] |= mask;
+                }
+            }
+        }
+    });
+
+    lightPositions.resize(lights.size());
+    for (uint32_t l : stale) {
+        lightPositions[l] = lights[l]->getPosition();
+    }
+    stats.shadowRays += static_cast<uint64_t>(surfaces.size()) * stale.size();
+}
+
+glm::vec3 Relighter::shadePixel(size_t pixel) const {
+    const auto& lights = scene.getLights();
+
+    // Walk the chain back from the deepest surface, mixing each reflection into the
+    // surface in front of it; past the end of a chain is the black background
+    glm::vec3 color(0.0f);
+    for (uint32_t s = chainStart[pixel + 1]; s-- > chainStart[pixel];) {
+        const GBufferSurface& surface = surfaces[s];
+        const Material& material = materials[surface.material];
+        const uint32_t* bits = &visibility[static_cast<size_t>(s) * lightWords];
+
+        glm::vec3 totalLight(0.0f);
+        totalLight += scene.ambientLighting(material);
+        for (size_t l = 0; l < lights.size(); ++l) {
+            if (!(bits[l / 32] & (1u << (l % 32)))) continue;
+            glm::vec3 lightDir = glm::normalize(lights[l]->getPosition() - surface.position);
+            float lightDistance = glm::length(lights[l]->getPosition() - surface.position);
+            totalLight += scene.directLighting(*lights[l], lightDir, lightDistance, surface.position, surface.normal, material);
+        }
+        glm::vec3 baseColor = glm::clamp(totalLight, 0.0f, 1.0f);
+
+        color = material.reflectiveness > 0.0f ? glm::mix(baseColor, color, material.reflectiveness) : baseColor;
+    }
+    return color;
+}
+
+void Relighter::render(int frameWidth, int frameHeight, std::vector<unsigned char>& frameBuffer) {
+    auto start = std::chrono::steady_clock::now();
+    stats = RelightStats();
+
+    // A rebuild may renumber the material table, so edits are dropped with it
+    bool rebuilt = scene.refit();
+    if (rebuilt || materials.size() != scene.getMaterials().size()) {
+        materials = scene.getMaterials();
+        valid = false;
+    }
+
+    if (needsCapture(frameWidth, frameHeight)) {
+        capture(frameWidth, frameHeight);
+    }
+    updateVisibility();
+
+    frameBuffer.assign(static_cast<size_t>(width) * height * 3, 0);
+    forEach(scene.getThreadPool(), height, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            size_t pixel = static_cast<size_t>(y) * width + x;
+            storePixel(&frameBuffer[pixel * 3], shadePixel(pixel));
+        }
+    });
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool Relighter::renderToPNG(const char* filename, int frameWidth, int frameHeight) {
+    std::vector<unsigned char> frameBuffer;
+    render(frameWidth, frameHeight, frameBuffer);
+    return write_png(filename, width, height, frameBuffer, scene.getRenderSettings().pngOptions);
+}
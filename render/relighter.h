@@ -0,0 +1,93 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "../utils/material.h"
+
+class Scene;
+
+// Surface seen by a pixel, directly or through reflections
+struct GBufferSurface {
+    glm::vec3 position;
+    glm::vec3 normal;
+    uint32_t material;      // Index into the scene's material table
+};
+
+// Work done by the last Relighter::render
+struct RelightStats {
+    bool captured = false;      // The G-buffer was (re)built, tracing camera and reflection rays
+    uint64_t shadowRays = 0;    // Shadow rays traced to bring light visibility up to date
+    double seconds = 0.0;
+};
+
+// Re-renders a scene after light or material edits without tracing it again.
+// The first render caches a G-buffer: every pixel's chain of surfaces through
+// reflections (up to Scene::getMaxDepth surfaces) and, per surface, which
+// lights reach it. Later renders only evaluate the lighting over the cache,
+// tracing shadow rays again just for lights that moved or were added.
+//
+// Geometry and camera are assumed unchanged between renders; a camera move or
+// a scene rebuild is detected and recaptures, other changes need invalidate().
+// Materials are edited through setMaterial rather than on the shapes. Making a
+// material reflective that was not when the cache was built also recaptures,
+// since its reflections were never traced. One sample per pixel is taken,
+// matching Scene::renderFrame without anti-aliasing. Every reflection is
+// followed to the full depth, as settings.minThroughput at 0 does.
+class Relighter {
+private:
+    Scene& scene;
+    int width = 0;
+    int height = 0;
+    int maxDepth = 0;
+    bool valid = false;
+
+    // Pixel i owns surfaces [chainStart[i], chainStart[i + 1]), nearest first
+    std::vector<uint32_t> chainStart;
+    std::vector<GBufferSurface> surfaces;
+
+    std::vector<Material> materials;
+    std::vector<bool> reflectionsTraced;    // Per material, as it was when the cache was built
+
+    // Bit l of surface s is set when light l reaches it: word s * lightWords + l / 32
+    int lightWords = 0;
+    std::vector<uint32_t> visibility;
+    std::vector<glm::vec3> lightPositions;  // Where each light was when its bits were traced
+
+    // Camera the cache was built for
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraDirection;
+    float cameraFieldOfView = 0.0f;
+
+    RelightStats stats;
+
+    bool needsCapture(int width, int height) const;
+
+    // Traces camera and reflection rays and records the surfaces they hit
+    void capture(int width, int height);
+
+    // Traces shadow rays for every light whose bits are missing or out of date
+    void updateVisibility();
+
+    glm::vec3 shadePixel(size_t pixel) const;
+
+public:
+    explicit Relighter(Scene& scene);
+
+    // Material table used for shading, initially the scene's (valid after a build)
+    const std::vector<Material>& getMaterials() const { return materials; }
+    void setMaterial(uint32_t index, const Material& material);
+
+    // Drops the cache, so the next render traces the scene again
+    void invalidate() { valid = false; }
+
+    // Renders into an RGB frame buffer of width * height * 3 bytes, building the
+    // cache on the first call and reusing it afterwards
+    void render(int width, int height, std::vector<unsigned char>& frameBuffer);
+
+    bool renderToPNG(const char* filename, int width, int height);
+
+    const RelightStats& getStats() const { return stats; }
+
+    // Memory held by the G-buffer and visibility bits
+    size_t getMemoryBytes() const;
+};
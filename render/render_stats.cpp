@@ -0,0 +1,118 @@
+#include "render_stats.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "tile.h"
+#include "../utils/utils.h"
+
+void RenderStats::add(const RenderStats& other) {
+    primaryRays += other.primaryRays;
+    reflectionRays += other.reflectionRays;
+    shadowRays += other.shadowRays;
+    hits += other.hits;
+    shadowRaysBlocked += other.shadowRaysBlocked;
+    lightsSkipped += other.lightsSkipped;
+    reflectionsCut += other.reflectionsCut;
+    for (int i = 0; i < MAX_DEPTH; ++i) {
+        raysAtDepth[i] += other.raysAtDepth[i];
+    }
+    traversal.add(other.traversal);
+    rasterizedPixels += other.rasterizedPixels;
+    rasterTests += other.rasterTests;
+    workerSeconds += other.workerSeconds;
+    traversalSeconds += other.traversalSeconds;
+}
+
+void RenderStats::writeJson(std::ostream& out) const {
+    // Only print the histogram up to the deepest bucket in use
+    int depthBuckets = MAX_DEPTH;
+    while (depthBuckets > 1 && raysAtDepth[depthBuckets - 1] == 0) {
+        depthBuckets--;
+    }
+
+    out << "{\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"camera_samples\": " << cameraSamples << ",\n"
+        << "  \"refined_pixels\": " << refinedPixels << ",\n"
+        << "  \"progressive_passes\": " << progressivePasses << ",\n"
+        << "  \"progressive_spacing\": " << progressiveSpacing << ",\n"
+        << "  \"checkpoint_tiles\": " << checkpointTiles << ",\n"
+        << "  \"resumed_tiles\": " << resumedTiles << ",\n"
+        << "  \"encoded_bytes\": " << encodedBytes << ",\n"
+        << "  \"bvh_rebuilt\": " << (accelerationRebuilt ? "true" : "false") << ",\n"
+        << "  \"rays\": {\n"
+        << "    \"primary\": " << primaryRays << ",\n"
+        << "    \"reflection\": " << reflectionRays << ",\n"
+        << "    \"shadow\": " << shadowRays << ",\n"
+        << "    \"hits\": " << hits << ",\n"
+        << "    \"shadow_blocked\": " << shadowRaysBlocked << ",\n"
+        << "    \"lights_skipped\": " << lightsSkipped << ",\n"
+        << "    \"reflections_cut\": " << reflectionsCut << ",\n"
+        << "    \"by_depth\": [";
+    for (int i = 0; i < depthBuckets; ++i) {
+        out << (i > 0 ? ", " : "") << raysAtDepth[i];
+    }
+    out << "]\n"
+        << "  },\n"
+        << "  \"traversal\": {\n"
+        << "    \"queries\": " << traversal.rays << ",\n"
+        << "    \"nodes_visited\": " << traversal.nodesVisited << ",\n"
+        << "    \"shape_tests\": " << traversal.primitiveTests << "\n"
+        << "  },\n"
+        << "  \"raster\": {\n"
+        << "    \"pixels\": " << rasterizedPixels << ",\n"
+        << "    \"shape_tests\": " << rasterTests << "\n"
+        << "  },\n"
+        << "  \"seconds\": {\n"
+        << "    \"render\": " << renderSeconds << ",\n"
+        << "    \"worker\": " << workerSeconds << ",\n"
+        << "    \"acceleration\": " << accelerationSeconds << ",\n";
+    if (timingsCollected) {
+        out << "    \"traversal\": " << traversalSeconds << ",\n"
+            << "    \"shading\": " << shadingSeconds() << ",\n";
+    }
+    out << "    \"features\": " << featureSeconds << ",\n"
+        << "    \"denoise\": " << denoiseSeconds << ",\n"
+        << "    \"encode\": " << encodeSeconds << "\n"
+        << "  }\n"
+        << "}\n";
+}
+
+// Piecewise linear ramp through dark blue, blue, green, yellow and red
+static glm::vec3 heatColor(float t) {
+    static const glm::vec3 stops[] = {
+        glm::vec3(0.0f, 0.0f, 0.3f),
+        glm::vec3(0.0f, 0.2f, 1.0f),
+        glm::vec3(0.0f, 0.9f, 0.3f),
+        glm::vec3(1.0f, 0.9f, 0.0f),
+        glm::vec3(1.0f, 0.0f, 0.0f),
+    };
+    const int segments = 4;
+
+    t = glm::clamp(t, 0.0f, 1.0f) * segments;
+    int segment = std::min(static_cast<int>(t), segments - 1);
+    return glm::mix(stops[segment], stops[segment + 1], t - segment);
+}
+
+bool write_cost_heatmap(const char* filename, int width, int height, const std::vector<float>& cost) {
+    if (cost.size() != static_cast<size_t>(width) * height) {
+        return false;
+    }
+
+    std::vector<float> sorted(cost);
+    size_t rank = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+    float scale = 0.0f;
+    if (!sorted.empty()) {
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        scale = sorted[rank];
+    }
+    if (scale <= 0.0f) {
+        scale = 1.0f;
+    }
+
+    std::vector<unsigned char> image(cost.size() * 3);
+    for (size_t i = 0; i < cost.size(); ++i) {
+        storePixel(&image[i * 3], heatColor(cost[i] / scale));
+    }
+    return write_png(filename, width, height, image);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "../accel/bvh.h"
+
+// Counters and timings of one render. Render threads fill a thread-local copy
+// and merge it into the scene's totals after every tile, so counting costs no
+// synchronisation inside the hot loops.
+struct RenderStats {
+    static const int MAX_DEPTH = 16;    // Deeper rays are counted in the last histogram bucket
+
+    uint64_t primaryRays = 0;
+    uint64_t reflectionRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t hits = 0;                  // Primary and reflection rays that hit a shape
+    uint64_t shadowRaysBlocked = 0;
+    uint64_t lightsSkipped = 0;         // Light evaluations saved by culling or sampling lights
+    uint64_t reflectionsCut = 0;        // Reflections not traced for their low weight
+    uint64_t raysAtDepth[MAX_DEPTH] = {};   // Closest-hit rays traced at each recursion depth
+    TraversalStats traversal;           // BVH nodes and shape tests of every query
+    uint64_t rasterizedPixels = 0;      // Primary rays resolved by a PrimaryRasterizer instead of the BVH
+    uint64_t rasterTests = 0;           // Shape tests the rasterizer made for them
+
+    // Thread time summed over all render threads. traversalSeconds is only measured
+    // with RenderSettings::collectTimings; shading is the rest of workerSeconds.
+    double workerSeconds = 0.0;
+    double traversalSeconds = 0.0;
+
+    // Frame-wide values, set by the scene rather than merged from threads
+    int width = 0;
+    int height = 0;
+    bool timingsCollected = false;
+    uint64_t cameraSamples = 0;         // Camera samples spent on the frame
+    uint64_t refinedPixels = 0;         // Pixels that received adaptive extra samples
+    int progressivePasses = 0;          // Passes a progressive render completed, 0 for other renders
+    int progressiveSpacing = 0;         // Pixel spacing of its finest completed pass, 1 once every pixel is rendered
+    int checkpointTiles = 0;            // Tiles of a checkpointed render, 0 for other renders
+    int resumedTiles = 0;               // Of those, tiles an earlier, interrupted render had finished
+    double renderSeconds = 0.0;         // Wall clock time of the frame
+    double encodeSeconds = 0.0;         // Time spent in the image encoder
+    uint64_t encodedBytes = 0;          // Size of the image file written
+    double featureSeconds = 0.0;        // Capturing the denoiser's feature buffers
+    double denoiseSeconds = 0.0;        // Filtering the frame
+    double accelerationSeconds = 0.0;   // BVH build or refit, light tree and rasterizer setup before the frame
+    bool accelerationRebuilt = false;   // The BVH was built rather than refitted or reused
+
+    // Adds the per-thread counters and times of other
+    void add(const RenderStats& other);
+
+    void countTracedRay(int depth, bool hit) {
+        if (depth == 0) primaryRays++;
+        else reflectionRays++;
+        raysAtDepth[depth < MAX_DEPTH ? depth : MAX_DEPTH - 1]++;
+        if (hit) hits++;
+    }
+
+    // Frame bytes (3 per pixel) the encoder consumed per second
+    double encodeBytesPerSecond() const {
+        return encodeSeconds > 0.0 ? 3.0 * width * height / encodeSeconds : 0.0;
+    }
+
+    double shadingSeconds() const {
+        return timingsCollected && workerSeconds > traversalSeconds ? workerSeconds - traversalSeconds : 0.0;
+    }
+
+    void writeJson(std::ostream& out) const;
+};
+
+// Adds the time spent in its scope to *seconds. A null target makes it a no-op,
+// so timing can be switched off without touching the call sites.
+class ScopedTimer {
+private:
+    using Clock = std::chrono::steady_clock;
+    double* seconds;
+    Clock::time_point start;
+
+public:
+    explicit ScopedTimer(double* target) : seconds(target) {
+        if (seconds) start = Clock::now();
+    }
+
+    ~ScopedTimer() {
+        if (seconds) *seconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Writes per-pixel costs as a false-colour PNG, from dark blue for the cheapest
+// pixels to red for the most expensive. Costs are scaled by their 99th percentile
+// so a handful of outliers do not wash out the rest of the frame.
+bool write_cost_heatmap(const char* filename, int width, int height, const std::vector<float>& cost);
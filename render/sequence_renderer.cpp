@@ -0,0 +1,138 @@
+#include "sequence_renderer.h"
+#include <chrono>
+#include "render_stats.h"
+#include "../scene.h"
+
+SequenceRenderer::SequenceRenderer(Scene& scene, const Animation& animation)
+    : scene(scene)
+    , animation(animation)
+{
+    // Keys place a shape's origin, so strip the authored translation and keep the rest
+    for (const ShapeTrack& track : animation.shapes) {
+        glm::mat4 matrix = scene.getShape(track.shapeIndex)->getModelMatrix();
+        matrix[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        shapeLocal.push_back(matrix);
+    }
+}
+
+void SequenceRenderer::pose(float time) {
+    if (!animation.camera.empty()) {
+        CameraKey key = Animation::sample(animation.camera, time);
+        Camera& camera = scene.getCamera();
+        camera.setPosition(key.position);
+        camera.setDirection(key.direction);
+    }
+
+    for (size_t i = 0; i < animation.shapes.size(); ++i) {
+        const ShapeTrack& track = animation.shapes[i];
+        TransformKey key = Animation::sample(track.keys, time);
+        scene.getShape(track.shapeIndex)->setModelMatrix(Animation::toMatrix(key) * shapeLocal[i]);
+    }
+    if (!animation.shapes.empty()) {
+        scene.markShapesMoved();
+    }
+
+    for (const LightTrack& track : animation.lights) {
+        scene.getLights()[track.lightIndex]->setPosition(Animation::sample(track.keys, time).position);
+    }
+}
+
+bool format_frame_name(const std::string& pattern, int frame, std::string& name) {
+    name.clear();
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            name += pattern[i];
+            continue;
+        }
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            name += '%';
+            ++i;
+            continue;
+        }
+
+        // %d, or %0Nd with a single width digit
+        size_t end = i + 1;
+        int width = 0;
+        if (end + 1 < pattern.size() && pattern[end] == '0' && pattern[end + 1] >= '1' && pattern[end + 1] <= '9') {
+            width = pattern[end + 1] - '0';
+            end += 2;
+        }
+        if (end >= pattern.size() || pattern[end] != 'd' || ++conversions > 1) {
+            return false;
+        }
+        std::string number = std::to_string(frame);
+        if (static_cast<int>(number.size()) < width) {
+            number.insert(0, width - number.size(), '0');
+        }
+        name += number;
+        i = end;
+    }
+    return conversions == 1;
+}
+
+bool SequenceRenderer::render(const SequenceSettings& settings, std::string& error) {
+    std::string filename;
+    if (!format_frame_name(settings.outputPattern, 0, filename)) {
+        error = settings.outputPattern + ": frame pattern needs exactly one %d or %0Nd and no other % conversions";
+        return false;
+    }
+
+    float start = settings.startTime;
+    float end = settings.endTime;
+    if (start == end) {
+        start = animation.startTime();
+        end = animation.endTime();
+    }
+
+    timings.clear();
+    for (int frame = 0; frame < settings.frameCount; ++frame) {
+        float t = settings.frameCount > 1 ? float(frame) / float(settings.frameCount - 1) : 0.0f;
+        FrameTiming timing;
+        timing.frame = frame;
+        timing.time = start + (end - start) * t;
+
+        double poseSeconds = 0.0;
+        {
+            ScopedTimer timer(&poseSeconds);
+            pose(timing.time);
+        }
+
+        format_frame_name(settings.outputPattern, frame, filename);
+        if (!scene.renderToPNG(filename.c_str(), settings.width, settings.height)) {
+            error = filename + ": failed to write frame";
+            return false;
+        }
+
+        RenderStats stats = scene.getRenderStats();
+        timing.poseSeconds = poseSeconds;
+        timing.accelerationSeconds = stats.accelerationSeconds;
+        timing.rebuilt = stats.accelerationRebuilt;
+        timing.sahCost = scene.getCompiledScene().getBVH().getBuildStats().sahCost;
+        timing.renderSeconds = stats.renderSeconds;
+        timing.encodeSeconds = stats.encodeSeconds;
+        timings.push_back(timing);
+    }
+    return true;
+}
+
+void SequenceRenderer::printTimings(std::ostream& out) const {
+    double pose = 0.0, acceleration = 0.0, render = 0.0, encode = 0.0;
+    int rebuilds = 0;
+    for (const FrameTiming& timing : timings) {
+        out << "Frame " << timing.frame << " (t=" << timing.time << "): "
+            << timing.poseSeconds * 1000.0 << " ms pose, "
+            << timing.accelerationSeconds * 1000.0 << " ms " << (timing.rebuilt ? "BVH build" : "BVH refit")
+            << " (SAH " << timing.sahCost << "), "
+            << timing.renderSeconds * 1000.0 << " ms render, "
+            << timing.encodeSeconds * 1000.0 << " ms encode" << std::endl;
+        pose += timing.poseSeconds;
+        acceleration += timing.accelerationSeconds;
+        render += timing.renderSeconds;
+        encode += timing.encodeSeconds;
+        rebuilds += timing.rebuilt ? 1 : 0;
+    }
+    out << "Sequence: " << timings.size() << " frames, " << rebuilds << " BVH builds, "
+        << pose << " s pose, " << acceleration << " s BVH, "
+        << render << " s render, " << encode << " s encode" << std::endl;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "animation.h"
+
+class Scene;
+
+// Options for SequenceRenderer::render
+struct SequenceSettings {
+    int frameCount;
+    int width;
+    int height;
+    float startTime;            // Times of the first and last frame. When equal,
+    float endTime;              // the animation's own key range is used.
+    std::string outputPattern;  // File name with one %d or %0Nd for the frame number, e.g. "frame_%04d.png"; %% is a literal %
+
+    SequenceSettings()
+        : frameCount(1)
+        , width(800)
+        , height(600)
+        , startTime(0.0f)
+        , endTime(0.0f)
+        , outputPattern("frame_%04d.png")
+    {}
+};
+
+// Where the time of one frame went
+struct FrameTiming {
+    int frame;
+    float time;                 // Animation time the frame was posed at
+    double poseSeconds;         // Moving the camera, shapes and lights
+    double accelerationSeconds; // BVH refit or rebuild
+    bool rebuilt;               // The BVH was rebuilt rather than refitted
+    float sahCost;              // SAH cost of the BVH the frame rendered with
+    double renderSeconds;
+    double encodeSeconds;
+};
+
+// Expands pattern for the given frame number. Only %d, %0Nd (N up to 9) and %%
+// are understood, and the pattern must hold exactly one frame number; returns
+// false for any other pattern.
+bool format_frame_name(const std::string& pattern, int frame, std::string& name);
+
+// Renders an animation frame by frame into one scene. The scene, its worker
+// pool and its compiled geometry stay alive across frames: moved shapes only
+// refit the BVH, which is rebuilt when refitting has degraded it too far
+// (see RenderSettings::refitThreshold).
+class SequenceRenderer {
+private:
+    Scene& scene;
+    const Animation& animation;
+    std::vector<glm::mat4> shapeLocal;  // Per shape track, its authored matrix without the translation
+    std::vector<FrameTiming> timings;
+
+public:
+    // Captures the authored transforms of the animated shapes, which keys are applied on top of
+    SequenceRenderer(Scene& scene, const Animation& animation);
+
+    // Moves the camera, shapes and lights to where they are at the given time
+    void pose(float time);
+
+    // Renders settings.frameCount frames evenly spread over the time range.
+    // Stops at the first frame that fails to be written.
+    bool render(const SequenceSettings& settings, std::string& error);
+
+    const std::vector<FrameTiming>& getTimings() const { return timings; }
+
+    // One line per frame, then the totals
+    void printTimings(std::ostream& out) const;
+};
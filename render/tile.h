@@ -0,0 +1,30 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Rectangular block of pixels rendered as one unit of work, [x0, x1) x [y0, y1)
+struct Tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Rows [firstRow, firstRow + rowCount) of an RGB image that is width pixels wide.
+// Tiles are written through this view so the same code can fill a whole frame
+// buffer or just one band of it.
+struct ImageRows {
+    unsigned char* data;
+    int width;
+    int firstRow;
+    int rowCount;
+
+    unsigned char* pixel(int x, int y) const {
+        return data + (static_cast<size_t>(y - firstRow) * width + x) * 3;
+    }
+};
+
+// Convert color to unsigned char (0-255 range)
+inline void storePixel(unsigned char* pixel, const glm::vec3& color) {
+    pixel[0] = static_cast<unsigned char>(color.r * 255.0f);
+    pixel[1] = static_cast<unsigned char>(color.g * 255.0f);
+    pixel[2] = static_cast<unsigned char>(color.b * 255.0f);
+}
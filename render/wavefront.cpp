@@ -0,0 +1,219 @@
+#include "wavefront.h"
+#include <algorithm>
+#include <limits>
+#include "../ray_packet.h"
+#include "../scene.h"
+
+static const uint32_t NO_OCCLUDER = std::numeric_limits<uint32_t>::max();
+
+// Spreads the low 10 bits of v so two zero bits follow each of them
+static uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Quantizes points within the bounds of a stream onto a 1024^3 grid and
+// interleaves the cell coordinates into a 30-bit Morton code
+struct MortonGrid {
+    glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 scale;
+
+    void include(const glm::vec3& p) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+
+    void finish() {
+        scale = glm::vec3(1023.0f) / glm::max(hi - lo, glm::vec3(1e-6f));
+    }
+
+    uint32_t code(const glm::vec3& p) const {
+        glm::vec3 cell = glm::clamp((p - lo) * scale, 0.0f, 1023.0f);
+        return (spreadBits(static_cast<uint32_t>(cell.x)) << 2) | (spreadBits(static_cast<uint32_t>(cell.y)) << 1) |
+               spreadBits(static_cast<uint32_t>(cell.z));
+    }
+};
+
+static uint32_t directionOctant(const glm::vec3& d) {
+    return (d.x < 0.0f ? 4u : 0u) | (d.y < 0.0f ? 2u : 0u) | (d.z < 0.0f ? 1u : 0u);
+}
+
+void WavefrontTracer::sortStream(size_t count) {
+    std::sort(order.begin(), order.begin() + count);
+}
+
+void WavefrontTracer::traceShadowRays(const Scene& scene, RenderStats& counters, double* traversalSeconds) {
+    const auto& lights = scene.getLights();
+    size_t lightCount = lights.size();
+    size_t count = points.size() * lightCount;
+    shadowRays.clear();
+    lightDirections.resize(count);
+    shadowDistances.resize(count);
+    shadowBlocked.resize(count);
+    order.resize(count);
+    if (count == 0) {
+        return;
+    }
+
+    MortonGrid grid;
+    for (const ShadingPoint& point : points) {
+        grid.include(point.position);
+    }
+    grid.finish();
+
+    // Built exactly as Scene::calculateLighting builds them
+    for (size_t p = 0; p < points.size(); ++p) {
+        const ShadingPoint& point = points[p];
+        uint64_t morton = grid.code(point.position);
+        for (size_t l = 0; l < lightCount; ++l) {
+            size_t index = p * lightCount + l;
+            glm::vec3 lightPosition = lights[l]->getPosition();
+            glm::vec3 lightDir = glm::normalize(lightPosition - point.position);
+            lightDirections[index] = lightDir;
+            shadowDistances[index] = glm::length(lightPosition - point.position);
+            shadowRays.push_back(Ray(point.position + point.normal * 0.001f, lightDir));
+            order[index] = {(static_cast<uint64_t>(l) << 32) | morton, static_cast<uint32_t>(index)};
+        }
+    }
+
+    // Rays towards the same light from nearby points are nearly parallel, so the
+    // sorted stream reuses both BVH nodes and the last blocker found
+    sortStream(count);
+    const CompiledScene& compiled = scene.getCompiledScene();
+    occluderHints.assign(lightCount, NO_OCCLUDER);
+    ScopedTimer timer(traversalSeconds);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t index = order[i].second;
+        size_t light = index % lightCount;
+        bool blocked = compiled.occluded(shadowRays[index], shadowDistances[index], &occluderHints[light], &counters.traversal);
+        shadowBlocked[index] = blocked;
+        counters.shadowRays++;
+        if (blocked) counters.shadowRaysBlocked++;
+    }
+}
+
+void WavefrontTracer::shadePoints(const Scene& scene, int depth) {
+    const auto& lights = scene.getLights();
+    const std::vector<Material>& materials = scene.getMaterials();
+    size_t lightCount = lights.size();
+    reflections.clear();
+
+    for (size_t p = 0; p < points.size(); ++p) {
+        const ShadingPoint& point = points[p];
+        const Material& material = materials[point.material];
+
+        // Same terms in the same order as Scene::calculateLighting
+        glm::vec3 totalLight(0.0f);
+        totalLight += scene.ambientLighting(material);
+        for (size_t l = 0; l < lightCount; ++l) {
+            size_t index = p * lightCount + l;
+            if (shadowBlocked[index]) continue;
+            totalLight += scene.directLighting(*lights[l], lightDirections[index], shadowDistances[index],
+                                               point.position, point.normal, material);
+        }
+
+        size_t slot = static_cast<size_t>(point.path) * maxDepth + depth;
+        pathColors[slot] = glm::clamp(totalLight, 0.0f, 1.0f);
+        pathSteps[slot] = scene.continuePath(material, point.position, depth, pathThroughputs[point.path]);
+        pathLengths[point.path] = depth + 1;
+
+        if (pathSteps[slot].trace) {
+            glm::vec3 reflectionDir = glm::reflect(point.incoming, point.normal);
+            reflections.push_back({Ray(point.position + point.normal * 0.001f, reflectionDir), point.path});
+        }
+    }
+}
+
+void WavefrontTracer::renderTile(const Scene& scene, const Tile& tile, int width, int height, const ImageRows& out,
+                                 RenderStats& counters, double* traversalSeconds) {
+    const Camera& camera = scene.getCamera();
+    const CompiledScene& compiled = scene.getCompiledScene();
+    int tileWidth = tile.x1 - tile.x0;
+    size_t pathCount = static_cast<size_t>(tileWidth) * (tile.y1 - tile.y0);
+    maxDepth = scene.getMaxDepth();
+    pathColors.resize(pathCount * maxDepth);
+    pathSteps.resize(pathCount * maxDepth);
+    pathLengths.assign(pathCount, 0);
+    pathThroughputs.assign(pathCount, 1.0f);
+
+    // Primary rays, intersected a packet at a time
+    points.clear();
+    RayPacket packet;
+    HitRecord hits[RayPacket::SIZE];
+    for (int by = tile.y0; by < tile.y1; by += RayPacket::HEIGHT) {
+        for (int bx = tile.x0; bx < tile.x1; bx += RayPacket::WIDTH) {
+            camera.getRayPacket(bx, by, tile.x1 - bx, tile.y1 - by, width, height, packet);
+            {
+                ScopedTimer timer(traversalSeconds);
+                compiled.intersectPacket(packet, hits, &counters.traversal);
+            }
+            for (int lane = 0; lane < packet.size(); ++lane) {
+                counters.countTracedRay(0, hits[lane].hit());
+                if (!hits[lane].hit()) continue;
+                int x = packet.x0 + lane % packet.width;
+                int y = packet.y0 + lane / packet.width;
+                Ray ray = packet.getRay(lane);
+                SurfacePoint surface = compiled.resolveSurface(ray, hits[lane]);
+                uint32_t path = static_cast<uint32_t>((y - tile.y0) * tileWidth + (x - tile.x0));
+                points.push_back({surface.position, surface.normal, ray.getDirection(), hits[lane].material, path});
+            }
+        }
+    }
+
+    for (int depth = 0; !points.empty(); ++depth) {
+        traceShadowRays(scene, counters, traversalSeconds);
+        shadePoints(scene, depth);
+
+        // Reflection rays sorted by direction octant, then origin
+        size_t count = reflections.size();
+        order.resize(count);
+        if (count > 0) {
+            MortonGrid grid;
+            for (const PathRay& reflection : reflections) {
+                grid.include(reflection.ray.getOrigin());
+            }
+            grid.finish();
+            for (size_t i = 0; i < count; ++i) {
+                const Ray& ray = reflections[i].ray;
+                uint64_t key = (static_cast<uint64_t>(directionOctant(ray.getDirection())) << 30) |
+                               grid.code(ray.getOrigin());
+                order[i] = {key, static_cast<uint32_t>(i)};
+            }
+            sortStream(count);
+        }
+        sortedReflections.clear();
+        for (size_t i = 0; i < count; ++i) {
+            sortedReflections.push_back(reflections[order[i].second]);
+        }
+
+        points.clear();
+        for (const PathRay& reflection : sortedReflections) {
+            HitRecord hit;
+            {
+                ScopedTimer timer(traversalSeconds);
+                hit = compiled.intersect(reflection.ray, &counters.traversal);
+            }
+            counters.countTracedRay(depth + 1, hit.hit());
+            if (!hit.hit()) continue;
+            SurfacePoint surface = compiled.resolveSurface(reflection.ray, hit);
+            points.push_back({surface.position, surface.normal, reflection.ray.getDirection(), hit.material, reflection.path});
+        }
+    }
+
+    // Fold each path back to front as Scene::shadeSurface does; beyond the last
+    // surface is the black background
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            size_t path = static_cast<size_t>(y - tile.y0) * tileWidth + (x - tile.x0);
+            glm::vec3 color(0.0f);
+            for (int i = pathLengths[path]; i-- > 0;) {
+                color = pathSteps[path * maxDepth + i].combine(pathColors[path * maxDepth + i], color);
+            }
+            storePixel(out.pixel(x, y), color);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "render_stats.h"
+#include "tile.h"
+#include "../scene.h"
+
+// Breadth-first alternative to the per-pixel Scene::shadeSurface. A tile's primary
+// rays are intersected as packets, and every surface they hit is queued for
+// shading. Shading emits a stream of shadow rays and a stream of reflection
+// rays; each stream is sorted by a key built from ray direction and a Morton
+// code of the origin, so neighbouring queries walk the same BVH nodes, and
+// then traced in bulk. Reflection hits feed the next round until the streams
+// run dry; Scene::continuePath decides which reflections are traced.
+//
+// Every shading decision mirrors the per-pixel path, and each pixel's colour is
+// combined from its surfaces in the same order, so images are identical.
+// One tracer per thread; it keeps its stream buffers between tiles.
+class WavefrontTracer {
+private:
+    // A surface waiting for its shadow rays
+    struct ShadingPoint {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 incoming;             // Direction of the ray that hit it
+        uint32_t material;
+        uint32_t path;
+    };
+
+    // A closest-hit query continuing a path
+    struct PathRay {
+        Ray ray;
+        uint32_t path;
+    };
+
+    // Each pixel's surfaces through its reflections, nearest first: the lit colour
+    // of surface i of path p, and how its reflection mixes in, at p * maxDepth + i
+    int maxDepth = 0;
+    std::vector<glm::vec3> pathColors;
+    std::vector<ReflectionStep> pathSteps;
+    std::vector<int> pathLengths;
+    std::vector<float> pathThroughputs;
+    std::vector<ShadingPoint> points;
+    std::vector<PathRay> reflections;
+    std::vector<PathRay> sortedReflections;
+    std::vector<Ray> shadowRays;        // points.size() * lightCount, light-minor
+    std::vector<glm::vec3> lightDirections;
+    std::vector<float> shadowDistances;
+    std::vector<uint8_t> shadowBlocked;
+    std::vector<std::pair<uint64_t, uint32_t>> order;   // Sort key and stream index
+    std::vector<uint32_t> occluderHints;                // Last blocker found per light
+
+    // Orders a stream by key; order holds the stream indices afterwards
+    void sortStream(size_t count);
+
+    // Traces the shadow stream of the queued points, sorted by light and origin
+    void traceShadowRays(const Scene& scene, RenderStats& counters, double* traversalSeconds);
+
+    // Lights and stores the queued points, and queues reflection rays for the reflective ones
+    void shadePoints(const Scene& scene, int depth);
+
+public:
+    // Renders every pixel of a tile of a width x height frame, one sample per
+    // pixel as Scene::renderTile does. Ray counters are added to counters, and
+    // BVH query time to traversalSeconds when given.
+    void renderTile(const Scene& scene, const Tile& tile, int width, int height, const ImageRows& out,
+                    RenderStats& counters, double* traversalSeconds);
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include "utils/image_encoder.h"
+#include "render/denoiser.h"
+
+// Options controlling how Scene::renderToPNG schedules and produces a frame
+struct RenderSettings {
+    int threadCount;    // Worker threads (0 = hardware concurrency, 1 = serial render)
+    int tileSize;       // Edge length of the square tiles handed to workers, in pixels
+    bool showProgress;  // Draw the console progress bar
+    bool wavefront;     // Trace single-sample tiles breadth first with sorted ray streams (see WavefrontTracer)
+    bool rasterize;     // Find the camera hits of single-sample tiles by rasterizing (see PrimaryRasterizer)
+
+    // Anti-aliasing. With both sample counts at 1 every pixel gets one ray through its
+    // corner. Otherwise each pixel takes samplesPerPixel stratified samples, and pixels
+    // that are noisy or differ strongly from a neighbour get more, up to maxSamplesPerPixel.
+    int samplesPerPixel;
+    int maxSamplesPerPixel;
+    float varianceThreshold;    // Refine while the standard error of pixel luminance exceeds this
+    float contrastThreshold;    // Refine pixels whose luminance differs from a neighbour's by more than this
+
+    // Reflections. A pixel's path ends after maxDepth surfaces (the camera hit
+    // included, at most Scene::MAX_TRACE_DEPTH). A reflection that would add less
+    // than minThroughput of the pixel's colour is not traced and the surface is
+    // shaded as if it were not reflective. With russianRoulette such reflections
+    // are instead traced with probability weight / minThroughput and weighted up
+    // to match, which keeps the expected colour right at the price of noise.
+    int maxDepth;
+    float minThroughput;
+    bool russianRoulette;
+
+    // Many-light shading (see LightTree). Lights whose estimated contribution at a
+    // shading point is below lightCutoff are skipped there; 0 evaluates every light.
+    // With lightSamples above 0 and more lights than that, each shading point
+    // instead traces shadow rays to lightSamples lights picked in proportion to
+    // their estimated contribution, weighted so the lighting is right on average.
+    float lightCutoff;
+    int lightSamples;
+
+    // Progressive preview (see Scene::renderProgressive). With progressiveBlock
+    // above 1, renderToPNG first renders one pixel per progressiveBlock-sized block
+    // (rounded down to a power of two) and then halves the spacing pass by pass.
+    // A positive deadlineSeconds stops refining once that long has passed since the
+    // frame started and keeps the best image reached; the first pass always completes.
+    // Passes take one sample per pixel, so renderToPNG ignores progressiveBlock
+    // while anti-aliasing is enabled.
+    int progressiveBlock;
+    double deadlineSeconds;
+
+    // Output. imageFormat picks the encoder renderToPNG writes with. With streamOutput
+    // and libpng output, finished bands of rows are encoded while later bands render,
+    // and only a few bands are kept in memory instead of the whole frame.
+    ImageFormat imageFormat;
+    bool streamOutput;
+    PngOptions pngOptions;
+
+    // Post-process. With denoise the finished frame goes through a Denoiser guided
+    // by first-hit normal, depth and albedo buffers before it is encoded; with
+    // writeFeatures those buffers are also saved next to the image (see
+    // FeatureBuffers::write).
+    bool denoise;
+    bool writeFeatures;
+    DenoiseOptions denoiseOptions;
+
+    // Instrumentation. Ray and traversal counters are always gathered; these add
+    // the costlier parts. collectTimings times every BVH query so traversal and
+    // shading time can be told apart, and recordPixelCost keeps the time spent on
+    // each pixel for Scene::getPixelCost.
+    bool collectTimings;
+    bool recordPixelCost;
+
+    // Animation. After shapes move the BVH is refitted in place, which keeps its
+    // topology; once that drives its SAH cost above refitThreshold times the cost
+    // it had when built, the next frame rebuilds it instead.
+    float refitThreshold;
+
+    RenderSettings()
+        : threadCount(0)
+        , tileSize(32)
+        , showProgress(true)
+        , wavefront(false)
+        , rasterize(false)
+        , samplesPerPixel(1)
+        , maxSamplesPerPixel(1)
+        , varianceThreshold(0.01f)
+        , contrastThreshold(0.1f)
+        , maxDepth(3)
+        , minThroughput(0.0f)
+        , russianRoulette(false)
+        , lightCutoff(0.0f)
+        , lightSamples(0)
+        , progressiveBlock(0)
+        , deadlineSeconds(0.0)
+        , imageFormat(ImageFormat::Png)
+        , streamOutput(false)
+        , denoise(false)
+        , writeFeatures(false)
+        , collectTimings(false)
+        , recordPixelCost(false)
+        , refitThreshold(1.5f)
+    {}
+};
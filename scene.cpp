@@ -1,5 +1,14 @@
 #include "scene.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <limits>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <stdexcept>
 #ifdef __APPLE__
@@ -8,59 +17,341 @@
     #include <GL/gl.h>
 #endif
 #include "utils/progress_bar.h"
+#include "render/adaptive_sampler.h"
+#include "render/wavefront.h"
+#include "render/checkpoint.h"
+
+// Per-thread render counters, merged into the scene totals after each tile
+static thread_local RenderStats threadStats;
+
+// Per-thread, per-light slot of the shape that last blocked a shadow ray.
+// Only used as a first guess, so stale entries cost one wasted test at most.
+static thread_local std::vector<uint32_t> lastOccluder;
+static const uint32_t NO_OCCLUDER = std::numeric_limits<uint32_t>::max();
+
+// Per-thread stream buffers of the wavefront path, reused across tiles
+static thread_local WavefrontTracer wavefrontTracer;
+
+// Per-thread camera hits of the tile being rendered, when rasterizing
+static thread_local TileVisibility tileVisibility;
 
 Scene::Scene(const Camera& cam) : camera(cam) {}
 
+void Scene::build() {
+    if (shapesPending) {
+        return;
+    }
+    compiled.build(shapes);
+    geometryVersion++;
+    builtSahCost = compiled.getBVH().getBuildStats().sahCost;
+    accelerationDirty = false;
+    transformsDirty = false;
+}
+
+bool Scene::refit() {
+    if (accelerationDirty) {
+        build();
+        return true;
+    }
+    if (!transformsDirty) {
+        return false;
+    }
+
+    transformsDirty = false;
+    materializeShapes();
+    float cost = compiled.refit(shapes);
+    geometryVersion++;
+    if (cost > builtSahCost * settings.refitThreshold) {
+        build();
+        return true;
+    }
+    return false;
+}
+
+void Scene::setCompiledScene(CompiledScene&& compiledScene) {
+    compiled = std::move(compiledScene);
+    geometryVersion++;
+    builtSahCost = compiled.getBVH().getBuildStats().sahCost;
+    shapes.clear();
+    shapesPending = true;
+    accelerationDirty = false;
+    transformsDirty = false;
+}
+
+void Scene::materializeShapes() {
+    if (shapesPending) {
+        shapes = compiled.toShapes();
+        shapesPending = false;
+    }
+}
+
+void Scene::flushRenderStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.add(threadStats);
+    threadStats = RenderStats();
+}
+
+double* Scene::traversalTimer() const {
+    return settings.collectTimings ? &threadStats.traversalSeconds : nullptr;
+}
+
+void Scene::printStats(std::ostream& out) const {
+    out << "Compiled scene: " << compiled.getSphereCount() << " spheres, "
+        << compiled.getCuboidCount() << " cuboids, "
+        << compiled.getInstanceCount() << " instances, "
+        << compiled.getGenericCount() << " other shapes" << std::endl;
+
+    if (compiled.getInstanceCount() > 0) {
+        // Shared geometry is counted once, however many instances place it
+        size_t geometryBytes = 0;
+        for (const auto& geometry : compiled.getInstances().geometries) {
+            geometryBytes += geometry->getMemoryBytes();
+        }
+        size_t instanceBytes = compiled.getInstanceCount() * (2 * sizeof(glm::mat4) + sizeof(uint32_t) + sizeof(PrimitiveRef));
+        out << "Instancing: " << compiled.getGeometryCount() << " geometries in "
+            << geometryBytes / (1024.0 * 1024.0) << " MB, instance data "
+            << instanceBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+    const BuildStats& build = compiled.getBVH().getBuildStats();
+    out << "BVH: " << build.primitiveCount << " shapes, "
+        << build.nodeCount << " nodes, "
+        << build.leafCount << " leaves, depth " << build.maxDepth
+        << ", SAH cost " << build.sahCost
+        << ", built in " << build.buildMilliseconds << " ms" << std::endl;
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    const RenderStats& stats = renderTotals;
+    if (stats.cameraSamples > 0) {
+        uint64_t pixels = static_cast<uint64_t>(stats.width) * stats.height;
+        out << "Samples: " << stats.cameraSamples << " camera samples, "
+            << static_cast<double>(stats.cameraSamples) / (pixels > 0 ? pixels : 1) << " per pixel, "
+            << stats.refinedPixels << " pixels refined" << std::endl;
+    }
+
+    if (stats.progressivePasses > 0) {
+        out << "Progressive: " << stats.progressivePasses << " passes, finest pixel spacing " << stats.progressiveSpacing;
+        if (stats.progressiveSpacing > 1) {
+            out << ", stopped by the deadline";
+        }
+        out << std::endl;
+    }
+
+    if (stats.rasterizedPixels > 0) {
+        out << "Raster: " << stats.rasterizedPixels << " camera hits rasterized, "
+            << static_cast<double>(stats.rasterTests) / stats.rasterizedPixels << " shape tests/pixel" << std::endl;
+    }
+
+    if (stats.checkpointTiles > 0) {
+        out << "Checkpoint: resumed " << stats.resumedTiles << " of " << stats.checkpointTiles << " tiles" << std::endl;
+    }
+
+    if (stats.traversal.rays == 0) {
+        return;
+    }
+
+    out << "Rays: " << stats.primaryRays << " primary, "
+        << stats.reflectionRays << " reflection, "
+        << stats.shadowRays << " shadow (" << stats.shadowRaysBlocked << " blocked), "
+        << stats.hits << " hits";
+    if (stats.lightsSkipped > 0) {
+        out << ", " << stats.lightsSkipped << " light evaluations skipped";
+    }
+    if (stats.reflectionsCut > 0) {
+        out << ", " << stats.reflectionsCut << " reflections cut";
+    }
+    out << std::endl;
+
+    double rays = static_cast<double>(stats.traversal.rays);
+    out << "Traversal: " << stats.traversal.rays << " rays, "
+        << stats.traversal.nodesVisited / rays << " nodes/ray, "
+        << stats.traversal.primitiveTests / rays << " shape tests/ray";
+    if (stats.renderSeconds > 0.0) {
+        out << ", " << rays / stats.renderSeconds / 1e6 << " Mrays/s";
+    }
+    out << std::endl;
+
+    if (stats.encodeSeconds > 0.0) {
+        out << "Encode: " << stats.encodedBytes / 1024.0 << " KB written in " << stats.encodeSeconds * 1000.0
+            << " ms, " << stats.encodeBytesPerSecond() / (1024.0 * 1024.0) << " MB/s of pixels" << std::endl;
+    }
+
+    if (stats.featureSeconds > 0.0 || stats.denoiseSeconds > 0.0) {
+        double postSeconds = stats.featureSeconds + stats.denoiseSeconds;
+        out << "Denoise: features " << stats.featureSeconds * 1000.0 << " ms, filter "
+            << stats.denoiseSeconds * 1000.0 << " ms";
+        if (stats.renderSeconds > 0.0) {
+            out << ", " << 100.0 * postSeconds / stats.renderSeconds << "% of render time";
+        }
+        out << std::endl;
+    }
+
+    if (stats.timingsCollected) {
+        out << "Time: " << stats.traversalSeconds << " s traversal, "
+            << stats.shadingSeconds() << " s shading across threads, "
+            << stats.encodeSeconds << " s encoding" << std::endl;
+    }
+}
+
+RenderStats Scene::getRenderStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return renderTotals;
+}
+
+TraversalStats Scene::getTraversalStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return renderTotals.traversal;
+}
+
+double Scene::getLastRenderSeconds() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return renderTotals.renderSeconds;
+}
+
+uint64_t Scene::getLastSampleCount() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return renderTotals.cameraSamples;
+}
 
 Intersection Scene::findClosestIntersection(const Ray& ray) const {
     Intersection closest;
-    float minDistance = std::numeric_limits<float>::infinity();
 
-    for (const auto& shape : shapes) {
-        Intersection intersection = shape->intersect(ray);
-        if (intersection.hit && intersection.distance < minDistance) {
-            minDistance = intersection.distance;
-            closest = intersection;
+    if (accelerationDirty) {
+        // No hierarchy yet, fall back to testing every shape
+        float minDistance = std::numeric_limits<float>::infinity();
+        for (const auto& shape : shapes) {
+            Intersection intersection = shape->intersect(ray);
+            if (intersection.hit && intersection.distance < minDistance) {
+                minDistance = intersection.distance;
+                closest = intersection;
+            }
         }
+        return closest;
     }
 
-    return closest;
+    return compiled.toIntersection(ray, compiled.intersect(ray, &threadStats.traversal));
 }
 
-glm::vec3 Scene::calculateLighting(const glm::vec3& point, const glm::vec3& normal, const Material& material) const {
-    glm::vec3 totalLight(0.0f);
-    
+bool Scene::occluded(const Ray& ray, float maxDistance) const {
+    return occluded(ray, maxDistance, nullptr);
+}
+
+bool Scene::occluded(const Ray& ray, float maxDistance, uint32_t* occluderHint) const {
+    if (accelerationDirty) {
+        for (const auto& shape : shapes) {
+            Intersection intersection = shape->intersect(ray);
+            if (intersection.hit && intersection.distance <= maxDistance) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ScopedTimer timer(traversalTimer());
+    return compiled.occluded(ray, maxDistance, occluderHint, &threadStats.traversal);
+}
+
+glm::vec3 Scene::ambientLighting(const Material& material) const {
     // Global ambient light (you might want to make this configurable)
     glm::vec3 globalAmbient(0.1f);
-    totalLight += globalAmbient * material.ambient * material.color;
-
-    // Add contribution from each light
-    for (const auto& light : lights) {
-        // Calculate light direction and distance
-        glm::vec3 lightDir = glm::normalize(light->getPosition() - point);
-        float lightDistance = glm::length(light->getPosition() - point);
-        
-        // Cast shadow ray
-        Ray shadowRay(point + normal * 0.001f, lightDir);
-        Intersection shadowIntersection = findClosestIntersection(shadowRay);
-        
-        // Check if point is in shadow
-        if (!shadowIntersection.hit || shadowIntersection.distance > lightDistance) {
-            // Diffuse term (Lambert's law)
-            float diff = glm::max(glm::dot(normal, lightDir), 0.0f);
-            glm::vec3 diffuse = material.diffuse * diff * material.color * light->getColor();
-            
-            // Specular term (Phong reflection)
-            glm::vec3 viewDir = glm::normalize(camera.getPosition() - point);
-            glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
-            float spec = pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), material.shininess);
-            glm::vec3 specular = material.specular * spec * light->getColor();
-            
-            // Light attenuation (inverse square law with smoothing)
-            float attenuation = 1.0f / (1.0f + 0.09f * lightDistance + 0.032f * lightDistance * lightDistance);
-            
-            // Add light contribution
-            totalLight += (diffuse + specular) * light->getIntensity() * attenuation;
+    return globalAmbient * material.ambient * material.color;
+}
+
+glm::vec3 Scene::directLighting(const Light& light, const glm::vec3& lightDir, float lightDistance,
+                                const glm::vec3& point, const glm::vec3& normal, const Material& material) const {
+    // Diffuse term (Lambert's law)
+    float diff = glm::max(glm::dot(normal, lightDir), 0.0f);
+    glm::vec3 diffuse = material.diffuse * diff * material.color * light.getColor();
+
+    // Specular term (Phong reflection)
+    glm::vec3 viewDir = glm::normalize(camera.getPosition() - point);
+    glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+    float spec = pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), material.shininess);
+    glm::vec3 specular = material.specular * spec * light.getColor();
+
+    // Light attenuation (inverse square law with smoothing)
+    float attenuation = light_falloff(lightDistance);
+
+    return (diffuse + specular) * light.getIntensity() * attenuation;
+}
+
+glm::vec3 Scene::lightContribution(size_t index, const glm::vec3& point, const glm::vec3& normal,
+                                   const Material& material) const {
+    const Light& light = *lights[index];
+
+    // Calculate light direction and distance
+    glm::vec3 lightDir = glm::normalize(light.getPosition() - point);
+    float lightDistance = glm::length(light.getPosition() - point);
+
+    // Cast shadow ray; the point is lit unless something sits within lightDistance
+    Ray shadowRay(point + normal * 0.001f, lightDir);
+    threadStats.shadowRays++;
+    if (occluded(shadowRay, lightDistance, &lastOccluder[index])) {
+        threadStats.shadowRaysBlocked++;
+        return glm::vec3(0.0f);
+    }
+    return directLighting(light, lightDir, lightDistance, point, normal, material);
+}
+
+// Seed for random choices at a shading point, such as light picks, so they do
+// not depend on which thread shades it or in what order
+static uint32_t hashPoint(const glm::vec3& point) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 3; ++i) {
+        uint32_t bits;
+        std::memcpy(&bits, &point[i], sizeof(bits));
+        hash = (hash ^ bits) * 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// Next number of a PCG sequence, as a float in [0, 1)
+static float nextUniform(uint32_t& state) {
+    state = state * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return ((word >> 22) ^ word) / 4294967296.0f;
+}
+
+// Lights considered at one shading point, reused across calls
+static thread_local std::vector<uint32_t> lightCandidates;
+
+glm::vec3 Scene::calculateLighting(const glm::vec3& point, const glm::vec3& normal, const Material& material) const {
+    glm::vec3 totalLight(0.0f);
+    totalLight += ambientLighting(material);
+
+    if (lastOccluder.size() < lights.size()) {
+        lastOccluder.resize(lights.size(), NO_OCCLUDER);
+    }
+
+    size_t samples = settings.lightSamples > 0 ? static_cast<size_t>(settings.lightSamples) : 0;
+    if (samples > 0 && lights.size() > samples) {
+        // Stratified picks from the light tree, each divided by the probability
+        // it was picked with, so the sum estimates the sum over every light
+        uint32_t state = hashPoint(point);
+        for (size_t s = 0; s < samples; ++s) {
+            float u = std::min((s + nextUniform(state)) / samples, 0.99999994f);
+            uint32_t index;
+            float probability;
+            if (!lightTree.sample(point, settings.lightCutoff, u, index, probability)) {
+                break;
+            }
+            totalLight += lightContribution(index, point, normal, material) / (probability * samples);
+        }
+        threadStats.lightsSkipped += lights.size() - samples;
+    } else if (settings.lightCutoff > 0.0f) {
+        lightCandidates.clear();
+        lightTree.collect(point, settings.lightCutoff, lightCandidates);
+        for (uint32_t index : lightCandidates) {
+            totalLight += lightContribution(index, point, normal, material);
+        }
+        threadStats.lightsSkipped += lights.size() - lightCandidates.size();
+    } else {
+        // Add contribution from each light
+        for (size_t i = 0; i < lights.size(); ++i) {
+            totalLight += lightContribution(i, point, normal, material);
         }
     }
 
@@ -68,54 +359,740 @@ glm::vec3 Scene::calculateLighting(const glm::vec3& point, const glm::vec3& norm
     return glm::clamp(totalLight, 0.0f, 1.0f);
 }
 
+ReflectionStep Scene::continuePath(const Material& material, const glm::vec3& position, int depth,
+                                   float& throughput) const {
+    ReflectionStep step;
+    if (material.reflectiveness <= 0.0f) {
+        return step;
+    }
+    step.reflectiveness = material.reflectiveness;
+
+    // Past the last level the reflection is black, as is a reflection that misses
+    if (depth + 1 >= getMaxDepth()) {
+        return step;
+    }
+
+    float weight = throughput * material.reflectiveness;
+    if (weight < settings.minThroughput) {
+        // Russian roulette is seeded from the surface, so the outcome does not depend on the thread
+        float survival = weight / settings.minThroughput;
+        uint32_t state = hashPoint(position) ^ static_cast<uint32_t>(depth) * 0x9e3779b9u;
+        if (!settings.russianRoulette || nextUniform(state) >= survival) {
+            threadStats.reflectionsCut++;
+            if (!settings.russianRoulette) {
+                step.reflectiveness = 0.0f;
+            }
+            return step;
+        }
+        step.compensation = 1.0f / survival;
+        weight = settings.minThroughput;
+    }
+
+    step.trace = true;
+    throughput = weight;
+    return step;
+}
+
 glm::vec3 Scene::traceRay(const Ray& ray, int depth) const {
-    if (depth >= MAX_REFLECTION_DEPTH) {
+    if (depth >= getMaxDepth()) {
         return glm::vec3(0.0f);
     }
 
-    Intersection intersection = findClosestIntersection(ray);
-    
-    if (!intersection.hit) {
+    HitRecord hit;
+    {
+        ScopedTimer timer(traversalTimer());
+        hit = compiled.intersect(ray, &threadStats.traversal);
+    }
+    threadStats.countTracedRay(depth, hit.hit());
+    if (!hit.hit()) {
         return glm::vec3(0.0f);  // Background color (black)
     }
+    return shadeSurface(ray, compiled.resolveSurface(ray, hit), depth);
+}
+
+glm::vec3 Scene::shadeRay(const Ray& ray) const {
+    return traceRay(ray, 0);
+}
+
+glm::vec3 Scene::shadeSurface(const Ray& cameraRay, const SurfacePoint& firstSurface, int depth) const {
+    glm::vec3 baseColor[MAX_TRACE_DEPTH];
+    ReflectionStep steps[MAX_TRACE_DEPTH];
+    int length = 0;
+
+    Ray ray = cameraRay;
+    SurfacePoint surface = firstSurface;
+    float throughput = 1.0f;
+    for (;;) {
+        const Material& material = *surface.material;
+        baseColor[length] = calculateLighting(surface.position, surface.normal, material);
+        ReflectionStep& step = steps[length++];
+        step = continuePath(material, surface.position, depth, throughput);
+        if (!step.trace) {
+            break;
+        }
+
+        Ray reflectionRay(surface.position + surface.normal * 0.001f, glm::reflect(ray.getDirection(), surface.normal));
+        HitRecord hit;
+        {
+            ScopedTimer timer(traversalTimer());
+            hit = compiled.intersect(reflectionRay, &threadStats.traversal);
+        }
+        threadStats.countTracedRay(++depth, hit.hit());
+        if (!hit.hit()) {
+            break;
+        }
+        ray = reflectionRay;
+        surface = compiled.resolveSurface(ray, hit);
+    }
+
+    // Beyond the last surface is the black background
+    glm::vec3 color(0.0f);
+    while (length-- > 0) {
+        color = steps[length].combine(baseColor[length], color);
+    }
+    return color;
+}
+
+// Stores the first hit of a packet lane in the feature buffers of its pixel
+static void storeFeatures(FeatureBuffers& features, const RayPacket& packet, int lane, const HitRecord& hit,
+                          const SurfacePoint& surface) {
+    size_t pixel = static_cast<size_t>(packet.y0 + lane / packet.width) * features.width + packet.x0 + lane % packet.width;
+    for (int c = 0; c < 3; ++c) {
+        features.normal[c][pixel] = surface.normal[c];
+        features.albedo[c][pixel] = surface.material->color[c];
+    }
+    features.depth[pixel] = hit.distance;
+}
+
+void Scene::renderTile(const Tile& tile, int width, int height, const ImageRows& out, float* cost,
+                       FeatureBuffers* features) const {
+    using Clock = std::chrono::steady_clock;
+    if (usesWavefront()) {
+        // Rays of a tile are traced together, so every pixel is charged an equal part
+        Clock::time_point tileStart = Clock::now();
+        wavefrontTracer.renderTile(*this, tile, width, height, out, threadStats, traversalTimer());
+        if (cost) {
+            float pixelCost = std::chrono::duration<float>(Clock::now() - tileStart).count() /
+                              ((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                std::fill(cost + static_cast<size_t>(y) * width + tile.x0, cost + static_cast<size_t>(y) * width + tile.x1, pixelCost);
+            }
+        }
+        return;
+    }
+
+    // The rasterizer is only set up for frames that use it; other callers trace
+    bool rasterized = settings.rasterize && rasterizer.isSetUp(camera, geometryVersion, width, height);
+    if (rasterized) {
+        ScopedTimer timer(traversalTimer());
+        rasterizer.rasterizeTile(camera, compiled, tile, tileVisibility, threadStats);
+    }
+
+    RayPacket packet;
+    HitRecord hits[RayPacket::SIZE];
+    SurfacePoint surfaces[RayPacket::SIZE];
+
+    for (int by = tile.y0; by < tile.y1; by += RayPacket::HEIGHT) {
+        for (int bx = tile.x0; bx < tile.x1; bx += RayPacket::WIDTH) {
+            Clock::time_point blockStart;
+            if (cost) blockStart = Clock::now();
+
+            camera.getRayPacket(bx, by, tile.x1 - bx, tile.y1 - by, width, height, packet);
+            if (rasterized) {
+                ScopedTimer timer(traversalTimer());
+                PrimaryRasterizer::resolvePacket(packet, tile, tileVisibility, hits);
+            } else {
+                ScopedTimer timer(traversalTimer());
+                compiled.intersectPacket(packet, hits, &threadStats.traversal);
+            }
+
+            // Resolve normals and materials for the final hits only, then shade the block
+            for (int lane = 0; lane < packet.size(); ++lane) {
+                threadStats.countTracedRay(0, hits[lane].hit());
+                if (hits[lane].hit()) {
+                    surfaces[lane] = compiled.resolveSurface(packet.getRay(lane), hits[lane]);
+                    if (features) {
+                        storeFeatures(*features, packet, lane, hits[lane], surfaces[lane]);
+                    }
+                }
+            }
+
+            // Primary visibility is shared by the block, so each pixel is charged an equal part
+            float sharedCost = 0.0f;
+            if (cost) sharedCost = std::chrono::duration<float>(Clock::now() - blockStart).count() / packet.size();
+
+            for (int lane = 0; lane < packet.size(); ++lane) {
+                int x = packet.x0 + lane % packet.width;
+                int y = packet.y0 + lane / packet.width;
+                Clock::time_point pixelStart;
+                if (cost) pixelStart = Clock::now();
+
+                glm::vec3 color(0.0f);  // Background color (black)
+                if (hits[lane].hit()) {
+                    color = shadeSurface(packet.getRay(lane), surfaces[lane], 0);
+                }
+                storePixel(out.pixel(x, y), color);
+
+                if (cost) {
+                    cost[static_cast<size_t>(y) * width + x] =
+                        sharedCost + std::chrono::duration<float>(Clock::now() - pixelStart).count();
+                }
+            }
+        }
+    }
+}
+
+std::vector<Tile> Scene::makeTiles(int width, int rowBegin, int rowEnd) const {
+    int tileSize = settings.tileSize > 0 ? settings.tileSize : 32;
+
+    std::vector<Tile> tiles;
+    for (int y = rowBegin; y < rowEnd; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            tiles.push_back({x, y, std::min(x + tileSize, width), std::min(y + tileSize, rowEnd)});
+        }
+    }
+    return tiles;
+}
+
+ThreadPool* Scene::getThreadPool() {
+    int threadCount = settings.threadCount > 0 ? settings.threadCount : ThreadPool::defaultThreadCount();
+    if (threadCount == 1) {
+        return nullptr;
+    }
+
+    if (!pool || pool->size() != threadCount) {
+        pool = std::make_unique<ThreadPool>(threadCount);
+    }
+    return pool.get();
+}
+
+int Scene::progressStepsPerTile() const {
+    return AdaptiveSampler::isEnabled(settings) ? 2 : 1;
+}
+
+void Scene::renderTiles(const std::vector<Tile>& tiles, int width, int height, const ImageRows& out, ProgressBar& progress) {
+    ThreadPool* workers = getThreadPool();
+    int tileCount = static_cast<int>(tiles.size());
+    float* cost = pixelCost.empty() ? nullptr : pixelCost.data();
+    FeatureBuffers* features = frameFeatures.depth.empty() ? nullptr : &frameFeatures;
+
+    // Every tile's thread time is recorded, and its counters merged once it is done
+    auto run = [&](const std::function<void(int)>& pass) {
+        auto timedPass = [&](int index) {
+            {
+                ScopedTimer timer(&threadStats.workerSeconds);
+                pass(index);
+            }
+            flushRenderStats();
+            progress.advance();
+        };
+        if (workers) {
+            workers->parallelFor(tileCount, timedPass);
+        } else {
+            for (int i = 0; i < tileCount; ++i) timedPass(i);
+        }
+    };
+
+    if (!AdaptiveSampler::isEnabled(settings)) {
+        // Tiles write disjoint pixel ranges, so workers share the output without locking
+        run([&](int index) {
+            renderTile(tiles[index], width, height, out, cost, features);
+        });
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        renderTotals.cameraSamples += static_cast<uint64_t>(width) * out.rowCount;
+        return;
+    }
+
+    // The refinement pass compares pixels with their neighbours' base estimates,
+    // so every tile finishes the base pass before any tile is refined. A band of a
+    // streamed frame also samples the row on either side of it, as the border of
+    // renderIsolatedTile does, so its edge pixels see the same neighbours as in a
+    // whole frame.
+    int bandEnd = out.firstRow + out.rowCount;
+    int firstRow = std::max(out.firstRow - 1, 0);
+    int lastRow = std::min(bandEnd + 1, height);
+    std::vector<Tile> baseTiles = tiles;
+    for (Tile& tile : baseTiles) {
+        if (tile.y0 == out.firstRow) tile.y0 = firstRow;
+        if (tile.y1 == bandEnd) tile.y1 = lastRow;
+    }
+    AdaptiveSampler sampler(*this, settings, width, height, firstRow, lastRow - firstRow, cost);
+    run([&](int index) {
+        sampler.sampleTile(baseTiles[index]);
+    });
+    run([&](int index) {
+        sampler.refineTile(tiles[index]);
+        sampler.resolveTile(tiles[index], out);
+    });
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.cameraSamples += sampler.getTotalSamples();
+    renderTotals.refinedPixels += sampler.getRefinedPixels();
+}
+
+// Wall clock seconds elapsed since start
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool Scene::usesRasterizer() const {
+    return settings.rasterize && !AdaptiveSampler::isEnabled(settings) && !usesWavefront();
+}
+
+void Scene::setupRasterizer(int width, int height) {
+    if (usesRasterizer()) {
+        rasterizer.setup(camera, compiled, geometryVersion, width, height,
+                         settings.tileSize > 0 ? settings.tileSize : 32);
+    } else {
+        rasterizer.clear();
+    }
+}
+
+void Scene::beginFrame(int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    bool rebuilt = refit();
+    if (usesLightTree()) {
+        lightTree.build(lights);
+    }
+    setupRasterizer(width, height);
+    double accelerationSeconds = secondsSince(start);
+
+    if (settings.recordPixelCost) {
+        pixelCost.assign(static_cast<size_t>(width) * height, 0.0f);
+    } else {
+        pixelCost.clear();
+    }
+
+    // Only renderTile's own packet path sees one primary hit per pixel
+    if ((settings.denoise || settings.writeFeatures) && !AdaptiveSampler::isEnabled(settings) && !usesWavefront()) {
+        frameFeatures.resize(width, height);
+    } else {
+        frameFeatures = FeatureBuffers();
+    }
+
+    // Drop anything the calling thread counted outside a render, e.g. direct queries
+    threadStats = RenderStats();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals = RenderStats();
+    renderTotals.width = width;
+    renderTotals.height = height;
+    renderTotals.timingsCollected = settings.collectTimings;
+    renderTotals.accelerationSeconds = accelerationSeconds;
+    renderTotals.accelerationRebuilt = rebuilt;
+}
+
+void Scene::renderFrame(int width, int height, std::vector<unsigned char>& frameBuffer) {
+    beginFrame(width, height);
+    auto start = std::chrono::steady_clock::now();
+
+    frameBuffer.assign(width * height * 3, 0);
+    std::vector<Tile> tiles = makeTiles(width, 0, height);
+    ProgressBar progress(static_cast<int>(tiles.size()) * progressStepsPerTile());
+    progress.setVisible(settings.showProgress);
+
+    renderTiles(tiles, width, height, ImageRows{frameBuffer.data(), width, 0, height}, progress);
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.renderSeconds = secondsSince(start);
+}
+
+uint64_t Scene::renderProgressiveTile(const Tile& tile, int spacing, bool firstPass, int width, int height,
+                                      const ImageRows& out) const {
+    uint64_t samples = 0;
+    int coarser = spacing * 2;
+    for (int y = (tile.y0 + spacing - 1) / spacing * spacing; y < tile.y1; y += spacing) {
+        for (int x = (tile.x0 + spacing - 1) / spacing * spacing; x < tile.x1; x += spacing) {
+            if (!firstPass && x % coarser == 0 && y % coarser == 0) {
+                continue;
+            }
+
+            // The ray renderTile would trace for this pixel. Its block may reach into
+            // the next tile, but no other pixel of the pass owns any of it.
+            unsigned char color[3];
+            storePixel(color, shadeRay(camera.getRay(x / float(width), y / float(height))));
+            int x1 = std::min(x + spacing, width);
+            int y1 = std::min(y + spacing, height);
+            for (int by = y; by < y1; ++by) {
+                for (int bx = x; bx < x1; ++bx) {
+                    std::memcpy(out.pixel(bx, by), color, 3);
+                }
+            }
+            samples++;
+        }
+    }
+    return samples;
+}
+
+bool Scene::renderProgressive(int width, int height, std::vector<unsigned char>& frameBuffer,
+                              const FrameCallback& onFrame) {
+    auto callStart = std::chrono::steady_clock::now();
+    beginFrame(width, height);
+    auto start = std::chrono::steady_clock::now();
+
+    // Passes shade single rays rather than renderTile's packets, so nothing is captured along the way
+    frameFeatures = FeatureBuffers();
+    pixelCost.clear();
+
+    int spacing = 1;
+    while (spacing * 2 <= settings.progressiveBlock) {
+        spacing *= 2;
+    }
+
+    frameBuffer.assign(static_cast<size_t>(width) * height * 3, 0);
+    ImageRows out{frameBuffer.data(), width, 0, height};
+    std::vector<Tile> tiles = makeTiles(width, 0, height);
+    int tileCount = static_cast<int>(tiles.size());
+    ThreadPool* workers = getThreadPool();
+
+    int passes = 0;
+    int finest = 0;
+    std::atomic<uint64_t> samples(0);
+    for (int step = spacing; step >= 1; step /= 2) {
+        bool firstPass = step == spacing;
+        std::atomic<bool> expired(false);
+        auto renderPassTile = [&](int index) {
+            if (!firstPass && settings.deadlineSeconds > 0.0 && secondsSince(callStart) >= settings.deadlineSeconds) {
+                expired = true;
+                return;
+            }
+            {
+                ScopedTimer timer(&threadStats.workerSeconds);
+                samples += renderProgressiveTile(tiles[index], step, firstPass, width, height, out);
+            }
+            flushRenderStats();
+        };
+        if (workers) {
+            workers->parallelFor(tileCount, renderPassTile);
+        } else {
+            for (int i = 0; i < tileCount; ++i) renderPassTile(i);
+        }
+
+        if (expired) {
+            break;
+        }
+        passes++;
+        finest = step;
+        if (onFrame) {
+            onFrame(frameBuffer, step);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.renderSeconds = secondsSince(start);
+    renderTotals.cameraSamples = samples;
+    renderTotals.progressivePasses = passes;
+    renderTotals.progressiveSpacing = finest;
+    return finest == 1;
+}
+
+// Size of a file just written, 0 if it cannot be read
+static uint64_t fileSize(const char* filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+void Scene::renderSingleTile(const Tile& tile, int width, int height, const ImageRows& out) {
+    refit();
+    if (usesLightTree() && lightTree.size() != lights.size()) {
+        lightTree.build(lights);
+    }
+    if (usesRasterizer() && !rasterizer.isSetUp(camera, geometryVersion, width, height)) {
+        setupRasterizer(width, height);
+    }
+    renderIsolatedTile(tile, width, height, out);
+}
+
+void Scene::renderIsolatedTile(const Tile& tile, int width, int height, const ImageRows& out) {
+    if (!AdaptiveSampler::isEnabled(settings)) {
+        renderTile(tile, width, height, out, nullptr);
+        flushRenderStats();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        renderTotals.cameraSamples += static_cast<uint64_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        return;
+    }
+
+    // Refinement compares pixels with their neighbours' base estimates
+    Tile border{std::max(tile.x0 - 1, 0), std::max(tile.y0 - 1, 0),
+                std::min(tile.x1 + 1, width), std::min(tile.y1 + 1, height)};
+    AdaptiveSampler sampler(*this, settings, width, height, border.y0, border.y1 - border.y0);
+    sampler.sampleTile(border);
+    sampler.refineTile(tile);
+    sampler.resolveTile(tile, out);
+    flushRenderStats();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.cameraSamples += sampler.getTotalSamples();
+    renderTotals.refinedPixels += sampler.getRefinedPixels();
+}
+
+void Scene::renderToCheckpoint(int width, int height, FrameCheckpoint& checkpoint) {
+    beginFrame(width, height);
+    auto start = std::chrono::steady_clock::now();
+
+    // Tiles render on their own, which neither fills a whole-frame cost buffer nor the features
+    pixelCost.clear();
+    frameFeatures = FeatureBuffers();
+
+    std::vector<Tile> tiles = makeTiles(width, 0, height);
+    std::vector<int> remaining;
+    for (int index = 0; index < static_cast<int>(tiles.size()); ++index) {
+        if (!checkpoint.isDone(index)) remaining.push_back(index);
+    }
+
+    ProgressBar progress(static_cast<int>(remaining.size()));
+    progress.setVisible(settings.showProgress);
+
+    // Tiles write disjoint pixel ranges of the mapping, so workers share it without locking
+    ImageRows out{checkpoint.getPixels(), width, 0, height};
+    auto renderRemaining = [&](int task) {
+        int index = remaining[task];
+        {
+            ScopedTimer timer(&threadStats.workerSeconds);
+            renderIsolatedTile(tiles[index], width, height, out);
+        }
+        flushRenderStats();
+        checkpoint.markDone(index);
+        progress.advance();
+    };
+
+    ThreadPool* workers = getThreadPool();
+    int taskCount = static_cast<int>(remaining.size());
+    if (workers) {
+        workers->parallelFor(taskCount, renderRemaining);
+    } else {
+        for (int task = 0; task < taskCount; ++task) renderRemaining(task);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.renderSeconds = secondsSince(start);
+    renderTotals.checkpointTiles = checkpoint.getTileCount();
+    renderTotals.resumedTiles = checkpoint.getResumedTiles();
+}
+
+bool Scene::renderToCheckpointedPNG(const char* filename, int width, int height, const std::string& checkpointPath,
+                                    std::string& error) {
+    if (needsBuild()) {
+        build();
+    }
+    FrameCheckpoint checkpoint;
+    int tileSize = settings.tileSize > 0 ? settings.tileSize : 32;
+    if (!checkpoint.open(checkpointPath, width, height, tileSize, checkpoint_fingerprint(*this, width, height), error)) {
+        return false;
+    }
 
-    glm::vec3 hitPoint = ray.at(intersection.distance);
-    glm::vec3 baseColor = calculateLighting(hitPoint, intersection.normal, intersection.material);
-    
-    // Handle reflections
-    if (intersection.material.reflectiveness > 0.0f) {
-        glm::vec3 reflectionDir = glm::reflect(ray.getDirection(), intersection.normal);
-        Ray reflectionRay(hitPoint + intersection.normal * 0.001f, reflectionDir);
-        
-        glm::vec3 reflectionColor = traceRay(reflectionRay, depth + 1);
-        
-        // Mix base color with reflection based on reflectiveness
-        return glm::mix(baseColor, reflectionColor, intersection.material.reflectiveness);
+    renderToCheckpoint(width, height, checkpoint);
+    if (!checkpoint.commit()) {
+        error = checkpointPath + ": could not write finished tiles";
+        return false;
+    }
+
+    double encodeSeconds = 0.0;
+    bool ok;
+    {
+        ScopedTimer timer(&encodeSeconds);
+        ok = write_image_rows(filename, settings.imageFormat, settings.pngOptions, width, height, checkpoint.getPixels());
+    }
+    if (ok) {
+        checkpoint.remove();
+    } else {
+        error = std::string("could not write ") + filename;
     }
-    
-    return baseColor;
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.encodeSeconds = encodeSeconds;
+    renderTotals.encodedBytes = ok ? fileSize(filename) : 0;
+    return ok;
+}
+
+bool Scene::renderToPNGStreamed(const char* filename, int width, int height) {
+    PngStreamWriter writer;
+    if (!writer.open(filename, width, height, settings.pngOptions)) {
+        return false;
+    }
+
+    beginFrame(width, height);
+    auto start = std::chrono::steady_clock::now();
+
+    // Bands are one tile high. A few band buffers rotate between the render loop and
+    // an encoder thread, which writes finished bands in order while later ones render.
+    const int BAND_BUFFERS = 3;
+    int bandHeight = settings.tileSize > 0 ? settings.tileSize : 32;
+    int bandCount = (height + bandHeight - 1) / bandHeight;
+    std::vector<std::vector<unsigned char>> buffers(BAND_BUFFERS, std::vector<unsigned char>(width * bandHeight * 3));
+
+    int tilesPerBand = (width + bandHeight - 1) / bandHeight;
+    ProgressBar progress(bandCount * tilesPerBand * progressStepsPerTile());
+    progress.setVisible(settings.showProgress);
+
+    std::mutex bandMutex;
+    std::condition_variable bandChanged;
+    int renderedBands = 0;
+    int encodedBands = 0;
+    bool encodeFailed = false;
+    double encodeSeconds = 0.0;     // Only touched by the encoder thread until it is joined
+
+    std::thread encoder([&]() {
+        for (int band = 0; band < bandCount; ++band) {
+            {
+                std::unique_lock<std::mutex> lock(bandMutex);
+                bandChanged.wait(lock, [&] { return renderedBands > band; });
+            }
+
+            const std::vector<unsigned char>& buffer = buffers[band % BAND_BUFFERS];
+            int rows = std::min(bandHeight, height - band * bandHeight);
+            bool ok = true;
+            {
+                ScopedTimer timer(&encodeSeconds);
+                for (int row = 0; row < rows && ok; ++row) {
+                    ok = writer.writeRow(&buffer[static_cast<size_t>(row) * width * 3]);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(bandMutex);
+            encodedBands = band + 1;
+            if (!ok) {
+                encodeFailed = true;
+                encodedBands = bandCount;
+            }
+            bandChanged.notify_all();
+            if (!ok) {
+                return;
+            }
+        }
+    });
+
+    for (int band = 0; band < bandCount; ++band) {
+        {
+            // Wait for the encoder to release the buffer this band will reuse
+            std::unique_lock<std::mutex> lock(bandMutex);
+            bandChanged.wait(lock, [&] { return band - encodedBands < BAND_BUFFERS; });
+            if (encodeFailed) {
+                renderedBands = bandCount;
+                bandChanged.notify_all();
+                break;
+            }
+        }
+
+        int rowBegin = band * bandHeight;
+        int rowEnd = std::min(rowBegin + bandHeight, height);
+        ImageRows rows{buffers[band % BAND_BUFFERS].data(), width, rowBegin, rowEnd - rowBegin};
+        renderTiles(makeTiles(width, rowBegin, rowEnd), width, height, rows, progress);
+
+        std::lock_guard<std::mutex> lock(bandMutex);
+        renderedBands = band + 1;
+        bandChanged.notify_all();
+    }
+
+    encoder.join();
+
+    bool ok = false;
+    if (!encodeFailed) {
+        ScopedTimer timer(&encodeSeconds);
+        ok = writer.close();
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.renderSeconds = secondsSince(start);
+    renderTotals.encodeSeconds = encodeSeconds;
+    renderTotals.encodedBytes = ok ? fileSize(filename) : 0;
+    return ok;
+}
+
+void Scene::renderFeatures(int width, int height, FeatureBuffers& features) {
+    if (needsBuild()) {
+        build();
+    }
+    features.resize(width, height);
+    std::vector<Tile> tiles = makeTiles(width, 0, height);
+
+    // Tiles write disjoint pixels, so workers fill the planes without locking
+    auto captureTile = [&](int index) {
+        const Tile& tile = tiles[index];
+        RayPacket packet;
+        HitRecord hits[RayPacket::SIZE];
+        for (int by = tile.y0; by < tile.y1; by += RayPacket::HEIGHT) {
+            for (int bx = tile.x0; bx < tile.x1; bx += RayPacket::WIDTH) {
+                camera.getRayPacket(bx, by, tile.x1 - bx, tile.y1 - by, width, height, packet);
+                compiled.intersectPacket(packet, hits);
+                for (int lane = 0; lane < packet.size(); ++lane) {
+                    if (hits[lane].hit()) {
+                        storeFeatures(features, packet, lane, hits[lane], compiled.resolveSurface(packet.getRay(lane), hits[lane]));
+                    }
+                }
+            }
+        }
+    };
+
+    ThreadPool* workers = getThreadPool();
+    int tileCount = static_cast<int>(tiles.size());
+    if (workers) {
+        workers->parallelFor(tileCount, captureTile);
+    } else {
+        for (int i = 0; i < tileCount; ++i) captureTile(i);
+    }
+}
+
+bool Scene::postProcessFrame(const char* filename, int width, int height, std::vector<unsigned char>& frameBuffer) {
+    double featureSeconds = 0.0;
+    double denoiseSeconds = 0.0;
+    if (frameFeatures.depth.empty()) {
+        ScopedTimer timer(&featureSeconds);
+        renderFeatures(width, height, frameFeatures);
+    }
+    // The buffers are only needed for this frame
+    FeatureBuffers features = std::move(frameFeatures);
+    frameFeatures = FeatureBuffers();
+
+    bool ok = true;
+    if (settings.writeFeatures) {
+        std::string stem(filename);
+        size_t dot = stem.find_last_of('.');
+        if (dot != std::string::npos && stem.find_first_of("/\\", dot) == std::string::npos) {
+            stem.erase(dot);
+        }
+        ok = features.write(stem);
+    }
+
+    if (settings.denoise) {
+        ScopedTimer timer(&denoiseSeconds);
+        Denoiser(settings.denoiseOptions, getThreadPool()).denoise(features, frameBuffer);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.featureSeconds = featureSeconds;
+    renderTotals.denoiseSeconds = denoiseSeconds;
+    return ok;
 }
 
 bool Scene::renderToPNG(const char* filename, int width, int height) {
-    std::vector<unsigned char> frameBuffer(width * height * 3);
-    ProgressBar progress(height);  // Create progress bar for number of rows
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            float u = float(x) / float(width);
-            float v = float(y) / float(height);
-            
-            Ray ray = camera.getRay(u, v);
-            glm::vec3 color = traceRay(ray, 0);
-            
-            // Convert color to unsigned char (0-255 range)
-            int pixel_index = (y * width + x) * 3;
-            frameBuffer[pixel_index] = static_cast<unsigned char>(color.r * 255.0f);
-            frameBuffer[pixel_index + 1] = static_cast<unsigned char>(color.g * 255.0f);
-            frameBuffer[pixel_index + 2] = static_cast<unsigned char>(color.b * 255.0f);
-        }
-        progress.update(y + 1);  // Update progress after each row
-    }
-
-    return write_png(filename, width, height, frameBuffer);
-}
\ No newline at end of file
+    bool postProcess = settings.denoise || settings.writeFeatures;
+    bool progressive = settings.progressiveBlock > 1 && !AdaptiveSampler::isEnabled(settings);
+    if (settings.streamOutput && settings.imageFormat == ImageFormat::Png && !postProcess && !progressive) {
+        return renderToPNGStreamed(filename, width, height);
+    }
+
+    std::vector<unsigned char> frameBuffer;
+    if (progressive) {
+        renderProgressive(width, height, frameBuffer, frameCallback);
+    } else {
+        renderFrame(width, height, frameBuffer);
+    }
+    if (postProcess && !postProcessFrame(filename, width, height, frameBuffer)) {
+        return false;
+    }
+
+    // The render is done, so the parallel encoder can have the whole pool
+    std::unique_ptr<ImageEncoder> encoder = make_image_encoder(settings.imageFormat, settings.pngOptions, getThreadPool());
+    double encodeSeconds = 0.0;
+    bool ok;
+    {
+        ScopedTimer timer(&encodeSeconds);
+        ok = encoder->write(filename, width, height, frameBuffer);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    renderTotals.encodeSeconds = encodeSeconds;
+    renderTotals.encodedBytes = ok ? fileSize(filename) : 0;
+    return ok;
+}
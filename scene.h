@@ -1,10 +1,43 @@
 #pragma once
+#include <algorithm>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <ostream>
 #include "camera.h"
 #include "shapes/shape.h"
 #include "lights/light.h"
+#include "render_settings.h"
+#include "accel/compiled_scene.h"
+#include "accel/light_tree.h"
 #include "utils/utils.h"
+#include "utils/thread_pool.h"
+#include "render/tile.h"
+#include "render/render_stats.h"
+#include "render/rasterizer.h"
+
+class ProgressBar;
+class FrameCheckpoint;
+
+// How a surface's colour combines with what its reflection sees, decided by
+// Scene::continuePath as a path reaches the surface
+struct ReflectionStep {
+    float reflectiveness = 0.0f;    // Share of the reflection in the result; 0 keeps the surface colour alone
+    float compensation = 1.0f;      // Extra weight of a reflection that survived Russian roulette
+    bool trace = false;             // Trace the reflection ray; a reflection that is not traced sees black
+
+    // Mixes a surface's lit colour with the colour its reflection saw
+    glm::vec3 combine(const glm::vec3& base, const glm::vec3& reflected) const {
+        if (reflectiveness <= 0.0f) return base;
+        if (compensation == 1.0f) return glm::mix(base, reflected, reflectiveness);
+        return base * (1.0f - reflectiveness) + reflected * (reflectiveness * compensation);
+    }
+};
+
+// Receives each intermediate image of a progressive render: the whole frame,
+// and the pixel spacing of the pass that just completed (1 for the final image)
+using FrameCallback = std::function<void(const std::vector<unsigned char>& frameBuffer, int spacing)>;
 
 class Scene {
 private:
@@ -14,34 +47,281 @@ private:
     std::vector<unsigned char> frameBuffer;
     int width;
     int height;
-    static const int MAX_REFLECTION_DEPTH = 3;
+    RenderSettings settings;
+    std::unique_ptr<ThreadPool> pool;   // Kept alive across renders, recreated when the thread count changes
+
+    // Render-ready copy of the shapes with their BVH, rebuilt lazily after shapes change
+    CompiledScene compiled;
+    bool accelerationDirty = true;
+    bool shapesPending = false;     // shapes still have to be recreated from an adopted compiled scene
+    bool transformsDirty = false;   // shapes moved since the BVH was last built or refitted
+    float builtSahCost = 0.0f;      // SAH cost of the BVH right after its last full build
+    uint64_t geometryVersion = 0;   // Bumped whenever the BVH is built, refitted or replaced
+
+    // Hierarchy over the lights, rebuilt every frame while settings cull or sample lights
+    LightTree lightTree;
+
+    // Leaves binned on screen, set up every frame that renderTile rasterizes
+    PrimaryRasterizer rasterizer;
+
+    // Counters merged from every render thread, and timing of the last frame
+    mutable std::mutex statsMutex;
+    mutable RenderStats renderTotals;
+
+    // Seconds spent on each pixel of the last frame, when settings.recordPixelCost is set
+    std::vector<float> pixelCost;
+
+    // Receives renderToPNG's intermediate images in progressive mode
+    FrameCallback frameCallback;
+
+    // First hits of the frame being rendered, for renderToPNG's post-process stage.
+    // renderTile fills them from its primary hits when settings.denoise or
+    // settings.writeFeatures is set; other paths leave them empty.
+    FeatureBuffers frameFeatures;
+
+    // occluded() with a hint slot that is tested first and updated with the blocker found
+    bool occluded(const Ray& ray, float maxDistance, uint32_t* occluderHint) const;
+
+    // Folds the calling thread's counters into renderTotals
+    void flushRenderStats() const;
+
+    // Where BVH query time goes: the calling thread's counter when timings are on
+    double* traversalTimer() const;
     
-    // Private method for recursive ray color calculation
+    bool usesLightTree() const { return settings.lightCutoff > 0.0f || settings.lightSamples > 0; }
+
+    // The wavefront path evaluates every light, so culling or sampling them turns it off
+    bool usesWavefront() const { return settings.wavefront && !usesLightTree(); }
+
+    // Only renderTile's own packet path takes one corner ray per pixel
+    bool usesRasterizer() const;
+
+    // Projects and bins the leaves for the frame if rasterizing, or drops them
+    void setupRasterizer(int width, int height);
+
+    // Traces the shadow ray towards light index from a surface point and returns
+    // the light's directLighting term, or black if the light is blocked
+    glm::vec3 lightContribution(size_t index, const glm::vec3& point, const glm::vec3& normal, const Material& material) const;
+
+    // Colour seen along a ray that starts a path at the given depth
     glm::vec3 traceRay(const Ray& ray, int depth) const;
 
+    // Colour of a ray whose closest hit has been resolved into a surface point.
+    // Follows the reflections iteratively, keeping each surface's colour and
+    // combining them back to front once the path ends.
+    glm::vec3 shadeSurface(const Ray& ray, const SurfacePoint& surface, int depth) const;
+
+    // Renders every pixel of a tile of a width x height frame.
+    // Primary rays are generated and intersected in RayPacket-sized blocks, and
+    // each block's hits are resolved and then shaded as a batch. With a cost buffer,
+    // the seconds spent on each pixel are stored at y * width + x, and with feature
+    // buffers the primary hits are stored in them.
+    // With settings.wavefront the tile goes through a WavefrontTracer instead, and
+    // with settings.rasterize the primary hits come from the PrimaryRasterizer.
+    void renderTile(const Tile& tile, int width, int height, const ImageRows& out, float* cost,
+                    FeatureBuffers* features = nullptr) const;
+
+    // Renders a set of tiles that together cover out's rows, on the worker pool.
+    // Uses the multi-sample path when anti-aliasing is enabled.
+    void renderTiles(const std::vector<Tile>& tiles, int width, int height, const ImageRows& out, ProgressBar& progress);
+
+    // Progress steps renderTiles takes per tile
+    int progressStepsPerTile() const;
+
+    // Splits rows [rowBegin, rowEnd) of the frame into tiles of settings.tileSize, row-major
+    std::vector<Tile> makeTiles(int width, int rowBegin, int rowEnd) const;
+
+    // Renders the pixels of a tile that progressive pass `spacing` adds: those on
+    // the grid of that spacing, less the ones the previous pass rendered on the
+    // grid of twice the spacing (none are skipped in the first pass). Each fills
+    // the spacing x spacing block it starts in out. Returns the pixels rendered.
+    uint64_t renderProgressiveTile(const Tile& tile, int spacing, bool firstPass, int width, int height,
+                                   const ImageRows& out) const;
+
+    // renderSingleTile once the BVH and light tree are up to date
+    void renderIsolatedTile(const Tile& tile, int width, int height, const ImageRows& out);
+
+    // Recreates the shape list from an adopted compiled scene, before it is changed
+    void materializeShapes();
+
+    // Builds if needed and resets the per-frame counters
+    void beginFrame(int width, int height);
+
+    // Renders straight into a PngStreamWriter, one band of tiles at a time
+    bool renderToPNGStreamed(const char* filename, int width, int height);
+
+    // The post-process stage of renderToPNG: captures the feature buffers if the
+    // render did not, writes them next to filename with settings.writeFeatures and
+    // denoises frameBuffer with settings.denoise
+    bool postProcessFrame(const char* filename, int width, int height, std::vector<unsigned char>& frameBuffer);
+
 public:
+    static const int MAX_TRACE_DEPTH = 16;     // Upper limit of settings.maxDepth
+
     Scene(const Camera& cam = Camera());
 
     void addShape(std::shared_ptr<Shape> shape) {
+        materializeShapes();
         shapes.push_back(shape);
+        accelerationDirty = true;
+    }
+
+    size_t getShapeCount() const {
+        return shapesPending ? compiled.getShapeCount() : shapes.size();
+    }
+
+    // Shape at the given index, in the order shapes were added. Shapes may be
+    // moved through setModelMatrix; call markShapesMoved afterwards.
+    std::shared_ptr<Shape> getShape(size_t index) {
+        materializeShapes();
+        return shapes[index];
+    }
+
+    // Notes that shapes were moved, so the next render refits the BVH to their
+    // new transforms instead of rebuilding it
+    void markShapesMoved() {
+        if (!accelerationDirty) {
+            transformsDirty = true;
+        }
     }
 
     void addLight(std::shared_ptr<Light> light) {
         lights.push_back(light);
     }
 
+    const std::vector<std::shared_ptr<Light>>& getLights() const { return lights; }
+
+    // Replaces the shapes with a scene compiled earlier, e.g. one loaded from a
+    // cache, so rendering can start without a build. The shape list is only
+    // recreated from it if more shapes are added.
+    void setCompiledScene(CompiledScene&& compiledScene);
+
     void setCamera(const Camera& cam) {
         camera = cam;
     }
 
     Camera& getCamera() { return camera; }
+    const Camera& getCamera() const { return camera; }
+
+    void setRenderSettings(const RenderSettings& renderSettings) {
+        settings = renderSettings;
+    }
+
+    const RenderSettings& getRenderSettings() const { return settings; }
+
+    // Compiles the current shapes into per-type pools and builds the BVH over them.
+    // Called automatically before rendering when shapes have changed.
+    void build();
+
+    // True when shapes changed since the last build
+    bool needsBuild() const { return accelerationDirty; }
+
+    // Brings the BVH up to date after markShapesMoved. Refits it in place, or
+    // rebuilds it if refitting pushed its SAH cost above settings.refitThreshold
+    // times its cost when built. Returns true if it rebuilt. Called automatically
+    // before rendering.
+    bool refit();
+
+    // Writes BVH build statistics and the ray counters of the last render
+    void printStats(std::ostream& out) const;
+
+    // Counters and timing of the last render
+    RenderStats getRenderStats() const;
+    TraversalStats getTraversalStats() const;
+    double getLastRenderSeconds() const;
+    uint64_t getLastSampleCount() const;
+
+    // Seconds spent on each pixel of the last render, row-major. Empty unless
+    // settings.recordPixelCost was set; see write_cost_heatmap.
+    const std::vector<float>& getPixelCost() const { return pixelCost; }
+
+    const CompiledScene& getCompiledScene() const { return compiled; }
+
+    // Materials referenced by hit records, one entry per distinct material (valid after build)
+    const std::vector<Material>& getMaterials() const { return compiled.getMaterials(); }
 
     // Finds the closest intersection with any shape for a given ray
     Intersection findClosestIntersection(const Ray& ray) const;
 
-    // Renders the scene to a PNG file
+    // Colour seen along a camera ray, including shadows and reflections.
+    // The scene must have been built.
+    glm::vec3 shadeRay(const Ray& ray) const;
+
+    // Returns true if any shape lies along the ray within maxDistance.
+    // Stops at the first blocker instead of searching for the closest hit.
+    bool occluded(const Ray& ray, float maxDistance) const;
+
+    // Renders the scene into an RGB frame buffer of width * height * 3 bytes
+    void renderFrame(int width, int height, std::vector<unsigned char>& frameBuffer);
+
+    // Renders coarse to fine for previews, one sample per pixel. The first pass
+    // renders one pixel per settings.progressiveBlock block and fills the block
+    // with it; every further pass halves the spacing, rendering only the pixels
+    // not rendered yet, until every pixel has been rendered. onFrame, when given,
+    // is called after each pass. Once settings.deadlineSeconds have passed since
+    // the call, no more tiles are started and frameBuffer keeps the best image
+    // reached, parts of it possibly one pass finer than the rest. Returns true if
+    // every pixel was rendered, in which case the image matches renderFrame
+    // without anti-aliasing.
+    bool renderProgressive(int width, int height, std::vector<unsigned char>& frameBuffer,
+                           const FrameCallback& onFrame = nullptr);
+
+    // Callback renderToPNG hands to renderProgressive when settings.progressiveBlock is set
+    void setFrameCallback(const FrameCallback& callback) { frameCallback = callback; }
+
+    // Renders one tile of a width x height frame on the calling thread, for callers
+    // that schedule tiles themselves such as worker processes. out must cover the
+    // tile's rows. Pixels match those of a full render: anti-aliased tiles also take
+    // base samples in a one-pixel border so edge pixels see their neighbours.
+    // Counters are added to getRenderStats without resetting them.
+    void renderSingleTile(const Tile& tile, int width, int height, const ImageRows& out);
+
+    // Renders the tiles of a width x height frame that checkpoint does not have yet
+    // into its mapped pixels, marking each done as it finishes. Tiles are rendered
+    // as renderSingleTile renders them, so the image matches renderFrame however
+    // many times the render was interrupted and resumed.
+    void renderToCheckpoint(int width, int height, FrameCheckpoint& checkpoint);
+
+    // renderToPNG through a FrameCheckpoint at checkpointPath: resumes the tiles
+    // an interrupted render of the same frame left there, renders the rest, then
+    // encodes the image straight from the mapped file and deletes it. The frame is
+    // never copied into memory, so it may be larger than RAM. Denoising, feature
+    // buffers and progressive rendering are not available this way.
+    bool renderToCheckpointedPNG(const char* filename, int width, int height, const std::string& checkpointPath,
+                                 std::string& error);
+
+    // Fills features with the first surface each pixel's camera ray hits, one ray
+    // through each pixel's corner as in a render without anti-aliasing. The rays
+    // are not added to the render counters.
+    void renderFeatures(int width, int height, FeatureBuffers& features);
+
+    // Renders the scene to an image file in settings.imageFormat, PNG by default.
+    // With settings.streamOutput a libpng image is encoded band by band while
+    // rendering continues, so only a few bands of pixels are held in memory at once.
+    // Denoising or writing feature buffers needs the whole frame and turns streaming
+    // off, as does progressive rendering, which goes through renderProgressive. An
+    // anti-aliased frame is never rendered progressively, as passes take one sample
+    // per pixel.
     bool renderToPNG(const char* filename, int width, int height);
 
+    // Surfaces a path may reach: settings.maxDepth, clamped to [1, MAX_TRACE_DEPTH]
+    int getMaxDepth() const { return std::min(std::max(settings.maxDepth, 1), MAX_TRACE_DEPTH); }
+
+    // Decides how a path continues at a surface with the given material at
+    // position, hit at depth (0 for camera hits). throughput is the share of the
+    // pixel the surface's colour makes up, 1 at the camera hit, and is updated to
+    // that of the reflection when it is traced.
+    ReflectionStep continuePath(const Material& material, const glm::vec3& position, int depth, float& throughput) const;
+
     // Calculate total lighting at a point
     glm::vec3 calculateLighting(const glm::vec3& point, const glm::vec3& normal, const Material& material) const;
+
+    // The terms calculateLighting adds up: ambient light, and the contribution
+    // of a light that reaches the point unblocked from lightDir at lightDistance
+    glm::vec3 ambientLighting(const Material& material) const;
+    glm::vec3 directLighting(const Light& light, const glm::vec3& lightDir, float lightDistance,
+                             const glm::vec3& point, const glm::vec3& normal, const Material& material) const;
+
+    // Returns the worker pool for the configured thread count, or nullptr for a serial render
+    ThreadPool* getThreadPool();
 }; 
\ No newline at end of file
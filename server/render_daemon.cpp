@@ -0,0 +1,541 @@
+#include "render_daemon.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "../scene.h"
+#include "../io/scene_file.h"
+#include "../io/scene_cache.h"
+#include "../render/adaptive_sampler.h"
+
+static bool parseInt(const std::string& text, int& value) {
+    char* end = nullptr;
+    long parsed = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0') return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+static bool parseFloat(const std::string& text, float& value) {
+    char* end = nullptr;
+    value = std::strtof(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+static bool parseVector(const std::string& text, glm::vec3& value) {
+    std::istringstream in(text);
+    std::string part;
+    for (int i = 0; i < 3; ++i) {
+        if (!std::getline(in, part, ',') || !parseFloat(part, value[i])) return false;
+    }
+    return !std::getline(in, part, ',');
+}
+
+// Modification time in nanoseconds, or -1 if the file is missing
+static int64_t fileTime(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return -1;
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+// File times of a scene and the meshes it loads, which its images depend on
+static std::string filesVersion(int64_t sceneTime, const std::vector<std::string>& meshFiles) {
+    std::string version = std::to_string(sceneTime);
+    for (const std::string& mesh : meshFiles) {
+        version += '|' + std::to_string(fileTime(mesh));
+    }
+    return version;
+}
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static bool writeLine(int fd, const std::string& line) {
+    return writeAll(fd, line.data(), line.size()) && writeAll(fd, "\n", 1);
+}
+
+std::string RenderRequest::key() const {
+    // Nine digits tell any two floats apart, so distinct views never share an entry
+    std::ostringstream out;
+    out << std::setprecision(9) << scene << '|' << width << 'x' << height << '|' << image_format_extension(format)
+        << static_cast<int>(format) << '|' << samplesPerPixel << ',' << maxSamplesPerPixel << '|' << fieldOfView
+        << '|' << deadlineMilliseconds;
+    if (hasPosition) out << "|p" << position.x << ',' << position.y << ',' << position.z;
+    if (hasDirection) out << "|d" << direction.x << ',' << direction.y << ',' << direction.z;
+    return out.str();
+}
+
+bool parse_render_request(const std::string& words, RenderRequest& request, std::string& error) {
+    std::istringstream in(words);
+    std::string word;
+    while (in >> word) {
+        size_t equals = word.find('=');
+        if (equals == std::string::npos) {
+            error = "expected key=value, got " + word;
+            return false;
+        }
+        std::string key = word.substr(0, equals);
+        std::string value = word.substr(equals + 1);
+
+        bool valid = true;
+        if (key == "scene") {
+            request.scene = value;
+        } else if (key == "width") {
+            valid = parseInt(value, request.width) && request.width > 0 && request.width <= 16384;
+        } else if (key == "height") {
+            valid = parseInt(value, request.height) && request.height > 0 && request.height <= 16384;
+        } else if (key == "format") {
+            valid = parse_image_format(value, request.format);
+        } else if (key == "position") {
+            valid = request.hasPosition = parseVector(value, request.position);
+        } else if (key == "direction") {
+            valid = request.hasDirection = parseVector(value, request.direction) && glm::length(request.direction) > 0.0f;
+        } else if (key == "fov") {
+            valid = parseFloat(value, request.fieldOfView) && request.fieldOfView > 0.0f && request.fieldOfView < 180.0f;
+        } else if (key == "spp") {
+            valid = parseInt(value, request.samplesPerPixel) && request.samplesPerPixel > 0;
+        } else if (key == "max-spp") {
+            valid = parseInt(value, request.maxSamplesPerPixel) && request.maxSamplesPerPixel > 0;
+        } else if (key == "deadline") {
+            valid = parseInt(value, request.deadlineMilliseconds) && request.deadlineMilliseconds > 0;
+        } else {
+            error = "unknown key " + key;
+            return false;
+        }
+        if (!valid) {
+            error = "bad value for " + key + ": " + value;
+            return false;
+        }
+    }
+    if (request.scene.empty()) {
+        error = "missing scene";
+        return false;
+    }
+    if (request.deadlineMilliseconds > 0 && (request.samplesPerPixel > 1 || request.maxSamplesPerPixel > 1)) {
+        error = "deadline renders take one sample per pixel, drop spp and max-spp";
+        return false;
+    }
+    return true;
+}
+
+RenderDaemon::RenderDaemon(const DaemonSettings& settings)
+    : settings(settings)
+{}
+
+RenderDaemon::~RenderDaemon() {
+    stop();
+    for (std::thread& thread : renderThreads) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+std::shared_ptr<RenderDaemon::SceneEntry> RenderDaemon::acquireScene(const std::string& path, std::unique_lock<std::mutex>& lock,
+                                                                   std::string& error) {
+    std::shared_ptr<SceneEntry> entry;
+    {
+        std::lock_guard<std::mutex> guard(scenesMutex);
+        std::shared_ptr<SceneEntry>& slot = scenes[path];
+        if (!slot) slot = std::make_shared<SceneEntry>();
+        entry = slot;
+        entry->lastUsed = ++useCounter;
+
+        // Drop the least recently used scenes nobody is rendering
+        while (scenes.size() > static_cast<size_t>(std::max(settings.maxScenes, 1))) {
+            auto oldest = scenes.end();
+            for (auto it = scenes.begin(); it != scenes.end(); ++it) {
+                if (it->second.use_count() == 1 && (oldest == scenes.end() || it->second->lastUsed < oldest->second->lastUsed)) {
+                    oldest = it;
+                }
+            }
+            if (oldest == scenes.end()) break;
+            scenes.erase(oldest);
+        }
+    }
+
+    lock = std::unique_lock<std::mutex>(entry->mutex);
+    int64_t sceneTime = fileTime(path);
+    if (entry->scene && entry->version == filesVersion(sceneTime, entry->meshFiles)) {
+        return entry;
+    }
+
+    // First use, or the scene or one of its meshes changed on disk since it was loaded
+    entry->scene.reset(new Scene());
+    entry->scene->setRenderSettings(settings.renderSettings);
+    std::vector<std::string> meshFiles;
+    bool loaded = is_scene_cache(path.c_str()) ? load_scene_cache(path.c_str(), *entry->scene, error)
+                                               : load_scene(path.c_str(), *entry->scene, error, nullptr, &meshFiles);
+    entry->version = filesVersion(sceneTime, meshFiles);
+    {
+        std::lock_guard<std::mutex> guard(scenesMutex);
+        entry->meshFiles = std::move(meshFiles);
+    }
+    if (!loaded) {
+        entry->scene.reset();
+        lock.unlock();
+        std::lock_guard<std::mutex> guard(scenesMutex);
+        auto it = scenes.find(path);
+        if (it != scenes.end() && it->second == entry) scenes.erase(it);
+        return nullptr;
+    }
+    entry->camera = entry->scene->getCamera();
+
+    // Build now so the BVH is resident before the first frame is timed
+    entry->scene->build();
+    std::lock_guard<std::mutex> guard(statsMutex);
+    stats.sceneLoads++;
+    return entry;
+}
+
+bool RenderDaemon::renderUncached(const RenderRequest& request, std::vector<unsigned char>& image, bool& complete,
+                                  std::string& sceneVersion, std::string& error) {
+    std::unique_lock<std::mutex> lock;
+    std::shared_ptr<SceneEntry> entry = acquireScene(request.scene, lock, error);
+    if (!entry) {
+        return false;
+    }
+    Scene& scene = *entry->scene;
+    sceneVersion = entry->version;
+
+    // Every request starts from the scene as loaded, so earlier overrides do not leak into it
+    Camera camera = entry->camera;
+    if (request.hasPosition) camera.setPosition(request.position);
+    if (request.hasDirection) camera.setDirection(request.direction);
+    if (request.fieldOfView > 0.0f) camera.setFieldOfView(request.fieldOfView);
+    scene.setCamera(camera);
+
+    RenderSettings renderSettings = settings.renderSettings;
+    if (request.samplesPerPixel > 0) renderSettings.samplesPerPixel = request.samplesPerPixel;
+    if (request.maxSamplesPerPixel > 0) renderSettings.maxSamplesPerPixel = request.maxSamplesPerPixel;
+    renderSettings.maxSamplesPerPixel = std::max(renderSettings.maxSamplesPerPixel, renderSettings.samplesPerPixel);
+    renderSettings.imageFormat = request.format;
+    if (request.deadlineMilliseconds > 0) {
+        renderSettings.deadlineSeconds = request.deadlineMilliseconds / 1000.0;
+        renderSettings.progressiveBlock = std::max(renderSettings.progressiveBlock, 8);
+    }
+    // The daemon's own settings may anti-alias; progressive passes cannot
+    if (renderSettings.progressiveBlock > 1 && AdaptiveSampler::isEnabled(renderSettings)) {
+        error = "progressive and deadline renders take one sample per pixel, but spp or max-spp is above 1";
+        return false;
+    }
+    scene.setRenderSettings(renderSettings);
+
+    std::vector<unsigned char> frameBuffer;
+    complete = true;
+    if (renderSettings.progressiveBlock > 1) {
+        complete = scene.renderProgressive(request.width, request.height, frameBuffer);
+    } else {
+        scene.renderFrame(request.width, request.height, frameBuffer);
+    }
+
+    image.clear();
+    std::unique_ptr<ImageEncoder> encoder = make_image_encoder(request.format, renderSettings.pngOptions, scene.getThreadPool());
+    if (!encoder->encode(request.width, request.height, frameBuffer, image)) {
+        error = "failed to encode image";
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const std::vector<unsigned char>> RenderDaemon::findCached(const std::string& key) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cacheIndex.find(key);
+    if (it == cacheIndex.end()) {
+        return nullptr;
+    }
+    cacheOrder.splice(cacheOrder.end(), cacheOrder, it->second);
+    return it->second->second;
+}
+
+void RenderDaemon::storeCached(const std::string& key, std::vector<unsigned char> image) {
+    if (image.size() > settings.cacheBytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cacheIndex.count(key)) {
+        return;
+    }
+    cachedBytes += image.size();
+    cacheOrder.emplace_back(key, std::make_shared<const std::vector<unsigned char>>(std::move(image)));
+    cacheIndex[key] = std::prev(cacheOrder.end());
+    while (cachedBytes > settings.cacheBytes) {
+        cachedBytes -= cacheOrder.front().second->size();
+        cacheIndex.erase(cacheOrder.front().first);
+        cacheOrder.pop_front();
+    }
+}
+
+// File times are part of the key, so editing a scene or its meshes invalidates
+// its images. Meshes are only known once the scene is resident; until then the
+// key matches nothing stored, as stored keys of mesh scenes list their meshes.
+std::string RenderDaemon::cacheKey(const RenderRequest& request) {
+    std::vector<std::string> meshFiles;
+    {
+        std::lock_guard<std::mutex> lock(scenesMutex);
+        auto it = scenes.find(request.scene);
+        if (it != scenes.end()) meshFiles = it->second->meshFiles;
+    }
+    return request.key() + '|' + filesVersion(fileTime(request.scene), meshFiles);
+}
+
+bool RenderDaemon::render(const RenderRequest& request, std::vector<unsigned char>& image, bool& cached, std::string& error) {
+    std::string key = cacheKey(request);
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.requests++;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> hit = findCached(key);
+    cached = hit != nullptr;
+    if (cached) {
+        image = *hit;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.cacheHits++;
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool complete = false;
+    std::string sceneVersion;
+    bool rendered = renderUncached(request, image, complete, sceneVersion, error);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (rendered && complete) {
+        // Stored under the files the image was rendered from, which a reload may have changed
+        storeCached(request.key() + '|' + sceneVersion, image);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (rendered) {
+        stats.rendered++;
+        stats.renderSeconds += seconds;
+        if (!complete) stats.cutShort++;
+    } else {
+        stats.failed++;
+    }
+    return rendered;
+}
+
+bool RenderDaemon::submit(const RenderRequest& request, std::vector<unsigned char>& image, bool& cached, std::string& error) {
+    // Cached images are answered without waiting for a render slot; identical
+    // requests queued behind a render still find its image when their turn comes
+    std::shared_ptr<const std::vector<unsigned char>> hit = findCached(cacheKey(request));
+    if (hit) {
+        image = *hit;
+        cached = true;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.requests++;
+        stats.cacheHits++;
+        return true;
+    }
+
+    Job job;
+    job.request = request;
+    job.image = &image;
+    job.cached = &cached;
+    job.error = &error;
+    std::future<bool> done = job.done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (stopping || queue.size() >= static_cast<size_t>(std::max(settings.maxQueuedRequests, 0))) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.requests++;
+            stats.rejected++;
+            error = stopping ? "shutting down" : "busy";
+            return false;
+        }
+        queue.push_back(&job);
+    }
+    queueChanged.notify_one();
+    return done.get();
+}
+
+void RenderDaemon::renderLoop() {
+    for (;;) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+        }
+        job->done.set_value(render(job->request, *job->image, *job->cached, *job->error));
+    }
+}
+
+void RenderDaemon::serveConnection(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    bool open = true;
+    while (open && !stopping) {
+        size_t newline = buffer.find('\n');
+        if (newline == std::string::npos) {
+            // Wake up now and then so a stopping daemon does not wait on idle clients
+            pollfd readable{fd, POLLIN, 0};
+            int ready = poll(&readable, 1, 200);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready <= 0) continue;
+            ssize_t got = ::read(fd, chunk, sizeof(chunk));
+            if (got <= 0) break;
+            buffer.append(chunk, static_cast<size_t>(got));
+            if (buffer.size() > 64 * 1024) {
+                writeLine(fd, "error request too long");
+                break;
+            }
+            continue;
+        }
+
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+
+        if (command.empty()) {
+            continue;
+        } else if (command == "render") {
+            std::string rest;
+            std::getline(words, rest);
+            RenderRequest request;
+            std::vector<unsigned char> image;
+            bool cached = false;
+            std::string error;
+            auto start = std::chrono::steady_clock::now();
+            if (!parse_render_request(rest, request, error) || !submit(request, image, cached, error)) {
+                open = writeLine(fd, "error " + error);
+                continue;
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::ostringstream header;
+            header << "ok " << image.size() << ' ' << (cached ? 1 : 0) << ' ' << milliseconds;
+            open = writeLine(fd, header.str()) && writeAll(fd, image.data(), image.size());
+        } else if (command == "stats") {
+            DaemonStats current = getStats();
+            std::ostringstream out;
+            out << "stats requests=" << current.requests << " cache_hits=" << current.cacheHits
+                << " rendered=" << current.rendered << " rejected=" << current.rejected
+                << " failed=" << current.failed << " cut_short=" << current.cutShort
+                << " scene_loads=" << current.sceneLoads
+                << " render_seconds=" << current.renderSeconds;
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                out << " cached_images=" << cacheOrder.size() << " cached_bytes=" << cachedBytes;
+            }
+            {
+                std::lock_guard<std::mutex> lock(scenesMutex);
+                out << " scenes=" << scenes.size();
+            }
+            open = writeLine(fd, out.str());
+        } else if (command == "shutdown") {
+            writeLine(fd, "ok shutting down");
+            stop();
+            open = false;
+        } else {
+            open = writeLine(fd, "error unknown command " + command);
+        }
+    }
+
+    // Erased before closing, so the accept loop cannot reuse the number while it is still listed
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    connections.erase(fd);
+    close(fd);
+    connectionsChanged.notify_all();
+}
+
+bool RenderDaemon::run(std::string& error) {
+    if (settings.socketPath.empty() || settings.socketPath.size() >= sizeof(sockaddr_un::sun_path)) {
+        error = "invalid socket path " + settings.socketPath;
+        return false;
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        error = "socket failed";
+        return false;
+    }
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, settings.socketPath.c_str());
+    unlink(settings.socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+        error = settings.socketPath + ": " + std::strerror(errno);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    for (int i = 0; i < std::max(settings.maxConcurrentRenders, 1); ++i) {
+        renderThreads.emplace_back(&RenderDaemon::renderLoop, this);
+    }
+
+    while (!stopping) {
+        pollfd readable{listenFd, POLLIN, 0};
+        int ready = poll(&readable, 1, 200);
+        if (ready < 0 && errno != EINTR) {
+            error = "poll failed";
+            break;
+        }
+        if (ready <= 0) continue;
+
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        std::unique_lock<std::mutex> lock(connectionsMutex);
+        if (connections.size() >= static_cast<size_t>(std::max(settings.maxConnections, 1))) {
+            lock.unlock();
+            writeLine(fd, "error too many connections");
+            close(fd);
+            continue;
+        }
+        connections.insert(fd);
+        std::thread(&RenderDaemon::serveConnection, this, fd).detach();
+    }
+
+    // Queued renders are still finished; connections notice stopping within a poll interval
+    stop();
+    for (std::thread& thread : renderThreads) {
+        thread.join();
+    }
+    renderThreads.clear();
+    {
+        std::unique_lock<std::mutex> lock(connectionsMutex);
+        connectionsChanged.wait(lock, [this] { return connections.empty(); });
+    }
+    close(listenFd);
+    listenFd = -1;
+    unlink(settings.socketPath.c_str());
+    return error.empty();
+}
+
+void RenderDaemon::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+}
+
+DaemonStats RenderDaemon::getStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../camera.h"
+#include "../render_settings.h"
+
+class Scene;
+
+// One render request as sent to the daemon. Unset overrides keep what the
+// scene file says.
+struct RenderRequest {
+    std::string scene;          // Scene file or scene cache path
+    int width = 800;
+    int height = 600;
+    ImageFormat format = ImageFormat::Png;
+    bool hasPosition = false;
+    glm::vec3 position;
+    bool hasDirection = false;
+    glm::vec3 direction;
+    float fieldOfView = 0.0f;   // 0 keeps the scene's
+    int samplesPerPixel = 0;    // 0 keeps the daemon's render settings
+    int maxSamplesPerPixel = 0;
+    int deadlineMilliseconds = 0;   // Above 0, render progressively and stop refining after this long
+
+    // Canonical form of every field, for recognising identical requests
+    std::string key() const;
+};
+
+// Parses the key=value words of a render line, e.g.
+//   scene=scenes/default.scene width=320 height=240 format=ppm position=0,4,10 direction=0,-0.3,-1 fov=45 spp=4
+// or, for a preview that is answered within about 50 ms whatever the scene,
+//   scene=scenes/default.scene deadline=50
+bool parse_render_request(const std::string& words, RenderRequest& request, std::string& error);
+
+struct DaemonSettings {
+    std::string socketPath;
+    int maxConcurrentRenders;   // Renders in flight at once; each uses its scene's worker pool
+    int maxQueuedRequests;      // Requests waiting for a render slot before new ones are refused
+    int maxConnections;
+    int maxScenes;              // Scenes kept loaded, least recently used ones are dropped first
+    size_t cacheBytes;          // Encoded images kept for repeated requests
+    RenderSettings renderSettings;
+
+    DaemonSettings()
+        : maxConcurrentRenders(2)
+        , maxQueuedRequests(64)
+        , maxConnections(64)
+        , maxScenes(8)
+        , cacheBytes(64 * 1024 * 1024)
+    {
+        renderSettings.showProgress = false;
+    }
+};
+
+struct DaemonStats {
+    uint64_t requests = 0;
+    uint64_t cacheHits = 0;
+    uint64_t rendered = 0;
+    uint64_t rejected = 0;      // Refused because the queue was full
+    uint64_t failed = 0;
+    uint64_t cutShort = 0;      // Progressive renders stopped by their deadline, which are not cached
+    uint64_t sceneLoads = 0;
+    double renderSeconds = 0.0; // Summed over rendered requests, including encoding
+};
+
+// Long-lived render server. Scenes are loaded on first use and stay resident
+// with their BVH and worker threads, so a request only pays for rendering and
+// encoding; identical requests are answered from a cache of encoded images.
+//
+// Clients connect to a Unix socket and send one request per line:
+//   render <key=value words, see parse_render_request>
+//   stats
+//   shutdown
+// A render is answered with "ok <bytes> <cached 0|1> <milliseconds>\n" followed
+// by the encoded image, anything else with a single text line; errors are
+// "error <message>\n". A connection may send any number of requests.
+class RenderDaemon {
+private:
+    // A resident scene. Renders change its camera and settings, so they take turns.
+    struct SceneEntry {
+        std::mutex mutex;
+        std::unique_ptr<Scene> scene;
+        Camera camera;              // As loaded, before any request's overrides
+        std::string version;        // File times of the scene and its meshes when loaded
+        std::vector<std::string> meshFiles;     // OBJ files the scene loaded; changed under both mutexes
+        uint64_t lastUsed = 0;
+    };
+
+    struct Job {
+        RenderRequest request;
+        std::promise<bool> done;
+        std::vector<unsigned char>* image;
+        bool* cached;
+        std::string* error;
+    };
+
+    DaemonSettings settings;
+
+    std::mutex scenesMutex;
+    std::map<std::string, std::shared_ptr<SceneEntry>> scenes;
+    uint64_t useCounter = 0;
+
+    // Least recently used entries at the front
+    std::mutex cacheMutex;
+    std::list<std::pair<std::string, std::shared_ptr<const std::vector<unsigned char>>>> cacheOrder;
+    std::unordered_map<std::string, decltype(cacheOrder)::iterator> cacheIndex;
+    size_t cachedBytes = 0;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<Job*> queue;
+    std::vector<std::thread> renderThreads;
+
+    std::mutex connectionsMutex;
+    std::condition_variable connectionsChanged;
+    std::set<int> connections;
+
+    mutable std::mutex statsMutex;
+    DaemonStats stats;
+
+    std::atomic<bool> stopping{false};
+    int listenFd = -1;
+
+    // Loads or reloads the scene of a path and returns it locked, or nullptr if it cannot be loaded
+    std::shared_ptr<SceneEntry> acquireScene(const std::string& path, std::unique_lock<std::mutex>& lock, std::string& error);
+
+    // Renders and encodes a request. complete is false if a deadline stopped it short of every pixel.
+    // sceneVersion receives the file times of the scene the image was rendered from.
+    bool renderUncached(const RenderRequest& request, std::vector<unsigned char>& image, bool& complete,
+                        std::string& sceneVersion, std::string& error);
+
+    // Image cache key of a request, including the current file times of its scene
+    // and of the meshes the resident copy loaded
+    std::string cacheKey(const RenderRequest& request);
+
+    std::shared_ptr<const std::vector<unsigned char>> findCached(const std::string& key);
+    void storeCached(const std::string& key, std::vector<unsigned char> image);
+
+    void renderLoop();
+    void serveConnection(int fd);
+
+    // Queues a render for the render threads and waits for it. Fails at once if the queue is full.
+    bool submit(const RenderRequest& request, std::vector<unsigned char>& image, bool& cached, std::string& error);
+
+public:
+    explicit RenderDaemon(const DaemonSettings& settings);
+    ~RenderDaemon();
+
+    RenderDaemon(const RenderDaemon&) = delete;
+    RenderDaemon& operator=(const RenderDaemon&) = delete;
+
+    // Renders a request in the calling thread, through the cache. cached tells
+    // whether the image came from it.
+    bool render(const RenderRequest& request, std::vector<unsigned char>& image, bool& cached, std::string& error);
+
+    // Listens on settings.socketPath and serves clients until stop() or a
+    // shutdown request
+    bool run(std::string& error);
+
+    void stop();
+
+    DaemonStats getStats() const;
+};
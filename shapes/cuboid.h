@@ -12,12 +12,25 @@ public:
         , dimensions(dims)
     {
         // Scale the model matrix by the dimensions
-        transform.modelMatrix = glm::scale(transform.modelMatrix, dimensions);
+        setModelMatrix(glm::scale(transform.modelMatrix, dimensions));
     }
 
     Intersection intersect(const Ray& worldRay) const override {
+        float worldDist;
+        glm::vec3 worldNormal;
+        if (!intersectKernel(worldRay, transform.modelMatrix, worldToObject, worldDist, worldNormal)) {
+            return Intersection();
+        }
+        return Intersection(worldDist, material, worldNormal);
+    }
+
+    // Intersection routines shared with the compiled scene. The dimensions are baked
+    // into the model matrix, so object space is always a unit cube. hitDistance finds
+    // the world-space distance and object-space hit point, normalAt the world normal.
+    static bool hitDistance(const Ray& worldRay, const glm::mat4& objectToWorld, const glm::mat4& worldToObject,
+                            float& worldDist, glm::vec3& objectHitPoint) {
         // Transform ray to object space
-        Ray objectRay = transformRayToObjectSpace(worldRay);
+        Ray objectRay = transformRay(worldRay, worldToObject);
         
         // Calculate intersection with axis-aligned box in object space
         glm::vec3 invDir = 1.0f / objectRay.getDirection();
@@ -35,17 +48,23 @@ public:
 
         // If tmax < 0, ray is intersecting box, but box is behind ray's origin
         if (tmax < 0) {
-            return Intersection();
+            return false;
         }
 
         // If tmin > tmax, ray doesn't intersect box
         if (tmin > tmax) {
-            return Intersection();
+            return false;
         }
 
-        // Calculate hit point in object space
-        glm::vec3 objectHitPoint = objectRay.at(tmin);
+        // Calculate hit point in object space and its distance in world space
+        objectHitPoint = objectRay.at(tmin);
+        glm::vec3 worldHitPoint = Transform::transformPoint(objectHitPoint, objectToWorld);
         
+        worldDist = glm::length(worldHitPoint - worldRay.getOrigin());
+        return true;
+    }
+
+    static glm::vec3 normalAt(const glm::vec3& objectHitPoint, const glm::mat4& objectToWorld) {
         // Calculate normal based on which face was hit
         glm::vec3 objectNormal(0.0f);
         float epsilon = 0.0001f; // To handle floating point precision issues
@@ -58,13 +77,24 @@ public:
         else if (std::abs(objectHitPoint.z - 0.5f) < epsilon) objectNormal = glm::vec3(0, 0, 1);
         else if (std::abs(objectHitPoint.z + 0.5f) < epsilon) objectNormal = glm::vec3(0, 0, -1);
 
-        // Transform intersection point and normal to world space
-        glm::vec3 worldHitPoint = Transform::transformPoint(objectHitPoint, transform.modelMatrix);
-        glm::vec3 worldNormal = glm::normalize(Transform::transformDirection(objectNormal, transform.modelMatrix));
-        
-        float worldDist = glm::length(worldHitPoint - worldRay.getOrigin());
-        return Intersection(worldDist, material, worldNormal);
+        // Transform normal to world space
+        return glm::normalize(Transform::transformDirection(objectNormal, objectToWorld));
+    }
+
+    static bool intersectKernel(const Ray& worldRay, const glm::mat4& objectToWorld, const glm::mat4& worldToObject,
+                                float& worldDist, glm::vec3& worldNormal) {
+        glm::vec3 objectHitPoint;
+        if (!hitDistance(worldRay, objectToWorld, worldToObject, worldDist, objectHitPoint)) {
+            return false;
+        }
+        worldNormal = normalAt(objectHitPoint, objectToWorld);
+        return true;
+    }
+
+    AABB getBounds() const override {
+        // The model matrix already includes the dimensions, so object space is a unit cube
+        return AABB(glm::vec3(-0.5f), glm::vec3(0.5f)).transformed(transform.modelMatrix);
     }
 
     glm::vec3 getDimensions() const { return dimensions; }
-}; 
\ No newline at end of file
+};
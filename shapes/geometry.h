@@ -0,0 +1,40 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include "../ray.h"
+#include "../accel/aabb.h"
+
+class Fingerprint;
+
+// Closest hit on a piece of geometry, in its object space
+struct GeometryHit {
+    float t;            // Distance along the ray that was passed in
+    uint32_t element;   // Part that was hit, e.g. a triangle
+    float u, v;         // Position on that element, e.g. barycentric weights
+};
+
+// Object-space geometry that can be shared by any number of instances, each
+// placing it with its own transform and material. This is the bottom level of
+// the two-level hierarchy; implementations carry their own acceleration structure.
+class Geometry {
+public:
+    virtual ~Geometry() = default;
+
+    // Closest hit with 0 < t < tMax
+    virtual bool intersect(const Ray& objectRay, float tMax, GeometryHit& hit) const = 0;
+
+    // Any hit with 0 < t < tMax
+    virtual bool occluded(const Ray& objectRay, float tMax) const = 0;
+
+    // Object-space normal at a hit returned by intersect
+    virtual glm::vec3 normalAt(const GeometryHit& hit) const = 0;
+
+    virtual AABB getBounds() const = 0;
+
+    // Approximate heap memory held by the geometry and its hierarchy
+    virtual size_t getMemoryBytes() const = 0;
+
+    // Adds everything the geometry's hits depend on, so any edit changes the fingerprint
+    virtual void addToFingerprint(Fingerprint& fingerprint) const = 0;
+};
@@ -0,0 +1,55 @@
+#include "instance.h"
+#include <limits>
+#include <utility>
+
+Instance::Instance(std::shared_ptr<const Geometry> sharedGeometry, const glm::mat4& objectToWorld, const Material& mat)
+    : Shape(glm::vec3(0.0f), mat)
+    , geometry(std::move(sharedGeometry))
+{
+    setModelMatrix(objectToWorld);
+}
+
+bool Instance::hitDistance(const Geometry& geometry, const Ray& worldRay, const glm::mat4& worldToObject,
+                           float maxWorldDist, float& worldDist, GeometryHit& hit) {
+    // The object-space ray is renormalised, so distances are rescaled both ways. The
+    // bound is widened a little so rounding never drops a hit the caller would keep;
+    // the caller makes the exact comparison in world space.
+    Ray objectRay = transformRay(worldRay, worldToObject);
+    float objectPerWorld = glm::length(Transform::transformDirection(worldRay.getDirection(), worldToObject));
+    if (!geometry.intersect(objectRay, maxWorldDist * objectPerWorld * (1.0f + 1e-5f), hit)) {
+        return false;
+    }
+    worldDist = hit.t / objectPerWorld;
+    return true;
+}
+
+glm::vec3 Instance::normalAt(const Geometry& geometry, const GeometryHit& hit, const glm::mat4& worldToObject,
+                             const glm::vec3& worldDirection) {
+    // Normals go to world space with the inverse transpose, and face the incoming ray
+    glm::vec3 objectNormal = geometry.normalAt(hit);
+    glm::vec3 worldNormal = glm::normalize(glm::vec3(glm::transpose(worldToObject) * glm::vec4(objectNormal, 0.0f)));
+    if (glm::dot(worldNormal, worldDirection) > 0.0f) {
+        worldNormal = -worldNormal;
+    }
+    return worldNormal;
+}
+
+bool Instance::occludedKernel(const Geometry& geometry, const Ray& worldRay, const glm::mat4& worldToObject,
+                              float maxWorldDist) {
+    Ray objectRay = transformRay(worldRay, worldToObject);
+    float objectPerWorld = glm::length(Transform::transformDirection(worldRay.getDirection(), worldToObject));
+    return geometry.occluded(objectRay, maxWorldDist * objectPerWorld);
+}
+
+Intersection Instance::intersect(const Ray& worldRay) const {
+    float worldDist;
+    GeometryHit hit;
+    if (!hitDistance(*geometry, worldRay, worldToObject, std::numeric_limits<float>::infinity(), worldDist, hit)) {
+        return Intersection();
+    }
+    return Intersection(worldDist, material, normalAt(*geometry, hit, worldToObject, worldRay.getDirection()));
+}
+
+AABB Instance::getBounds() const {
+    return geometry->getBounds().transformed(transform.modelMatrix);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <memory>
+#include "shape.h"
+#include "geometry.h"
+
+// Shape that places shared geometry in the scene. Many instances can point at
+// one Geometry, each with its own object-to-world transform and material, so
+// memory grows with the number of distinct geometries, not with the instances.
+// Rays are taken to object space with the instance's cached inverse transform.
+class Instance : public Shape {
+protected:
+    std::shared_ptr<const Geometry> geometry;
+
+public:
+    Instance(std::shared_ptr<const Geometry> sharedGeometry, const glm::mat4& objectToWorld, const Material& mat);
+
+    Intersection intersect(const Ray& worldRay) const override;
+    AABB getBounds() const override;
+
+    const std::shared_ptr<const Geometry>& getGeometry() const { return geometry; }
+
+    // Instance kernels shared with the compiled scene. hitDistance finds the world
+    // distance of the closest hit, searching the geometry only up to about
+    // maxWorldDist; normalAt turns the hit into a world normal that faces against the ray.
+    static bool hitDistance(const Geometry& geometry, const Ray& worldRay, const glm::mat4& worldToObject,
+                            float maxWorldDist, float& worldDist, GeometryHit& hit);
+    static glm::vec3 normalAt(const Geometry& geometry, const GeometryHit& hit, const glm::mat4& worldToObject,
+                              const glm::vec3& worldDirection);
+    static bool occludedKernel(const Geometry& geometry, const Ray& worldRay, const glm::mat4& worldToObject,
+                               float maxWorldDist);
+};
@@ -4,27 +4,35 @@
 #include "../intersection.h"
 #include "../transforms.h"
 #include "../utils/material.h"
+#include "../accel/aabb.h"
 
 class Shape {
 protected:
     Transform transform;
+    glm::mat4 worldToObject;    // Cached inverse of transform.modelMatrix
     Material material;
 
 public:
     Shape(const glm::vec3& pos, const Material& mat) 
         : material(mat)
     {
-        transform.modelMatrix = glm::translate(glm::mat4(1.0f), pos);
+        setModelMatrix(glm::translate(glm::mat4(1.0f), pos));
     }
     
     virtual ~Shape() = default;
 
     // Returns intersection in world space
     virtual Intersection intersect(const Ray& worldRay) const = 0;
+
+    // Returns world-space bounds enclosing the shape
+    virtual AABB getBounds() const = 0;
     
     // Transform ray from world space to object space
     Ray transformRayToObjectSpace(const Ray& worldRay) const {
-        glm::mat4 worldToObject = glm::inverse(transform.modelMatrix);
+        return transformRay(worldRay, worldToObject);
+    }
+
+    static Ray transformRay(const Ray& worldRay, const glm::mat4& worldToObject) {
         glm::vec3 origin = Transform::transformPoint(worldRay.getOrigin(), worldToObject);
         glm::vec3 direction = Transform::transformDirection(worldRay.getDirection(), worldToObject);
         return Ray(origin, direction);
@@ -32,9 +40,18 @@ public:
 
     void setModelMatrix(const glm::mat4& matrix) {
         transform.modelMatrix = matrix;
+        worldToObject = glm::inverse(matrix);
     }
 
     glm::mat4 getModelMatrix() const {
         return transform.modelMatrix;
     }
+
+    const glm::mat4& getWorldToObjectMatrix() const {
+        return worldToObject;
+    }
+
+    const Material& getMaterial() const {
+        return material;
+    }
 }; 
\ No newline at end of file
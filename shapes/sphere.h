@@ -12,8 +12,22 @@ public:
     {}
 
     Intersection intersect(const Ray& worldRay) const override {
+        float worldDist;
+        glm::vec3 worldNormal;
+        if (!intersectKernel(worldRay, transform.modelMatrix, worldToObject, radius, worldDist, worldNormal)) {
+            return Intersection();
+        }
+        return Intersection(worldDist, material, worldNormal);
+    }
+
+    // Intersection routines shared with the compiled scene, which stores the matrices
+    // and radius in its own pools. hitDistance finds the world-space distance to the
+    // nearest hit in front of the ray along with the object-space hit point, and
+    // normalAt turns that point into a world-space normal.
+    static bool hitDistance(const Ray& worldRay, const glm::mat4& objectToWorld, const glm::mat4& worldToObject,
+                            float radius, float& worldDist, glm::vec3& objectHitPoint) {
         // Transform ray to object space
-        Ray objectRay = transformRayToObjectSpace(worldRay);
+        Ray objectRay = transformRay(worldRay, worldToObject);
         
         // Perform intersection in object space
         glm::vec3 oc = objectRay.getOrigin();  // In object space, center is at origin
@@ -23,26 +37,45 @@ public:
         float discriminant = b*b - 4*a*c;
 
         if (discriminant < 0) {
-            return Intersection();
+            return false;
         }
 
         float dist = (-b - sqrt(discriminant)) / (2.0f*a);
         if (dist < 0) {
             dist = (-b + sqrt(discriminant)) / (2.0f*a);
             if (dist < 0) {
-                return Intersection();
+                return false;
             }
         }
 
         // Transform intersection point back to world space
-        glm::vec3 objectHitPoint = objectRay.at(dist);
+        objectHitPoint = objectRay.at(dist);
+        glm::vec3 worldHitPoint = Transform::transformPoint(objectHitPoint, objectToWorld);
+        
+        worldDist = glm::length(worldHitPoint - worldRay.getOrigin());
+        return true;
+    }
+
+    static glm::vec3 normalAt(const glm::vec3& objectHitPoint, const glm::mat4& objectToWorld) {
         glm::vec3 objectNormal = glm::normalize(objectHitPoint);  // For sphere, normal is just normalized position
         
         // Transform normal to world space
-        glm::vec3 worldHitPoint = Transform::transformPoint(objectHitPoint, transform.modelMatrix);
-        glm::vec3 worldNormal = glm::normalize(Transform::transformDirection(objectNormal, transform.modelMatrix));
-        
-        float worldDist = glm::length(worldHitPoint - worldRay.getOrigin());
-        return Intersection(worldDist, material, worldNormal);
+        return glm::normalize(Transform::transformDirection(objectNormal, objectToWorld));
+    }
+
+    static bool intersectKernel(const Ray& worldRay, const glm::mat4& objectToWorld, const glm::mat4& worldToObject,
+                                float radius, float& worldDist, glm::vec3& worldNormal) {
+        glm::vec3 objectHitPoint;
+        if (!hitDistance(worldRay, objectToWorld, worldToObject, radius, worldDist, objectHitPoint)) {
+            return false;
+        }
+        worldNormal = normalAt(objectHitPoint, objectToWorld);
+        return true;
+    }
+
+    AABB getBounds() const override {
+        return AABB(glm::vec3(-radius), glm::vec3(radius)).transformed(transform.modelMatrix);
     }
-};
\ No newline at end of file
+
+    float getRadius() const { return radius; }
+};
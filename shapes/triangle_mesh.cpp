@@ -0,0 +1,237 @@
+#include "triangle_mesh.h"
+#include <cmath>
+#include <limits>
+#include <utility>
+#include "../utils/fingerprint.h"
+#include "../utils/thread_pool.h"
+
+void MeshGeometry::reserve(size_t vertexCount, size_t triangleCount) {
+    positionX.reserve(vertexCount);
+    positionY.reserve(vertexCount);
+    positionZ.reserve(vertexCount);
+    positionIndices.reserve(triangleCount * 3);
+}
+
+uint32_t MeshGeometry::addPosition(const glm::vec3& p) {
+    positionX.push_back(p.x);
+    positionY.push_back(p.y);
+    positionZ.push_back(p.z);
+    return static_cast<uint32_t>(positionX.size() - 1);
+}
+
+uint32_t MeshGeometry::addNormal(const glm::vec3& n) {
+    normalX.push_back(n.x);
+    normalY.push_back(n.y);
+    normalZ.push_back(n.z);
+    return static_cast<uint32_t>(normalX.size() - 1);
+}
+
+void MeshGeometry::addTriangle(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t n0, uint32_t n1, uint32_t n2) {
+    positionIndices.push_back(p0);
+    positionIndices.push_back(p1);
+    positionIndices.push_back(p2);
+
+    bool hasNormals = n0 != NO_NORMAL && n1 != NO_NORMAL && n2 != NO_NORMAL;
+    if (hasNormals && normalIndices.empty()) {
+        // First triangle with normals: earlier triangles have none
+        normalIndices.assign(positionIndices.size() - 3, NO_NORMAL);
+    }
+    if (!normalIndices.empty()) {
+        normalIndices.push_back(hasNormals ? n0 : NO_NORMAL);
+        normalIndices.push_back(hasNormals ? n1 : NO_NORMAL);
+        normalIndices.push_back(hasNormals ? n2 : NO_NORMAL);
+    }
+}
+
+void MeshGeometry::build(ThreadPool* pool) {
+    int triangleCount = static_cast<int>(getTriangleCount());
+    std::vector<AABB> triangleBounds(triangleCount);
+    auto computeBounds = [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            AABB box;
+            for (int corner = 0; corner < 3; ++corner) {
+                box.expand(position(positionIndices[i * 3 + corner]));
+            }
+            triangleBounds[i] = box;
+        }
+    };
+
+    const int CHUNK = 16384;
+    int chunkCount = (triangleCount + CHUNK - 1) / CHUNK;
+    if (pool && chunkCount > 1) {
+        pool->parallelFor(chunkCount, [&](int chunk) {
+            computeBounds(chunk * CHUNK, std::min((chunk + 1) * CHUNK, triangleCount));
+        });
+    } else {
+        computeBounds(0, triangleCount);
+    }
+
+    bvh.build(triangleBounds, 4, pool);
+
+    bounds = AABB();
+    for (const AABB& box : triangleBounds) {
+        bounds.expand(box);
+    }
+
+    // Store triangles in leaf order, so the BVH's leaf slots are triangle indices
+    // and a leaf's triangles sit next to each other in memory
+    const std::vector<uint32_t>& order = bvh.getPrimitiveIndices();
+    std::vector<uint32_t> sortedPositions;
+    std::vector<uint32_t> sortedNormals;
+    sortedPositions.reserve(order.size() * 3);
+    sortedNormals.reserve(normalIndices.empty() ? 0 : order.size() * 3);
+    for (uint32_t triangle : order) {
+        for (int corner = 0; corner < 3; ++corner) {
+            sortedPositions.push_back(positionIndices[triangle * 3 + corner]);
+            if (!normalIndices.empty()) {
+                sortedNormals.push_back(normalIndices[triangle * 3 + corner]);
+            }
+        }
+    }
+    positionIndices.swap(sortedPositions);
+    normalIndices.swap(sortedNormals);
+}
+
+// Per-ray constants of the watertight test: the ray is sheared so that it runs
+// along +z, after which each triangle is tested in 2D with exact edge functions
+struct WatertightRay {
+    glm::vec3 origin;
+    int kx, ky, kz;
+    float shearX, shearY, shearZ;
+
+    explicit WatertightRay(const Ray& ray) : origin(ray.getOrigin()) {
+        glm::vec3 direction = ray.getDirection();
+        glm::vec3 magnitude = glm::abs(direction);
+        kz = 0;
+        if (magnitude.y > magnitude[kz]) kz = 1;
+        if (magnitude.z > magnitude[kz]) kz = 2;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // Keep the winding of the sheared triangle independent of the direction's sign
+        if (direction[kz] < 0.0f) std::swap(kx, ky);
+
+        shearX = direction[kx] / direction[kz];
+        shearY = direction[ky] / direction[kz];
+        shearZ = 1.0f / direction[kz];
+    }
+
+    // Returns true for a hit with 0 < t < tMax and fills t and the barycentrics
+    bool test(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tMax,
+              float& t, float& u, float& v) const {
+        glm::vec3 a = p0 - origin;
+        glm::vec3 b = p1 - origin;
+        glm::vec3 c = p2 - origin;
+
+        float ax = a[kx] - shearX * a[kz];
+        float ay = a[ky] - shearY * a[kz];
+        float bx = b[kx] - shearX * b[kz];
+        float by = b[ky] - shearY * b[kz];
+        float cx = c[kx] - shearX * c[kz];
+        float cy = c[ky] - shearY * c[kz];
+
+        float e0 = cx * by - cy * bx;
+        float e1 = ax * cy - ay * cx;
+        float e2 = bx * ay - by * ax;
+
+        // Edges exactly through the ray are decided in double precision, so
+        // neighbouring triangles always agree on who owns the edge
+        if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f) {
+            e0 = static_cast<float>(double(cx) * double(by) - double(cy) * double(bx));
+            e1 = static_cast<float>(double(ax) * double(cy) - double(ay) * double(cx));
+            e2 = static_cast<float>(double(bx) * double(ay) - double(by) * double(ax));
+        }
+
+        if ((e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) && (e0 > 0.0f || e1 > 0.0f || e2 > 0.0f)) {
+            return false;
+        }
+        float det = e0 + e1 + e2;
+        if (det == 0.0f) {
+            return false;
+        }
+
+        float az = shearZ * a[kz];
+        float bz = shearZ * b[kz];
+        float cz = shearZ * c[kz];
+        float scaledT = e0 * az + e1 * bz + e2 * cz;
+
+        // Compare the unnormalised distance against the range, sign-corrected by det
+        if (det < 0.0f ? (scaledT >= 0.0f || scaledT < tMax * det) : (scaledT <= 0.0f || scaledT > tMax * det)) {
+            return false;
+        }
+
+        float inverseDet = 1.0f / det;
+        t = scaledT * inverseDet;
+        u = e1 * inverseDet;
+        v = e2 * inverseDet;
+        return t < tMax;
+    }
+};
+
+bool MeshGeometry::intersect(const Ray& ray, float tMax, GeometryHit& hit) const {
+    WatertightRay sheared(ray);
+    bool found = false;
+
+    bvh.intersectOrdered(ray, tMax, [&](uint32_t triangle, float& maxDistance) {
+        const uint32_t* corners = &positionIndices[triangle * 3];
+        float t, u, v;
+        if (sheared.test(position(corners[0]), position(corners[1]), position(corners[2]), maxDistance, t, u, v)) {
+            maxDistance = t;
+            hit = {t, triangle, u, v};
+            found = true;
+        }
+    });
+    return found;
+}
+
+bool MeshGeometry::occluded(const Ray& ray, float tMax) const {
+    WatertightRay sheared(ray);
+    return bvh.occluded(ray, tMax, [&](uint32_t triangle) {
+        const uint32_t* corners = &positionIndices[triangle * 3];
+        float t, u, v;
+        return sheared.test(position(corners[0]), position(corners[1]), position(corners[2]), tMax, t, u, v);
+    });
+}
+
+size_t MeshGeometry::getMemoryBytes() const {
+    size_t floats = positionX.capacity() + positionY.capacity() + positionZ.capacity() +
+                    normalX.capacity() + normalY.capacity() + normalZ.capacity();
+    size_t indices = positionIndices.capacity() + normalIndices.capacity() + bvh.getPrimitiveIndices().capacity();
+    return floats * sizeof(float) + indices * sizeof(uint32_t) + bvh.getNodes().capacity() * sizeof(BVHNode);
+}
+
+void MeshGeometry::addToFingerprint(Fingerprint& fingerprint) const {
+    fingerprint.addArray(positionX);
+    fingerprint.addArray(positionY);
+    fingerprint.addArray(positionZ);
+    fingerprint.addArray(normalX);
+    fingerprint.addArray(normalY);
+    fingerprint.addArray(normalZ);
+    fingerprint.addArray(positionIndices);
+    fingerprint.addArray(normalIndices);
+}
+
+glm::vec3 MeshGeometry::normalAt(const GeometryHit& hit) const {
+    size_t base = static_cast<size_t>(hit.element) * 3;
+    if (!normalIndices.empty() && normalIndices[base] != NO_NORMAL) {
+        float w = 1.0f - hit.u - hit.v;
+        glm::vec3 normal(0.0f);
+        const float weights[3] = { w, hit.u, hit.v };
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t n = normalIndices[base + corner];
+            normal += weights[corner] * glm::vec3(normalX[n], normalY[n], normalZ[n]);
+        }
+        if (glm::dot(normal, normal) > 0.0f) {
+            return glm::normalize(normal);
+        }
+    }
+
+    glm::vec3 p0 = position(positionIndices[base]);
+    glm::vec3 p1 = position(positionIndices[base + 1]);
+    glm::vec3 p2 = position(positionIndices[base + 2]);
+    return glm::normalize(glm::cross(p1 - p0, p2 - p0));
+}
+
+TriangleMesh::TriangleMesh(std::shared_ptr<const MeshGeometry> meshGeometry, const glm::vec3& pos,
+                           const glm::vec3& scale, const Material& mat)
+    : Instance(std::move(meshGeometry), glm::scale(glm::translate(glm::mat4(1.0f), pos), scale), mat)
+{}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "instance.h"
+#include "../accel/bvh.h"
+
+class ThreadPool;
+
+// Indexed triangle geometry in structure-of-arrays layout, with its own BVH.
+// Meshes that share geometry share one of these, so its vertices and hierarchy
+// are stored once however often the mesh appears. Hits report the triangle as
+// the element and the barycentric weights of its second and third vertex as u, v.
+class MeshGeometry : public Geometry {
+private:
+    // Vertex positions and optional vertex normals, one entry per vertex
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> normalX, normalY, normalZ;
+
+    // Three position indices per triangle, and three normal indices when normals are present
+    std::vector<uint32_t> positionIndices;
+    std::vector<uint32_t> normalIndices;
+
+    BVH bvh;
+    AABB bounds;
+
+    glm::vec3 position(uint32_t vertex) const {
+        return glm::vec3(positionX[vertex], positionY[vertex], positionZ[vertex]);
+    }
+
+public:
+    static constexpr uint32_t NO_NORMAL = 0xffffffffu;
+
+    // Filling. Indices refer to vertices added before build() is called.
+    void reserve(size_t vertexCount, size_t triangleCount);
+    uint32_t addPosition(const glm::vec3& p);
+    uint32_t addNormal(const glm::vec3& n);
+
+    // Corners without a vertex normal pass NO_NORMAL; such triangles use their face normal
+    void addTriangle(uint32_t p0, uint32_t p1, uint32_t p2,
+                     uint32_t n0 = NO_NORMAL, uint32_t n1 = NO_NORMAL, uint32_t n2 = NO_NORMAL);
+
+    // Builds the BVH over the triangles, on the pool's workers when one is given.
+    // Triangles are reordered to BVH leaf order so each leaf reads neighbouring entries.
+    void build(ThreadPool* pool = nullptr);
+
+    // Triangles are tested with the watertight algorithm of Woop, Benthin and
+    // Wald, so rays never slip through shared edges
+    bool intersect(const Ray& ray, float tMax, GeometryHit& hit) const override;
+    bool occluded(const Ray& ray, float tMax) const override;
+
+    // Interpolated from vertex normals when available, the face normal otherwise
+    glm::vec3 normalAt(const GeometryHit& hit) const override;
+
+    AABB getBounds() const override { return bounds; }
+    size_t getMemoryBytes() const override;
+    void addToFingerprint(Fingerprint& fingerprint) const override;
+    size_t getVertexCount() const { return positionX.size(); }
+    size_t getTriangleCount() const { return positionIndices.size() / 3; }
+    const BVH& getBVH() const { return bvh; }
+};
+
+// Instance of triangle geometry placed with a scale and a translation
+class TriangleMesh : public Instance {
+public:
+    // The geometry must have been built. scale is applied before translating to pos.
+    TriangleMesh(std::shared_ptr<const MeshGeometry> meshGeometry, const glm::vec3& pos, const glm::vec3& scale,
+                 const Material& mat);
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+
+// Bit counts on 64-bit lane masks. GCC and Clang compile the builtins to single
+// instructions; other compilers get the portable loops.
+
+// Index of the lowest set bit; mask must not be zero
+inline int lowest_set_bit(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    int index = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+inline int count_set_bits(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(mask);
+#else
+    int count = 0;
+    for (; mask; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
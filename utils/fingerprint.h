@@ -0,0 +1,37 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// FNV-1a over the bytes of each value added
+class Fingerprint {
+private:
+    uint64_t hash = 14695981039346656037ull;
+
+public:
+    void add(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+    }
+
+    template <typename T>
+    void add(const T& value) { add(&value, sizeof(value)); }
+
+    void add(const glm::vec3& v) {
+        add(v.x);
+        add(v.y);
+        add(v.z);
+    }
+
+    // The element count, then the elements' bytes. T must have no padding.
+    template <typename T>
+    void addArray(const std::vector<T>& values) {
+        add(static_cast<uint64_t>(values.size()));
+        add(values.data(), values.size() * sizeof(T));
+    }
+
+    uint64_t value() const { return hash; }
+};
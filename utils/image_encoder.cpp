@@ -0,0 +1,344 @@
+#include "image_encoder.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include "thread_pool.h"
+
+// Writes buffers to a new file, reporting errors that only show up on close
+static bool writeFile(const char* filename, const unsigned char* header, size_t headerSize,
+                      const unsigned char* data, size_t size) {
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        return false;
+    }
+    // Empty buffers may be null, which fwrite does not accept even for zero bytes
+    bool ok = (headerSize == 0 || fwrite(header, 1, headerSize, fp) == headerSize) &&
+              (size == 0 || fwrite(data, 1, size, fp) == size);
+    return fclose(fp) == 0 && ok;
+}
+
+bool ImageEncoder::write(const char* filename, int width, int height, const std::vector<unsigned char>& image) {
+    std::vector<unsigned char> output;
+    if (!encode(width, height, image, output)) {
+        return false;
+    }
+    return writeFile(filename, nullptr, 0, output.data(), output.size());
+}
+
+bool PngEncoder::encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) {
+    PngStreamWriter writer;
+    if (!writer.open(output, width, height, options)) {
+        return false;
+    }
+    for (int y = 0; y < height; ++y) {
+        if (!writer.writeRow(&image[static_cast<size_t>(y) * width * 3])) {
+            return false;
+        }
+    }
+    return writer.close();
+}
+
+bool PngEncoder::write(const char* filename, int width, int height, const std::vector<unsigned char>& image) {
+    // Straight to the file, without holding the encoded stream
+    PngStreamWriter writer;
+    if (!writer.open(filename, width, height, options)) {
+        return false;
+    }
+    for (int y = 0; y < height; ++y) {
+        if (!writer.writeRow(&image[static_cast<size_t>(y) * width * 3])) {
+            return false;
+        }
+    }
+    return writer.close();
+}
+
+static std::string ppmHeader(int width, int height) {
+    return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+}
+
+bool PpmEncoder::encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) {
+    std::string header = ppmHeader(width, height);
+    output.insert(output.end(), header.begin(), header.end());
+    output.insert(output.end(), image.begin(), image.begin() + static_cast<size_t>(width) * height * 3);
+    return true;
+}
+
+bool PpmEncoder::write(const char* filename, int width, int height, const std::vector<unsigned char>& image) {
+    std::string header = ppmHeader(width, height);
+    return writeFile(filename, reinterpret_cast<const unsigned char*>(header.data()), header.size(),
+                     image.data(), static_cast<size_t>(width) * height * 3);
+}
+
+bool RawEncoder::encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) {
+    output.insert(output.end(), image.begin(), image.begin() + static_cast<size_t>(width) * height * 3);
+    return true;
+}
+
+bool RawEncoder::write(const char* filename, int width, int height, const std::vector<unsigned char>& image) {
+    return writeFile(filename, nullptr, 0, image.data(), static_cast<size_t>(width) * height * 3);
+}
+
+bool write_image_rows(const char* filename, ImageFormat format, const PngOptions& options,
+                      int width, int height, const unsigned char* pixels) {
+    size_t rowBytes = static_cast<size_t>(width) * 3;
+    if (format == ImageFormat::Ppm || format == ImageFormat::Raw) {
+        std::string header = format == ImageFormat::Ppm ? ppmHeader(width, height) : std::string();
+        return writeFile(filename, reinterpret_cast<const unsigned char*>(header.data()), header.size(),
+                         pixels, rowBytes * height);
+    }
+
+    PngStreamWriter writer;
+    if (!writer.open(filename, width, height, options)) {
+        return false;
+    }
+    for (int y = 0; y < height; ++y) {
+        if (!writer.writeRow(pixels + static_cast<size_t>(y) * rowBytes)) {
+            return false;
+        }
+    }
+    return writer.close();
+}
+
+// PNG filter types as stored in the first byte of each filtered row
+enum : unsigned char { FILTER_NONE = 0, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH };
+
+static unsigned char paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return static_cast<unsigned char>(a);
+    if (pb <= pc) return static_cast<unsigned char>(b);
+    return static_cast<unsigned char>(c);
+}
+
+// Filters one row of RGB bytes. prev is the unfiltered row above, or nullptr for the first row.
+static void filterRow(unsigned char type, const unsigned char* row, const unsigned char* prev, size_t length,
+                      unsigned char* out) {
+    const size_t BPP = 3;
+    // The first pixel has no left neighbour; one loop per filter keeps the inner loops branch-free
+    size_t lead = std::min(BPP, length);
+    switch (type) {
+    case FILTER_SUB:
+        std::memcpy(out, row, lead);
+        for (size_t i = BPP; i < length; ++i) out[i] = static_cast<unsigned char>(row[i] - row[i - BPP]);
+        break;
+    case FILTER_UP:
+        if (!prev) {
+            std::memcpy(out, row, length);
+            break;
+        }
+        for (size_t i = 0; i < length; ++i) out[i] = static_cast<unsigned char>(row[i] - prev[i]);
+        break;
+    case FILTER_AVERAGE:
+        for (size_t i = 0; i < lead; ++i) out[i] = static_cast<unsigned char>(row[i] - ((prev ? prev[i] : 0) >> 1));
+        for (size_t i = BPP; i < length; ++i) {
+            out[i] = static_cast<unsigned char>(row[i] - ((row[i - BPP] + (prev ? prev[i] : 0)) >> 1));
+        }
+        break;
+    case FILTER_PAETH:
+        if (!prev) {
+            // Without a row above the predictor always picks the left neighbour
+            filterRow(FILTER_SUB, row, prev, length, out);
+            break;
+        }
+        for (size_t i = 0; i < lead; ++i) out[i] = static_cast<unsigned char>(row[i] - prev[i]);
+        for (size_t i = BPP; i < length; ++i) {
+            out[i] = static_cast<unsigned char>(row[i] - paethPredictor(row[i - BPP], prev[i], prev[i - BPP]));
+        }
+        break;
+    default:
+        std::memcpy(out, row, length);
+        break;
+    }
+}
+
+// Sum of the filtered bytes read as signed values, libpng's heuristic for picking a filter
+static uint64_t filterCost(const unsigned char* filtered, size_t length) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        sum += std::abs(static_cast<int>(static_cast<signed char>(filtered[i])));
+    }
+    return sum;
+}
+
+static unsigned char filterType(PngFilter filter) {
+    switch (filter) {
+        case PngFilter::Sub: return FILTER_SUB;
+        case PngFilter::Up: return FILTER_UP;
+        case PngFilter::Average: return FILTER_AVERAGE;
+        case PngFilter::Paeth: return FILTER_PAETH;
+        default: return FILTER_NONE;
+    }
+}
+
+static void put32(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back(static_cast<unsigned char>(value >> 24));
+    out.push_back(static_cast<unsigned char>(value >> 16));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+static void appendChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t length) {
+    put32(out, static_cast<uint32_t>(length));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + length);
+    put32(out, static_cast<uint32_t>(crc32(0, &out[start], static_cast<uInt>(length + 4))));
+}
+
+// Runs task(i) for i in [0, count) on the pool, or inline without one
+static void forEach(ThreadPool* pool, int count, const std::function<void(int)>& task) {
+    if (pool && pool->size() > 1) {
+        pool->parallelFor(count, task);
+    } else {
+        for (int i = 0; i < count; ++i) task(i);
+    }
+}
+
+bool ParallelPngEncoder::encode(int width, int height, const std::vector<unsigned char>& image,
+                                std::vector<unsigned char>& output) {
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    const size_t rowBytes = static_cast<size_t>(width) * 3;
+    const size_t stride = rowBytes + 1;
+
+    // Chunks of about 256 KiB keep every worker busy on large frames while
+    // the dictionary priming keeps the compression loss small
+    const size_t CHUNK_BYTES = 256 * 1024;
+    const size_t DICTIONARY_BYTES = 32 * 1024;
+    int rowsPerChunk = static_cast<int>(std::max<size_t>(1, CHUNK_BYTES / stride));
+    int chunkCount = (height + rowsPerChunk - 1) / rowsPerChunk;
+
+    // Filtering only looks at unfiltered rows, so chunks are filtered independently
+    std::vector<unsigned char> filtered(stride * height);
+    forEach(pool, chunkCount, [&](int chunk) {
+        int rowEnd = std::min(height, (chunk + 1) * rowsPerChunk);
+        bool adaptive = options.filter == PngFilter::Default;
+        std::vector<unsigned char> candidate(adaptive ? rowBytes : 0);
+        for (int y = chunk * rowsPerChunk; y < rowEnd; ++y) {
+            const unsigned char* row = &image[y * rowBytes];
+            const unsigned char* prev = y > 0 ? row - rowBytes : nullptr;
+            unsigned char* out = &filtered[y * stride];
+
+            if (!adaptive) {
+                out[0] = filterType(options.filter);
+                filterRow(out[0], row, prev, rowBytes, out + 1);
+                continue;
+            }
+
+            // Each candidate is filtered into scratch space and kept in place if it is the best so far
+            uint64_t bestCost = UINT64_MAX;
+            for (unsigned char type = FILTER_NONE; type <= FILTER_PAETH; ++type) {
+                filterRow(type, row, prev, rowBytes, candidate.data());
+                uint64_t cost = filterCost(candidate.data(), rowBytes);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    out[0] = type;
+                    std::memcpy(out + 1, candidate.data(), rowBytes);
+                }
+            }
+        }
+    });
+
+    std::vector<std::vector<unsigned char>> pieces(chunkCount);
+    std::vector<uLong> checksums(chunkCount);
+    std::vector<char> failed(chunkCount, 0);
+    forEach(pool, chunkCount, [&](int chunk) {
+        size_t begin = static_cast<size_t>(chunk) * rowsPerChunk * stride;
+        size_t end = std::min(filtered.size(), static_cast<size_t>(chunk + 1) * rowsPerChunk * stride);
+        bool last = chunk == chunkCount - 1;
+        checksums[chunk] = adler32(adler32(0, nullptr, 0), &filtered[begin], static_cast<uInt>(end - begin));
+
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, options.compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            failed[chunk] = 1;
+            return;
+        }
+        if (chunk > 0) {
+            size_t dictionary = std::min(DICTIONARY_BYTES, begin);
+            deflateSetDictionary(&stream, &filtered[begin - dictionary], static_cast<uInt>(dictionary));
+        }
+
+        std::vector<unsigned char>& piece = pieces[chunk];
+        piece.resize(deflateBound(&stream, end - begin) + 64);
+        stream.next_in = &filtered[begin];
+        stream.avail_in = static_cast<uInt>(end - begin);
+        int status;
+        do {
+            if (stream.total_out == piece.size()) {
+                piece.resize(piece.size() * 2);
+            }
+            stream.next_out = piece.data() + stream.total_out;
+            stream.avail_out = static_cast<uInt>(piece.size() - stream.total_out);
+            // A sync flush ends the piece on a byte boundary without ending the stream
+            status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        } while (status == Z_OK && (last || stream.avail_out == 0));
+        failed[chunk] = status != (last ? Z_STREAM_END : Z_OK);
+        piece.resize(stream.total_out);
+        deflateEnd(&stream);
+    });
+
+    // zlib stream: header, the concatenated pieces, then the Adler-32 of everything
+    std::vector<unsigned char> stream = {0x78, 0x9c};
+    uLong checksum = checksums[0];
+    for (int chunk = 0; chunk < chunkCount; ++chunk) {
+        if (failed[chunk]) {
+            return false;
+        }
+        stream.insert(stream.end(), pieces[chunk].begin(), pieces[chunk].end());
+        if (chunk > 0) {
+            size_t begin = static_cast<size_t>(chunk) * rowsPerChunk * stride;
+            size_t end = std::min(filtered.size(), static_cast<size_t>(chunk + 1) * rowsPerChunk * stride);
+            checksum = adler32_combine(checksum, checksums[chunk], static_cast<z_off_t>(end - begin));
+        }
+    }
+    put32(stream, static_cast<uint32_t>(checksum));
+
+    static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    output.insert(output.end(), SIGNATURE, SIGNATURE + 8);
+
+    std::vector<unsigned char> header;
+    put32(header, static_cast<uint32_t>(width));
+    put32(header, static_cast<uint32_t>(height));
+    header.insert(header.end(), {8, 2, 0, 0, 0});   // 8-bit RGB, deflate, adaptive filtering, no interlace
+    appendChunk(output, "IHDR", header.data(), header.size());
+
+    const size_t IDAT_BYTES = 1 << 20;
+    for (size_t offset = 0; offset < stream.size(); offset += IDAT_BYTES) {
+        appendChunk(output, "IDAT", &stream[offset], std::min(IDAT_BYTES, stream.size() - offset));
+    }
+    appendChunk(output, "IEND", nullptr, 0);
+    return true;
+}
+
+std::unique_ptr<ImageEncoder> make_image_encoder(ImageFormat format, const PngOptions& options, ThreadPool* pool) {
+    switch (format) {
+        case ImageFormat::ParallelPng: return std::make_unique<ParallelPngEncoder>(options, pool);
+        case ImageFormat::Ppm: return std::make_unique<PpmEncoder>();
+        case ImageFormat::Raw: return std::make_unique<RawEncoder>();
+        default: return std::make_unique<PngEncoder>(options);
+    }
+}
+
+const char* image_format_extension(ImageFormat format) {
+    switch (format) {
+        case ImageFormat::Ppm: return "ppm";
+        case ImageFormat::Raw: return "rgb";
+        default: return "png";
+    }
+}
+
+bool parse_image_format(const std::string& name, ImageFormat& format) {
+    if (name == "png") format = ImageFormat::Png;
+    else if (name == "png-parallel") format = ImageFormat::ParallelPng;
+    else if (name == "ppm") format = ImageFormat::Ppm;
+    else if (name == "raw") format = ImageFormat::Raw;
+    else return false;
+    return true;
+}
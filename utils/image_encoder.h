@@ -0,0 +1,85 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "png_writer.h"
+
+class ThreadPool;
+
+// File formats a frame can be written in
+enum class ImageFormat {
+    Png,            // libpng on the calling thread
+    ParallelPng,    // PNG with rows filtered and deflated in parallel chunks
+    Ppm,            // Binary PPM (P6): a short header and the pixels as they are
+    Raw             // The bare RGB bytes, row-major, no header
+};
+
+// Encodes 8-bit RGB frames of width * height * 3 bytes
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() = default;
+
+    // Appends the encoded image to output
+    virtual bool encode(int width, int height, const std::vector<unsigned char>& image,
+                        std::vector<unsigned char>& output) = 0;
+
+    // Writes the encoded image to a file. Formats that need no encoding
+    // override this to write the pixels without an intermediate copy.
+    virtual bool write(const char* filename, int width, int height, const std::vector<unsigned char>& image);
+};
+
+class PngEncoder : public ImageEncoder {
+private:
+    PngOptions options;
+
+public:
+    explicit PngEncoder(const PngOptions& options = PngOptions()) : options(options) {}
+
+    bool encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) override;
+    bool write(const char* filename, int width, int height, const std::vector<unsigned char>& image) override;
+};
+
+// Splits the filtered image into chunks of rows and deflates them concurrently.
+// Each chunk is primed with the 32 KiB of data before it and all but the last
+// end on a sync flush, so the pieces concatenate into one zlib stream that
+// compresses almost as well as a serial encode. PngFilter::Default picks the
+// filter of each row by the minimum sum of absolute differences, as libpng does.
+class ParallelPngEncoder : public ImageEncoder {
+private:
+    PngOptions options;
+    ThreadPool* pool;   // nullptr encodes the chunks serially
+
+public:
+    ParallelPngEncoder(const PngOptions& options, ThreadPool* pool) : options(options), pool(pool) {}
+
+    bool encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) override;
+};
+
+class PpmEncoder : public ImageEncoder {
+public:
+    bool encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) override;
+    bool write(const char* filename, int width, int height, const std::vector<unsigned char>& image) override;
+};
+
+class RawEncoder : public ImageEncoder {
+public:
+    bool encode(int width, int height, const std::vector<unsigned char>& image, std::vector<unsigned char>& output) override;
+    bool write(const char* filename, int width, int height, const std::vector<unsigned char>& image) override;
+};
+
+// Encoder for a format. PNG options apply to both PNG encoders; the pool is
+// used by the parallel one.
+std::unique_ptr<ImageEncoder> make_image_encoder(ImageFormat format, const PngOptions& options, ThreadPool* pool);
+
+// Writes a frame that is not held in a vector, such as one in a memory-mapped
+// file, reading its rows in place. Both PNG formats go through PngStreamWriter on
+// the calling thread, so nothing but the current row is buffered; PPM and raw
+// write the pixels as they are.
+bool write_image_rows(const char* filename, ImageFormat format, const PngOptions& options,
+                      int width, int height, const unsigned char* pixels);
+
+// Conventional file extension of a format, without the dot
+const char* image_format_extension(ImageFormat format);
+
+// Parses "png", "png-parallel", "ppm" or "raw"
+bool parse_image_format(const std::string& name, ImageFormat& format);
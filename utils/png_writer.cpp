@@ -0,0 +1,148 @@
+#include "png_writer.h"
+#include <png.h>
+
+PngStreamWriter::PngStreamWriter()
+    : fp(nullptr)
+    , memory(nullptr)
+    , png(nullptr)
+    , info(nullptr)
+    , width(0)
+    , height(0)
+    , rowsWritten(0)
+{}
+
+PngStreamWriter::~PngStreamWriter() {
+    destroy();
+}
+
+void PngStreamWriter::destroy() {
+    if (png) {
+        png_structp pngPtr = static_cast<png_structp>(png);
+        png_infop infoPtr = static_cast<png_infop>(info);
+        png_destroy_write_struct(&pngPtr, infoPtr ? &infoPtr : nullptr);
+        png = nullptr;
+        info = nullptr;
+    }
+    if (fp) {
+        fclose(fp);
+        fp = nullptr;
+    }
+    memory = nullptr;
+}
+
+static void appendToMemory(png_structp pngPtr, png_bytep data, png_size_t length) {
+    auto* output = static_cast<std::vector<unsigned char>*>(png_get_io_ptr(pngPtr));
+    output->insert(output->end(), data, data + length);
+}
+
+static void flushMemory(png_structp) {}
+
+static int filterFlags(PngFilter filter) {
+    switch (filter) {
+        case PngFilter::None: return PNG_FILTER_NONE;
+        case PngFilter::Sub: return PNG_FILTER_SUB;
+        case PngFilter::Up: return PNG_FILTER_UP;
+        case PngFilter::Average: return PNG_FILTER_AVG;
+        case PngFilter::Paeth: return PNG_FILTER_PAETH;
+        default: return PNG_ALL_FILTERS;
+    }
+}
+
+bool PngStreamWriter::open(const char* filename, int imageWidth, int imageHeight, const PngOptions& options) {
+    destroy();
+    width = imageWidth;
+    height = imageHeight;
+    rowsWritten = 0;
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        return false;
+    }
+    return start(options);
+}
+
+bool PngStreamWriter::open(std::vector<unsigned char>& output, int imageWidth, int imageHeight, const PngOptions& options) {
+    destroy();
+    width = imageWidth;
+    height = imageHeight;
+    rowsWritten = 0;
+    memory = &output;
+    return start(options);
+}
+
+bool PngStreamWriter::start(const PngOptions& options) {
+    png_structp pngPtr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!pngPtr) {
+        destroy();
+        return false;
+    }
+    png = pngPtr;
+
+    png_infop infoPtr = png_create_info_struct(pngPtr);
+    if (!infoPtr) {
+        destroy();
+        return false;
+    }
+    info = infoPtr;
+
+    if (setjmp(png_jmpbuf(pngPtr))) {
+        destroy();
+        return false;
+    }
+
+    if (memory) {
+        png_set_write_fn(pngPtr, memory, appendToMemory, flushMemory);
+    } else {
+        png_init_io(pngPtr, fp);
+    }
+
+    if (options.compressionLevel >= 0) {
+        png_set_compression_level(pngPtr, options.compressionLevel);
+    }
+    if (options.filter != PngFilter::Default) {
+        png_set_filter(pngPtr, PNG_FILTER_TYPE_BASE, filterFlags(options.filter));
+    }
+
+    // Set image attributes
+    png_set_IHDR(pngPtr, infoPtr, width, height, 8, 
+                 PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(pngPtr, infoPtr);
+    return true;
+}
+
+bool PngStreamWriter::writeRow(const unsigned char* row) {
+    if (!png || rowsWritten >= height) {
+        return false;
+    }
+
+    png_structp pngPtr = static_cast<png_structp>(png);
+    if (setjmp(png_jmpbuf(pngPtr))) {
+        destroy();
+        return false;
+    }
+
+    png_write_row(pngPtr, const_cast<png_bytep>(row));
+    ++rowsWritten;
+    return true;
+}
+
+bool PngStreamWriter::close() {
+    if (!png || rowsWritten != height) {
+        destroy();
+        return false;
+    }
+
+    png_structp pngPtr = static_cast<png_structp>(png);
+    if (setjmp(png_jmpbuf(pngPtr))) {
+        destroy();
+        return false;
+    }
+
+    png_write_end(pngPtr, static_cast<png_infop>(info));
+
+    // Report write errors that only show up when the file is flushed
+    bool ok = !fp || fflush(fp) == 0;
+    destroy();
+    return ok;
+}
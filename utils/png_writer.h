@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+
+// Row filter applied before deflate. Filtering helps compression but costs encode time.
+enum class PngFilter {
+    Default,    // Let libpng choose adaptively among all filters
+    None,
+    Sub,
+    Up,
+    Average,
+    Paeth
+};
+
+struct PngOptions {
+    int compressionLevel;   // zlib level 0 (store) to 9 (smallest), -1 for the zlib default
+    PngFilter filter;
+
+    PngOptions()
+        : compressionLevel(-1)
+        , filter(PngFilter::Default)
+    {}
+};
+
+// Incremental 8-bit RGB PNG encoder. Rows are passed to libpng one at a time, in
+// order, as soon as they are available, so the whole image never has to be held
+// in memory.
+class PngStreamWriter {
+private:
+    FILE* fp;
+    std::vector<unsigned char>* memory;     // Receives the stream instead of fp when set
+    void* png;      // png_structp, kept opaque so that png.h stays out of this header
+    void* info;     // png_infop
+    int width;
+    int height;
+    int rowsWritten;
+
+    void destroy();
+
+    // Sets up libpng for the opened destination and writes the header
+    bool start(const PngOptions& options);
+
+public:
+    PngStreamWriter();
+    ~PngStreamWriter();
+
+    PngStreamWriter(const PngStreamWriter&) = delete;
+    PngStreamWriter& operator=(const PngStreamWriter&) = delete;
+
+    // Creates the file and writes the PNG header
+    bool open(const char* filename, int width, int height, const PngOptions& options = PngOptions());
+
+    // Appends the encoded stream to output instead of writing a file
+    bool open(std::vector<unsigned char>& output, int width, int height, const PngOptions& options = PngOptions());
+
+    // Appends the next row of width * 3 bytes
+    bool writeRow(const unsigned char* row);
+
+    // Finishes the stream once every row has been written
+    bool close();
+
+    int getRowsWritten() const { return rowsWritten; }
+};
@@ -1,5 +1,7 @@
 #pragma once
+#include <atomic>
 #include <iostream>
+#include <mutex>
 #include <string>
 
 class ProgressBar {
@@ -7,12 +9,14 @@ private:
     int width;
     int total;
     std::string prefix;
+    std::atomic<int> completed;
+    std::atomic<int> lastPercent;   // Last percentage drawn, used to skip redundant redraws
+    std::mutex drawMutex;
+    bool visible;
 
-public:
-    ProgressBar(int total_steps, int bar_width = 50, const std::string& prefix_text = "Rendering: ")
-        : width(bar_width), total(total_steps), prefix(prefix_text) {}
+    void draw(int current) {
+        if (!visible) return;
 
-    void update(int current) {
         float progress = static_cast<float>(current) / total;
         int pos = static_cast<int>(width * progress);
 
@@ -30,4 +34,41 @@ public:
             std::cout << std::endl;
         }
     }
-}; 
\ No newline at end of file
+
+public:
+    ProgressBar(int total_steps, int bar_width = 50, const std::string& prefix_text = "Rendering: ")
+        : width(bar_width), total(total_steps), prefix(prefix_text), completed(0), lastPercent(-1), visible(true) {}
+
+    // Hidden bars still count progress but never touch the console
+    void setVisible(bool show) { visible = show; }
+
+    void update(int current) {
+        std::lock_guard<std::mutex> lock(drawMutex);
+        completed.store(current);
+        draw(current);
+    }
+
+    // Thread-safe increment. Only redraws when the visible percentage changes,
+    // and a worker that finds the console busy skips the redraw instead of waiting.
+    void advance(int steps = 1) {
+        int current = completed.fetch_add(steps) + steps;
+        int percent = static_cast<int>(100.0f * current / total);
+
+        if (current == total) {
+            std::lock_guard<std::mutex> lock(drawMutex);
+            lastPercent.store(100);
+            draw(current);
+            return;
+        }
+
+        int previous = lastPercent.load();
+        if (percent <= previous) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(drawMutex, std::try_to_lock);
+        if (lock.owns_lock() && lastPercent.compare_exchange_strong(previous, percent)) {
+            draw(current);
+        }
+    }
+};
\ No newline at end of file
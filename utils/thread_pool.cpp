@@ -0,0 +1,108 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threadCount)
+    : generation(0)
+    , remaining(0)
+    , stopping(false)
+{
+    if (threadCount <= 0) {
+        threadCount = defaultThreadCount();
+    }
+
+    for (int i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (int i = 0; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::defaultThreadCount() {
+    unsigned int count = std::thread::hardware_concurrency();
+    return count > 0 ? static_cast<int>(count) : 1;
+}
+
+void ThreadPool::parallelFor(int count, const Task& task) {
+    if (count <= 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    int workerCount = size();
+    remaining.store(count);
+
+    // Hand every worker a contiguous block so neighbouring items stay on one thread
+    for (int w = 0; w < workerCount; ++w) {
+        int begin = static_cast<int>(static_cast<long long>(count) * w / workerCount);
+        int end = static_cast<int>(static_cast<long long>(count) * (w + 1) / workerCount);
+        std::lock_guard<std::mutex> queueLock(queues[w]->mutex);
+        for (int i = begin; i < end; ++i) {
+            queues[w]->items.emplace_back(&task, i);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ++generation;
+    wake.notify_all();
+    done.wait(lock, [this] { return remaining.load() == 0; });
+}
+
+bool ThreadPool::popLocal(int index, WorkItem& item) {
+    WorkQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty()) {
+        return false;
+    }
+    item = queue.items.front();
+    queue.items.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(int thief, WorkItem& item) {
+    int workerCount = size();
+    for (int offset = 1; offset < workerCount; ++offset) {
+        WorkQueue& victim = *queues[(thief + offset) % workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.items.empty()) {
+            item = victim.items.back();
+            victim.items.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(int index) {
+    unsigned long seenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        WorkItem item;
+        while (popLocal(index, item) || steal(index, item)) {
+            (*item.first)(item.second);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+}
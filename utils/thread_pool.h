@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Persistent pool of worker threads with one work queue per worker.
+// Each batch is split into contiguous blocks, one per worker. Workers drain
+// their own block from the front and steal from the back of other blocks once
+// they run dry, so uneven task costs balance out.
+class ThreadPool {
+private:
+    using Task = std::function<void(int)>;
+    using WorkItem = std::pair<const Task*, int>;
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<WorkItem> items;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::mutex submitMutex;        // Serializes concurrent parallelFor calls
+    unsigned long generation;      // Bumped for every submitted batch
+    std::atomic<int> remaining;    // Work items not yet finished in the current batch
+    bool stopping;
+
+    void workerLoop(int index);
+    bool popLocal(int index, WorkItem& item);
+    bool steal(int thief, WorkItem& item);
+
+public:
+    // threadCount <= 0 uses the hardware concurrency
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()); }
+
+    // Runs task(i) for every i in [0, count) and blocks until all calls have returned.
+    // Must not be called from inside a task running on the same pool.
+    void parallelFor(int count, const Task& task);
+
+    static int defaultThreadCount();
+};
@@ -1,49 +1,62 @@
 #include "utils.h"
 #include <png.h>
-#include <stdexcept>
+#include <cstdio>
+#include <cstring>
 
-bool write_png(const char* filename, int width, int height, const std::vector<unsigned char>& image) {
-    FILE* fp = fopen(filename, "wb");
-    if (!fp) {
+bool write_png(const char* filename, int width, int height, const std::vector<unsigned char>& image,
+               const PngOptions& options) {
+    PngStreamWriter writer;
+    if (!writer.open(filename, width, height, options)) {
         return false;
     }
 
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png) {
-        fclose(fp);
-        return false;
+    for (int y = 0; y < height; ++y) {
+        if (!writer.writeRow(&image[y * width * 3])) {
+            return false;
+        }
     }
 
-    png_infop info = png_create_info_struct(png);
-    if (!info) {
-        png_destroy_write_struct(&png, nullptr);
-        fclose(fp);
-        return false;
-    }
+    return writer.close();
+}
 
-    if (setjmp(png_jmpbuf(png))) {
-        png_destroy_write_struct(&png, &info);
-        fclose(fp);
+bool read_png(const char* filename, int& width, int& height, std::vector<unsigned char>& image) {
+    png_image png;
+    std::memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&png, filename)) {
         return false;
     }
 
-    png_init_io(png, fp);
-
-    // Set image attributes
-    png_set_IHDR(png, info, width, height, 8, 
-                 PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-    // Allocate row pointers
-    std::vector<png_bytep> row_pointers(height);
-    for (int y = 0; y < height; ++y) {
-        row_pointers[y] = (png_bytep)&image[y * width * 3];
+    png.format = PNG_FORMAT_RGB;
+    image.resize(PNG_IMAGE_SIZE(png));
+    if (!png_image_finish_read(&png, nullptr, image.data(), 0, nullptr)) {
+        png_image_free(&png);
+        return false;
     }
-
-    png_set_rows(png, info, row_pointers.data());
-    png_write_png(png, info, PNG_TRANSFORM_IDENTITY, nullptr);
-
-    png_destroy_write_struct(&png, &info);
-    fclose(fp);
+    width = static_cast<int>(png.width);
+    height = static_cast<int>(png.height);
     return true;
-} 
\ No newline at end of file
+}
+
+std::string json_escape(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char code[7];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
@@ -1,6 +1,14 @@
 #pragma once
 #include <vector>
 #include <string>
+#include "png_writer.h"
 
 // Write image data to a PNG file
-bool write_png(const char* filename, int width, int height, const std::vector<unsigned char>& image);
+bool write_png(const char* filename, int width, int height, const std::vector<unsigned char>& image,
+               const PngOptions& options = PngOptions());
+
+// Read a PNG file as 8-bit RGB, whatever its colour type and bit depth
+bool read_png(const char* filename, int& width, int& height, std::vector<unsigned char>& image);
+
+// Escape text for use inside a JSON string literal
+std::string json_escape(const std::string& text);